@@ -5,10 +5,18 @@
 
 
 #include <limits>
+#include <memory>
 #include <stdint.h>
 
 #include "StoragePage.h"
+#include "StorageLog.h"
 #include "StorageType.h"
+#include "StorageWear.h"
+#include "StorageIndex.h"
+#include "StorageAllocator.h"
+#include "StorageContext.h"
+#include "StorageCheckpoint.h"
+#include "StorageHeaderCache.h"
 #include "StorageMacroblock.h"
 
 
@@ -21,9 +29,29 @@
 class IStorageDriver
 {
 public:
-	virtual StorageStatus read(const uint32_t, uint8_t*, const uint32_t)        { return STORAGE_ERROR; }
-	virtual StorageStatus write(const uint32_t, const uint8_t*, const uint32_t) { return STORAGE_ERROR; }
-	virtual StorageStatus erase(const uint32_t*, const uint32_t)                { return STORAGE_ERROR; }
+	virtual StorageStatus read(const uint32_t, uint8_t*, const uint32_t)              { return STORAGE_ERROR; }
+	virtual StorageStatus write(const uint32_t, const uint8_t*, const uint32_t)       { return STORAGE_ERROR; }
+	virtual StorageStatus erase(const uint32_t*, const uint32_t)                      { return STORAGE_ERROR; }
+
+	/* Optional vectored requests, used only if the capabilities mask declares them */
+	virtual StorageStatus readv(const StorageIOVec*, const uint32_t)                  { return STORAGE_ERROR; }
+	virtual StorageStatus writev(const StorageIOVec*, const uint32_t)                 { return STORAGE_ERROR; }
+
+	/* Optional whole erase sector erase by the sector start address, used only if the capabilities mask declares it */
+	virtual StorageStatus eraseSector(const uint32_t)                                 { return STORAGE_ERROR; }
+
+	/*
+	 * Optional asynchronous requests, used only if the capabilities mask declares them.
+	 * submit* returns STORAGE_OK if the request was accepted, the buffer must not be
+	 * released until poll returns anything except STORAGE_BUSY (the request result).
+	 */
+	virtual StorageStatus submitRead(const uint32_t, uint8_t*, const uint32_t)        { return STORAGE_ERROR; }
+	virtual StorageStatus submitWrite(const uint32_t, const uint8_t*, const uint32_t) { return STORAGE_ERROR; }
+	virtual StorageStatus submitErase(const uint32_t*, const uint32_t)                { return STORAGE_ERROR; }
+	virtual StorageStatus poll()                                                      { return STORAGE_ERROR; }
+
+	/* Returns StorageDriverCapability bit mask */
+	virtual uint32_t capabilities()                                                   { return STORAGE_DRIVER_CAP_NONE; }
 };
 
 /*
@@ -35,25 +63,57 @@ public:
 class StorageAT
 {
 private:
-	/* Storage pages count */
-	static uint32_t m_pagesCount;
+	friend class StorageOperation;
 
-	/* Storage read/write driver */
-	static IStorageDriver* m_driver;
+	/* Storage instance state (geometry, driver and in-RAM indexes) */
+	StorageContext m_context;
 
-	/* Storage minimum erase size */
-	static uint32_t m_minEraseSize;
+	/*
+	 * Saves changed cached headers after the operation
+	 *
+	 * @param status The operation result
+	 * @return       Returns the operation result or the headers saving error
+	 */
+	static StorageStatus flushHeaders(StorageStatus status);
+
+	/*
+	 * Marks the headers checkpoint as stale before the memory change
+	 *
+	 * @return Returns STORAGE_OK if the memory may be changed
+	 */
+	static StorageStatus invalidateCheckpoint();
+
+	/*
+	 * Checks that the data fits the memory (the data of the wear leveling and
+	 * log modes may wrap around the memory end, so only the start is checked)
+	 *
+	 * @param address Data start address
+	 * @param len     Data length in bytes
+	 * @return        Returns true if the data is out of memory
+	 */
+	static bool isOutOfMemory(uint32_t address, uint32_t len);
+
+	/*
+	 * Checks that the pages are one whole erase sector in the address order and
+	 * the driver erases the sector natively
+	 *
+	 * @param addresses Page addresses for erase
+	 * @param count     Pages count
+	 * @return          Returns true if the pages are erased with one eraseSector request
+	 */
+	static bool isSectorErase(const uint32_t* addresses, const uint32_t count);
 
 public:
 	/* Max available address for StorageFS */
 	static const uint32_t MAX_ADDRESS = std::numeric_limits<uint32_t>::max();
 
 	/*
-	 * Storage Allocation Table constructor
+	 * Storage Allocation Table constructor (binds the instance to the constructing thread, see bind)
 	 *
 	 * @param pagesCount   Physical drive pages count
 	 * @param driver       Physical drive read/write driver
-	 * @param minEraseSize Minimal erase sector size
+	 * @param minEraseSize Minimal erase sector size (any size, the macroblocks are
+	 *                     aligned to the erase sectors that fit one or more macroblocks)
 	 */
 	StorageAT(
 		uint32_t        pagesCount,
@@ -61,6 +121,29 @@ public:
 		uint32_t        minEraseSize
 	);
 
+	/*
+	 * Storage Allocation Table destructor
+	 */
+	~StorageAT();
+
+	/* The instance owns its state and locks, so it is not copied */
+	StorageAT(const StorageAT&) = delete;
+	StorageAT& operator=(const StorageAT&) = delete;
+
+	/*
+	 * Binds the instance to the calling thread for the direct use of Page, Header,
+	 * StorageMacroblock and the static StorageAT functions outside of the instance
+	 * calls (until the next bind, unbind or the thread exit). The instance has to be
+	 * unbound on the other threads before the destruction (the destructor unbinds
+	 * the destroying thread and asserts that no other thread keeps the binding).
+	 */
+	void bind();
+
+	/*
+	 * Unbinds the instance from the calling thread if it is bound
+	 */
+	void unbind();
+
 	/*
 	 * Find data in storage
 	 * 
@@ -125,6 +208,26 @@ public:
 		uint32_t    len
 	);
 
+	/*
+	 * Writes the new version of the data at the log write head (the log mode has
+	 * to be enabled). The pages of the previous version become stale and the new
+	 * pages are written without the erase of every write.
+	 *
+	 * @param prefix  String page prefix of header
+	 * @param id      Integer page prefix of header
+	 * @param data    Pointer to data array for save data
+	 * @param len     Array size
+	 * @param address Pointer to the new data start address (optional)
+	 * @return        Returns STORAGE_OK if the data was appended successfully
+	 */
+	StorageStatus append(
+		const char* prefix,
+		uint32_t    id,
+		uint8_t*    data,
+		uint32_t    len,
+		uint32_t*   address = nullptr
+	);
+
 	/*
 	 * Format FLASH memory
 	 *
@@ -132,6 +235,17 @@ public:
 	 */
 	StorageStatus format();
 
+	/*
+	 * Format FLASH memory with progress reporting. The progress callback gets
+	 * formatted and total macroblocks counts, it may be called from the thread
+	 * pool threads (the calls are serialized).
+	 *
+	 * @param progress Progress callback (may be nullptr)
+	 * @param arg      User argument of the progress callback
+	 * @return         Returns STORAGE_OK if the memory was formatted successfully
+	 */
+	StorageStatus format(StorageProgressCallback progress, void* arg = nullptr);
+
 	/*
 	 * Removes data from address
 	 *
@@ -150,11 +264,224 @@ public:
 	StorageStatus clearAddress(const uint32_t address);
 
 	/*
-	 * Changes storage pages count
+	 * Enables in-RAM prefix and id index and builds it from the macroblock headers.
+	 * FIND_MODE_EQUAL, FIND_MODE_NEXT, FIND_MODE_MIN and FIND_MODE_MAX requests
+	 * with not empty prefix are served from the index without memory reads
+	 * while all changes are made through StorageAT.
+	 *
+	 * @return Returns STORAGE_OK if the index was built successfully
+	 */
+	StorageStatus enableIndex();
+
+	/*
+	 * Disables in-RAM prefix and id index and frees its memory
+	 */
+	void disableIndex();
+
+	/*
+	 * Enables in-RAM free pages bitmap and builds it from the macroblock headers.
+	 * FIND_MODE_EMPTY requests and the pages allocation of save and rewrite
+	 * are served from the bitmap without memory reads.
+	 * In the contiguous mode multi-page data is placed to contiguous pages runs
+	 * inside the macroblocks and is loaded by driver readv requests of up to
+	 * STORAGE_EXTENT_PAGES_COUNT pages if the driver declares STORAGE_DRIVER_CAP_READV,
+	 * otherwise the pages are read one by one.
+	 *
+	 * @param contiguous Flag that enables contiguous pages runs allocation
+	 * @return           Returns STORAGE_OK if the bitmap was built successfully
+	 */
+	StorageStatus enableAllocator(bool contiguous = false);
+
+	/*
+	 * Disables in-RAM free pages bitmap and frees its memory
+	 */
+	void disableAllocator();
+
+	/*
+	 * Changes macroblock headers cache size. Cached headers are loaded without
+	 * memory reads and changed headers are saved once at the end of operation.
+	 *
+	 * @param headersCount Max cached headers count (0 disables the cache)
+	 * @return             Returns STORAGE_OK if the cache was changed successfully
+	 */
+	StorageStatus setHeaderCacheSize(uint32_t headersCount);
+
+	/*
+	 * Saves all changed cached headers to memory
+	 *
+	 * @return Returns STORAGE_OK if the headers were saved successfully
+	 */
+	StorageStatus flush();
+
+	/*
+	 * Changes page write verification policy (STORAGE_VERIFY_FULL by default)
+	 *
+	 * @param policy New page write verification policy
+	 */
+	void setVerifyPolicy(StorageVerifyPolicy policy);
+
+	/*
+	 * Enables the lazy rebuild of the broken macroblock headers. The call that loads
+	 * a broken header does not rebuild it: the header is filled from the macroblock
+	 * pages meta data without the data chains validation and the macroblock is
+	 * read-only until rebuildHeaders rebuilds the header (save does not allocate its
+	 * pages, rewrite returns STORAGE_BUSY and deleteData erases the data pages without
+	 * the header change). Headers without data pages are rebuilt at once.
+	 */
+	void enableLazyRebuild();
+
+	/*
+	 * Disables the lazy rebuild (the queued headers are still rebuilt by rebuildHeaders)
+	 */
+	void disableLazyRebuild();
+
+	/*
+	 * Rebuilds the queued broken headers, the call time is bounded by the headers count
+	 *
+	 * @param headersCount Max rebuilt headers count
+	 * @return             Returns STORAGE_OK if the headers were rebuilt successfully
+	 */
+	StorageStatus rebuildHeaders(uint32_t headersCount = 1);
+
+	/*
+	 * @return Returns the count of the broken headers waiting for the rebuild
+	 */
+	uint32_t getRebuildQueueSize();
+
+	/*
+	 * Enables the headers checkpoint in the memory region outside of the allocation
+	 * table (getCheckpointSize bytes from the address) and loads it. The loaded
+	 * checkpoint serves the header loads without memory reads, so the index and
+	 * the free pages bitmap are built in one pass. The first change of the memory
+	 * marks the checkpoint as stale until the next saveCheckpoint call, every
+	 * instance that changes the memory has to enable the checkpoint.
+	 *
+	 * @param address Checkpoint region start address (page aligned, not less than getStorageSize)
+	 * @param verify  Flag that enables the header checksums reading to find the headers
+	 *                changed by an instance without the checkpoint
+	 * @return        Returns STORAGE_OK if the checkpoint was loaded and STORAGE_NOT_FOUND
+	 *                if there is no valid checkpoint in memory (the checkpoint stays enabled)
+	 */
+	StorageStatus enableCheckpoint(uint32_t address, bool verify = true);
+
+	/*
+	 * Disables the headers checkpoint and frees its memory (the checkpoint in memory is kept)
+	 */
+	void disableCheckpoint();
+
+	/*
+	 * Saves all changed cached headers and the headers checkpoint to memory
+	 *
+	 * @return Returns STORAGE_OK if the checkpoint was saved successfully
+	 */
+	StorageStatus saveCheckpoint();
+
+	/*
+	 * Enables the wear leveling with the erase counters of the minimum erase size
+	 * sectors kept in the memory region outside of the allocation table
+	 * (getWearCountersSize bytes from the address) and loads the counters. Every
+	 * erase request increments the counters of the erased sectors and
+	 * FIND_MODE_EMPTY returns the first empty page of the least worn sector with
+	 * empty pages, the data pages search wraps to the memory start. The leveling
+	 * uses the free pages bitmap, so the allocator is enabled too.
+	 *
+	 * @param address Wear counters region start address (page aligned, not less than getStorageSize)
+	 * @return        Returns STORAGE_OK if the counters were loaded and STORAGE_NOT_FOUND
+	 *                if there are no valid counters in memory (the counters start from zero)
+	 */
+	StorageStatus enableWearLeveling(uint32_t address);
+
+	/*
+	 * Disables the wear leveling and frees the counters memory (the counters in memory are kept)
+	 */
+	void disableWearLeveling();
+
+	/*
+	 * Saves the erase counters to memory
+	 *
+	 * @return Returns STORAGE_OK if the counters were saved successfully
+	 */
+	StorageStatus saveWearCounters();
+
+	/*
+	 * @param address Memory address
+	 * @return        Returns the erase count of the address sector (0 if the wear leveling is disabled)
+	 */
+	uint32_t getEraseCount(uint32_t address);
+
+	/*
+	 * Enables the log-structured writes. append writes the data at the log write
+	 * head that moves over the erase sectors, the head erases all the empty and
+	 * stale pages of the next sector by one request when it enters the sector.
+	 * append marks the previous version pages as stale instead of empty, the
+	 * stale pages are not allocated until the head or the compaction erases them
+	 * (deleteData, rewrite and save free the pages as before). The log mode uses the free pages
+	 * bitmap, so the allocator is enabled too.
+	 *
+	 * @return Returns STORAGE_OK if the log mode was enabled successfully
+	 */
+	StorageStatus enableLogMode();
+
+	/*
+	 * Disables the log-structured writes (the stale pages stay stale until the log
+	 * mode is enabled again, the memory is compacted or formatted)
+	 */
+	void disableLogMode();
+
+	/*
+	 * Runs one step of the stale pages compaction. The victim is the erase sector
+	 * with the lowest live pages ratio among the sectors with stale pages: its data
+	 * is moved to the empty pages of other sectors (every data as a whole), then
+	 * all the sector data pages are erased by one request and the stale pages
+	 * become empty. The step is bounded by the moved pages count, so the call may
+	 * be repeated from an idle loop until it returns STORAGE_NOT_FOUND. The
+	 * compaction uses the free pages bitmap, the allocator has to be enabled.
+	 *
+	 * @param pagesCount Max moved pages count (one data is moved at least)
+	 * @return           Returns STORAGE_OK if the step was done successfully and
+	 *                   STORAGE_NOT_FOUND if there is no sector to compact
+	 */
+	StorageStatus compact(uint32_t pagesCount = 1);
+
+#ifndef STORAGE_NO_THREADS
+	/*
+	 * Enables the instance reader/writer lock. find and load requests run in parallel
+	 * under the shared lock, save, rewrite, deleteData, clearAddress, format and the
+	 * settings changes take the exclusive lock. The driver has to support parallel
+	 * read requests. The locking has to be enabled before the instance is shared
+	 * between threads.
+	 * With the macroblock locks save, rewrite, deleteData and clearAddress lock only
+	 * the macroblocks they change (in the macroblock index order), so writers of
+	 * different macroblocks run in parallel and the driver has to support parallel
+	 * write requests too. The macroblock headers are written through in this mode.
+	 *
+	 * @param macroblockLocks Flag that enables the macroblock locks for writers
+	 * @return                Returns STORAGE_OK if the locking was enabled successfully
+	 */
+	StorageStatus enableLocking(bool macroblockLocks = false);
+
+	/*
+	 * Disables the instance reader/writer lock
+	 */
+	void disableLocking();
+
+	/*
+	 * Changes the threads count of the instance thread pool. If the driver declares
+	 * STORAGE_DRIVER_CAP_PARALLEL, find requests that are not served from the index
+	 * or the free pages bitmap search the macroblocks from several threads and
+	 * format formats (and rebuilds the broken headers of) several macroblocks at once.
+	 *
+	 * @param threadsCount Threads count including the calling thread (0 or 1 disables the thread pool)
+	 */
+	void setThreadsCount(uint32_t threadsCount);
+#endif
+
+	/*
+	 * Changes storage pages count of the instance (the in-RAM indexes are rebuilt by the next calls)
 	 *
 	 * @param pagesCount Physical drive pages count
 	 */
-	static void setPagesCount(const uint32_t pagesCount);
+	void setPagesCount(const uint32_t pagesCount);
 
 	/*
 	 * @return Returns pages count of physical drive
@@ -176,6 +503,16 @@ public:
 	 */
 	static uint32_t getPayloadSize();
 
+	/*
+	 * @return Returns headers checkpoint region size in bytes
+	 */
+	static uint32_t getCheckpointSize();
+
+	/*
+	 * @return Returns wear counters region size in bytes
+	 */
+	static uint32_t getWearCountersSize();
+
 	/*
 	 * @return Returns read/write driver of physical drive 
 	 */
@@ -185,6 +522,90 @@ public:
 	 * @return Returns minimum erase size of physical drive
 	 */
 	static uint32_t getMinEraseSize();
+
+	/*
+	 * @return Returns prefix and id index or nullptr if the index is disabled
+	 */
+	static StorageIndex* index();
+
+	/*
+	 * Checks the driver capability
+	 *
+	 * @param capability Target StorageDriverCapability
+	 * @return           Returns true if the driver declares the capability
+	 */
+	static bool driverHasCapability(StorageDriverCapability capability);
+
+	/*
+	 * Writes the memory range and counts the memory change
+	 *
+	 * @param address Range start address
+	 * @param data    Range data
+	 * @param len     Range length in bytes
+	 * @return        Returns the driver write result
+	 */
+	static StorageStatus driverWrite(const uint32_t address, const uint8_t* data, const uint32_t len);
+
+	/*
+	 * Reads memory ranges with one driver readv request or with read requests
+	 * for every range page if the driver does not support readv
+	 *
+	 * @param vec   Memory ranges for read
+	 * @param count Memory ranges count
+	 * @return      Returns STORAGE_OK if all the ranges were read successfully
+	 */
+	static StorageStatus driverReadv(const StorageIOVec* vec, const uint32_t count);
+
+	/*
+	 * Writes memory ranges with one driver writev request or with write requests
+	 * for every range if the driver does not support writev
+	 *
+	 * @param vec   Memory ranges for write
+	 * @param count Memory ranges count
+	 * @return      Returns STORAGE_OK if all the ranges were written successfully
+	 */
+	static StorageStatus driverWritev(const StorageIOVec* vec, const uint32_t count);
+
+	/*
+	 * @return Returns free pages bitmap or nullptr if the allocator is disabled
+	 */
+	static StorageAllocator* allocator();
+
+	/*
+	 * @return Returns macroblock headers cache or nullptr if the cache is disabled
+	 */
+	static StorageHeaderCache* headerCache();
+
+	/*
+	 * @return Returns headers checkpoint or nullptr if the checkpoint is disabled
+	 */
+	static StorageCheckpoint* checkpoint();
+
+	/*
+	 * @return Returns erase sectors wear counters or nullptr if the wear leveling is disabled
+	 */
+	static StorageWear* wear();
+
+	/*
+	 * @return Returns log write head or nullptr if the log mode is disabled
+	 */
+	static StorageLog* log();
+
+	/*
+	 * Erases the pages and registrates the erase in the wear counters (the pages
+	 * of one whole erase sector in the address order are erased with one driver
+	 * eraseSector request if the driver supports it)
+	 *
+	 * @param addresses Page addresses for erase
+	 * @param count     Pages count
+	 * @return          Returns STORAGE_OK if the pages were erased successfully
+	 */
+	static StorageStatus driverErase(const uint32_t* addresses, const uint32_t count);
+
+	/*
+	 * @return Returns page write verification policy
+	 */
+	static StorageVerifyPolicy getVerifyPolicy();
 };
 
 
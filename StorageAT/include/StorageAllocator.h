@@ -0,0 +1,214 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_ALLOCATOR_H_
+#define _STORAGE_ALLOCATOR_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#include "StoragePage.h"
+#include "StorageType.h"
+
+
+/*
+ * StorageAllocator is an in-RAM free pages bitmap
+ *
+ * The bitmap is built from the macroblock headers page statuses and updated on
+ * every header load and save, so empty pages are found without memory reads.
+ * Bit index is macroblockIndex * Header::PAGES_COUNT + pageIndex, set bit means
+ * that the page is empty. The stale pages (superseded by the log-structured
+ * writes) and the blocked pages are kept in the same way. The bitmap also keeps
+ * the empty, stale and blocked pages counts of every erase sector for the wear
+ * leveling, the log write head and the compaction.
+ */
+class StorageAllocator
+{
+private:
+    /* Bits count in the bitmap word */
+    static const uint32_t WORD_BITS = 32;
+
+    /* Flag that indicates that the bitmap matches the headers in memory */
+    bool m_built;
+
+    /* Flag that indicates that multi-page data prefers contiguous pages runs */
+    bool m_contiguous;
+
+    /* Payload pages count that the bitmap contains */
+    uint32_t m_pagesCount;
+
+    /* Free pages bitmap */
+    std::vector<uint32_t> m_freeBits;
+
+    /* Stale pages bitmap */
+    std::vector<uint32_t> m_staleBits;
+
+    /* Blocked pages bitmap */
+    std::vector<uint32_t> m_blockedBits;
+
+    /* Empty pages count by erase sector index */
+    std::vector<uint32_t> m_sectorFreeCounts;
+
+    /* Stale pages count by erase sector index */
+    std::vector<uint32_t> m_sectorStaleCounts;
+
+    /* Blocked pages count by erase sector index */
+    std::vector<uint32_t> m_sectorBlockedCounts;
+
+    /* Erase sector index from which the least worn sector search begins */
+    uint32_t m_wearCursor;
+
+    /*
+     * Calculates bitmap page index by address
+     *
+     * @param address Page address
+     * @return        Returns bitmap page index
+     */
+    static uint32_t getBitIndex(uint32_t address);
+
+    /*
+     * Calculates page address by bitmap index
+     *
+     * @param bitIndex Bitmap page index
+     * @return         Returns page address
+     */
+    static uint32_t getBitAddress(uint32_t bitIndex);
+
+    /*
+     * @return Returns trailing zero bits count of the not zero word
+     */
+    static uint32_t countTrailingZeros(uint32_t word);
+
+    /*
+     * @return Returns set bits count of the word
+     */
+    static uint32_t countBits(uint32_t word);
+
+    /*
+     * Changes the page bit and the page erase sector count
+     *
+     * @param bits         Pointer to the target bitmap
+     * @param sectorCounts Pointer to the set bits counts by erase sector index
+     * @param bitIndex     Bitmap page index
+     * @param value        New bit value
+     */
+    static void setBit(
+        std::vector<uint32_t>* bits,
+        std::vector<uint32_t>* sectorCounts,
+        uint32_t               bitIndex,
+        bool                   value
+    );
+
+    /*
+     * Searches first free page starting from the bitmap index
+     *
+     * @param bitIndex Bitmap index from which the search begins
+     * @return         Returns free page bitmap index or m_pagesCount if there are no free pages
+     */
+    uint32_t findFreeBit(uint32_t bitIndex);
+
+public:
+    /*
+     * StorageAllocator constructor
+     *
+     * @param contiguous Flag that enables contiguous pages runs allocation
+     */
+    StorageAllocator(bool contiguous = false);
+
+    /*
+     * Builds the bitmap from all macroblock headers
+     *
+     * @return Returns STORAGE_OK if the bitmap was built successfully
+     */
+    StorageStatus build();
+
+    /*
+     * Drops the bitmap content, the bitmap has to be built again before use
+     */
+    void invalidate();
+
+    /*
+     * @return Returns true if the bitmap matches the headers in memory
+     */
+    bool isBuilt();
+
+    /*
+     * Updates the macroblock page statuses in the bitmap
+     *
+     * @param header The macroblock header
+     */
+    void update(Header* header);
+
+    /*
+     * Searches first empty page starting from the address
+     *
+     * @param startAddress The address from which the search begins
+     * @param address      Pointer that used to find needed page address
+     * @return             Returns STORAGE_OK if the empty page was found
+     */
+    StorageStatus findFree(uint32_t startAddress, uint32_t* address);
+
+    /*
+     * Searches first empty page of the least worn erase sector with empty pages,
+     * the sectors with the same erase count are taken in turn
+     *
+     * @param address Pointer that used to find needed page address
+     * @return        Returns STORAGE_OK if the empty page was found
+     */
+    StorageStatus findLeastWorn(uint32_t* address);
+
+    /*
+     * Searches first run of contiguous empty pages inside one macroblock
+     *
+     * @param startAddress The address from which the search begins
+     * @param count        Needed empty pages count
+     * @param address      Pointer that used to find the run start address
+     * @return             Returns STORAGE_OK if the empty pages run was found
+     */
+    StorageStatus findFreeRun(uint32_t startAddress, uint32_t count, uint32_t* address);
+
+    /*
+     * Searches next empty page for the data that needs pagesCount more pages.
+     * In the contiguous mode the page right after the start address continues
+     * the current run, otherwise the longest run (up to pagesCount pages) is
+     * preferred to the first empty page.
+     *
+     * @param startAddress The address from which the search begins
+     * @param pagesCount   Data pages count that still have to be allocated
+     * @param address      Pointer that used to find needed page address
+     * @return             Returns STORAGE_OK if the empty page was found
+     */
+    StorageStatus findExtent(uint32_t startAddress, uint32_t pagesCount, uint32_t* address);
+
+    /*
+     * @return Returns true if the contiguous pages runs allocation is enabled
+     */
+    bool isContiguous();
+
+    /*
+     * @param sectorIndex Erase sector index
+     * @return            Returns empty pages count of the erase sector
+     */
+    uint32_t getSectorFreeCount(uint32_t sectorIndex);
+
+    /*
+     * @param sectorIndex Erase sector index
+     * @return            Returns stale pages count of the erase sector
+     */
+    uint32_t getSectorStaleCount(uint32_t sectorIndex);
+
+    /*
+     * @param sectorIndex Erase sector index
+     * @return            Returns blocked pages count of the erase sector
+     */
+    uint32_t getSectorBlockedCount(uint32_t sectorIndex);
+
+    /*
+     * @return Returns empty pages count
+     */
+    uint32_t getFreePagesCount();
+};
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_CRC_H_
+#define _STORAGE_CRC_H_
+
+
+#include <stdint.h>
+
+
+/*
+ * STORAGE_CRC_NO_TABLE - define it for the flash constrained targets to calculate
+ * CRC16 bit by bit without the 2 KB slicing-by-4 lookup tables (the checksums are the same)
+ * and software CRC32C without the 1 KB lookup table
+ */
+
+
+/*
+ * Calculates the page CRC16 (CCITT polynomial 0x1021, initial value 0).
+ * The first buffer byte is not included in the checksum (the page format
+ * has always been calculated from the second byte).
+ *
+ * @param buf Data buffer
+ * @param len Data buffer length
+ * @return    Returns CRC16 of the buffer bytes [1, len)
+ */
+uint16_t storage_at_crc16(const uint8_t* buf, uint16_t len);
+
+/*
+ * Calculates CRC32C (Castagnoli polynomial 0x1EDC6F41, reflected, initial value
+ * and final XOR 0xFFFFFFFF). SSE4.2 crc32 instructions are used if the CPU supports
+ * them (GCC and Clang x86 builds) and ARMv8 CRC instructions if the target is built
+ * with them (__ARM_FEATURE_CRC32), otherwise the checksum is calculated in software.
+ *
+ * @param buf Data buffer
+ * @param len Data buffer length
+ * @return    Returns CRC32C of the buffer
+ */
+uint32_t storage_at_crc32c(const uint8_t* buf, uint32_t len);
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_CHECKPOINT_H_
+#define _STORAGE_CHECKPOINT_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#include "StoragePage.h"
+#include "StorageType.h"
+
+
+/*
+ * StorageCheckpoint is a compact copy of all the macroblock headers that is kept
+ * in the memory region outside of the allocation table
+ *
+ * The checkpoint is a superblock page and the summary of every macroblock:
+ * the header prefix and id table, the page statuses bitmap, the data start pages
+ * bitmap and the header checksum that stands for the header generation. The
+ * loaded summary serves the header loads without memory reads, so the index and
+ * the free pages bitmap are built at mount in one pass. The superblock is marked
+ * as stale before the first change of the allocation table.
+ */
+class StorageCheckpoint
+{
+private:
+    /* Checkpoint superblock validator */
+    static const uint32_t MAGIC = 0xC4EC4B01;
+
+    /* Checkpoint format version */
+    static const uint8_t VERSION = 0x01;
+
+    /* Data start pages bitmap size in bytes */
+    static const uint32_t START_BYTES_COUNT = Header::PAGES_COUNT / 8 + (Header::PAGES_COUNT % 8 ? 1 : 0);
+
+    /* Checkpoint superblock (the first region page) */
+    STORAGE_PACK(typedef struct, _Superblock {
+        uint32_t magic;            // Checkpoint validator
+        uint8_t  version;          // Checkpoint format version
+        uint8_t  clean;            // The summary matches the headers in memory
+        uint32_t macroblocksCount; // Summary macroblocks count
+        uint32_t summaryCRC;       // CRC32C of the summary
+        uint32_t crc;              // CRC32C of the previous superblock fields
+    } Superblock);
+
+    /* Single macroblock summary */
+    STORAGE_PACK(typedef struct, _Entry {
+        uint32_t           headerAddress;                 // Header page address in the reserved pages
+        StoragePageCRC     headerCRC;                     // Header page checksum (header generation)
+        uint8_t            startPages[START_BYTES_COUNT]; // Data start pages bitmap
+        Header::HeaderMeta meta;                          // Header prefix and id table with page statuses
+    } Entry);
+
+    /* Checkpoint region start address */
+    uint32_t m_address;
+
+    /* Flag that indicates that the superblock in memory is marked as clean */
+    bool m_clean;
+
+    /* Loaded summary (empty if the checkpoint is not loaded or is stale) */
+    std::vector<Entry> m_entries;
+
+    /*
+     * @return Returns summary size in bytes rounded up to the pages
+     */
+    static uint32_t getSummarySize();
+
+    /*
+     * Writes the superblock
+     *
+     * @param clean      Flag that marks the summary as matching the headers
+     * @param summaryCRC CRC32C of the summary
+     * @return           Returns STORAGE_OK if the superblock was written successfully
+     */
+    StorageStatus writeSuperblock(bool clean, uint32_t summaryCRC);
+
+public:
+    /*
+     * StorageCheckpoint constructor
+     *
+     * @param address Checkpoint region start address (page aligned, outside of the allocation table)
+     */
+    StorageCheckpoint(uint32_t address);
+
+    /*
+     * Loads the checkpoint from memory. Header checksums verification compares
+     * the summary with the headers that were changed without the checkpoint.
+     *
+     * @param verify Flag that enables the header checksums verification
+     * @return       Returns STORAGE_OK if the checkpoint was loaded and
+     *               STORAGE_NOT_FOUND if there is no valid checkpoint in memory
+     */
+    StorageStatus load(bool verify);
+
+    /*
+     * Saves the summary of the current headers to memory
+     *
+     * @return Returns STORAGE_OK if the checkpoint was saved successfully
+     */
+    StorageStatus save();
+
+    /*
+     * Marks the checkpoint in memory as stale and drops the loaded summary,
+     * has to be called before any change of the allocation table
+     *
+     * @return Returns STORAGE_OK if the checkpoint was marked successfully
+     */
+    StorageStatus invalidate();
+
+    /*
+     * @return Returns true if the summary is loaded
+     */
+    bool isLoaded();
+
+    /*
+     * Copies the header from the loaded summary
+     *
+     * @param header Pointer to the target header (macroblock index must be set)
+     * @return       Returns true if the header was found in the summary
+     */
+    bool get(Header* header);
+
+    /*
+     * Checks that the page is a data start page in the loaded summary
+     *
+     * @param macroblockIndex Macroblock index
+     * @param pageIndex       Page index in macroblock
+     * @param start           Pointer to the flag that is set if the page is a data start page
+     * @return                Returns true if the macroblock was found in the summary
+     */
+    bool isStartPage(uint32_t macroblockIndex, uint32_t pageIndex, bool* start);
+
+    /*
+     * @return Returns checkpoint region start address
+     */
+    uint32_t getAddress();
+
+    /*
+     * @return Returns checkpoint region size in bytes for the current memory geometry
+     */
+    static uint32_t getSize();
+};
+
+
+#endif
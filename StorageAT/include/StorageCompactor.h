@@ -0,0 +1,108 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_COMPACTOR_H_
+#define _STORAGE_COMPACTOR_H_
+
+
+#include <vector>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "StorageType.h"
+
+
+/*
+ * StorageCompactor reclaims the erase sectors with the stale pages
+ *
+ * The victim is the erase sector with the lowest live pages ratio among the
+ * sectors with stale pages. The live data of the victim is moved out of the
+ * sector as a whole (the links of the data pages can not be changed without
+ * the erase), then all the sector data pages are erased by one request and the
+ * stale pages (and the blocked pages that are erased successfully) become empty.
+ * The work is split into steps bounded by the moved pages count, the victim is
+ * kept between the steps.
+ */
+class StorageCompactor
+{
+private:
+    /* Victim erase sector index */
+    uint32_t m_sectorIndex;
+
+    /* Flag that indicates that the victim erase sector is selected */
+    bool m_selected;
+
+    /*
+     * Collects the data page addresses of the erase sector
+     *
+     * @param sectorIndex Erase sector index
+     * @param addresses   Pointer to the data page addresses
+     * @return            Returns false if the sector has read-only macroblock pages
+     */
+    static bool getSectorPages(uint32_t sectorIndex, std::vector<uint32_t>* addresses);
+
+    /*
+     * Checks that the page reads as erased
+     *
+     * @param address The page address
+     * @return        Returns true if all the page bytes are 0xFF
+     */
+    static bool isErased(uint32_t address);
+
+    /*
+     * Searches the first page with the data in the victim sector
+     *
+     * @param addresses The victim sector data page addresses
+     * @param address   Pointer that used to find the page address
+     * @return          Returns STORAGE_OK if the page was found and STORAGE_NOT_FOUND
+     *                  if the victim sector has no data
+     */
+    StorageStatus findLivePage(const std::vector<uint32_t>& addresses, uint32_t* address);
+
+    /*
+     * Marks the page that is not a part of a valid data as stale
+     *
+     * @param address The page address
+     * @return        Returns STORAGE_OK if the header was saved successfully
+     */
+    StorageStatus dropPage(uint32_t address);
+
+    /*
+     * Erases all the data pages of the victim sector by one request and marks
+     * the stale and the erased blocked pages as empty
+     *
+     * @param addresses The victim sector data page addresses
+     * @return          Returns STORAGE_OK if the sector was erased successfully
+     */
+    StorageStatus eraseSector(const std::vector<uint32_t>& addresses);
+
+public:
+    /*
+     * StorageCompactor constructor
+     */
+    StorageCompactor();
+
+    /*
+     * Selects the victim erase sector if it is not selected yet
+     *
+     * @return Returns STORAGE_OK if the victim is selected and STORAGE_NOT_FOUND
+     *         if there is no sector to compact
+     */
+    StorageStatus select();
+
+    /*
+     * Moves the victim sector data and erases the sector when it has no data
+     *
+     * @param pagesCount Max moved pages count (the data is moved as a whole,
+     *                   so one data is moved at least)
+     * @return           Returns STORAGE_OK if the step was done successfully
+     */
+    StorageStatus collect(uint32_t pagesCount);
+
+    /*
+     * Drops the victim selection (after the memory geometry change or format)
+     */
+    void reset();
+};
+
+
+#endif
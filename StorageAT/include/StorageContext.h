@@ -0,0 +1,410 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_CONTEXT_H_
+#define _STORAGE_CONTEXT_H_
+
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include "StorageLog.h"
+#include "StorageType.h"
+#include "StorageWear.h"
+#include "StorageIndex.h"
+#include "StorageAllocator.h"
+#include "StorageCompactor.h"
+#include "StorageCheckpoint.h"
+#include "StorageThreadPool.h"
+#include "StorageHeaderCache.h"
+#ifndef STORAGE_NO_THREADS
+#   include <mutex>
+#   include <shared_mutex>
+#endif
+
+
+/* Thread local storage specifier of the bound context (may be defined empty for single thread targets) */
+#ifndef STORAGE_THREAD_LOCAL
+#   ifdef STORAGE_NO_THREADS
+#       define STORAGE_THREAD_LOCAL
+#   else
+#       define STORAGE_THREAD_LOCAL thread_local
+#   endif
+#endif
+
+
+class IStorageDriver;
+
+
+/*
+ * StorageContext is the state of a single StorageAT instance: memory geometry,
+ * driver and in-RAM indexes
+ *
+ * StorageAT binds its context to the calling thread for the time of every call
+ * (StorageContextGuard), so Page, Header, StorageMacroblock and StorageData reach
+ * the instance state through the StorageAT static accessors. Outside of StorageAT
+ * calls the context bound by the StorageAT constructor or StorageAT::bind is used.
+ * Without the bound context the accessors return the empty geometry and the driver
+ * requests fail.
+ */
+class StorageContext
+{
+public:
+    /* Storage pages count */
+    uint32_t pagesCount;
+
+    /* Storage read/write driver */
+    IStorageDriver* driver;
+
+    /* Storage minimum erase size */
+    uint32_t minEraseSize;
+
+    /* Storage in-RAM prefix and id index (nullptr if the index is disabled) */
+    std::unique_ptr<StorageIndex> index;
+
+    /* Storage free pages bitmap (nullptr if the allocator is disabled) */
+    std::unique_ptr<StorageAllocator> allocator;
+
+    /* Storage macroblock headers cache (nullptr if the cache is disabled) */
+    std::unique_ptr<StorageHeaderCache> headerCache;
+
+    /* Storage headers checkpoint (nullptr if the checkpoint is disabled) */
+    std::unique_ptr<StorageCheckpoint> checkpoint;
+
+    /* Storage erase sectors wear counters (nullptr if the wear leveling is disabled) */
+    std::unique_ptr<StorageWear> wear;
+
+    /* Storage log-structured writes head (nullptr if the log mode is disabled) */
+    std::unique_ptr<StorageLog> log;
+
+    /* Storage stale pages compaction state (nullptr until the first compaction) */
+    std::unique_ptr<StorageCompactor> compactor;
+
+    /* Storage page write verification policy */
+    StorageVerifyPolicy verifyPolicy;
+
+    /* Flag that enables the lazy rebuild of the broken headers (see StorageAT::enableLazyRebuild) */
+    bool lazyRebuild;
+
+    /* Macroblocks with the broken headers waiting for the rebuild (the macroblocks are read-only) */
+    std::vector<uint32_t> rebuildQueue;
+
+    /* Flag that enables the instance locks (see StorageAT::enableLocking) */
+    bool locking;
+
+    /* Threads of the full memory search and format (nullptr if the thread pool is disabled) */
+    std::unique_ptr<StorageThreadPool> threadPool;
+
+    /* Memory changes counter: every driver write and erase request increments it (see StorageOperation) */
+    std::atomic<uint32_t> changesCount;
+
+    /* Threads count that have the context bound by bind() */
+    std::atomic<uint32_t> boundThreadsCount;
+
+#ifndef STORAGE_NO_THREADS
+    /* Instance reader/writer lock: find and load are shared, changes are exclusive */
+    std::shared_mutex accessMutex;
+
+    /* Lock of the in-RAM state that shared requests change (headers cache, free pages bitmap) */
+    std::recursive_mutex stateMutex;
+
+    /* Macroblock locks (nullptr if the macroblock locking is disabled) */
+    std::unique_ptr<std::shared_mutex[]> macroblockMutexes;
+
+    /* Macroblock locks count */
+    uint32_t macroblockMutexesCount;
+#endif
+
+    /*
+     * StorageContext constructor
+     *
+     * @param pagesCount   Physical drive pages count
+     * @param driver       Physical drive read/write driver
+     * @param minEraseSize Minimal erase sector size
+     */
+    StorageContext(uint32_t pagesCount = 0, IStorageDriver* driver = nullptr, uint32_t minEraseSize = 0);
+
+    /*
+     * Creates the macroblock locks for the current memory geometry
+     *
+     * @param macroblocksCount Macroblocks count (0 disables the macroblock locking)
+     */
+    void setMacroblockLocks(uint32_t macroblocksCount);
+
+    /*
+     * @return Returns true if the writers lock the macroblocks instead of the whole instance
+     */
+    bool isMacroblockLocking();
+
+    /*
+     * @return Returns true if the in-RAM state may be changed by several threads at once
+     */
+    bool isStateShared();
+
+    /*
+     * Binds the context to the current thread for the calls outside of StorageAT
+     * (the previous binding of the thread ends)
+     */
+    void bind();
+
+    /*
+     * Unbinds the context from the current thread if it is bound (every thread unbinds
+     * the context or exits before the context destruction)
+     */
+    void unbind();
+
+    /*
+     * @return Returns the context bound to the current thread or nullptr if there is no bound context
+     */
+    static StorageContext* current();
+
+private:
+    friend class StorageContextGuard;
+
+    /* Context bound to the thread by bind(), the binding ends with the thread */
+    class Binding
+    {
+    public:
+        /* Bound context */
+        StorageContext* context = nullptr;
+
+        /*
+         * Unbinds the context at the thread exit
+         */
+        ~Binding();
+    };
+
+    /* Context of the current thread (the bound context or the context of the current StorageAT call) */
+    static STORAGE_THREAD_LOCAL StorageContext* m_bound;
+
+    /* Context bound to the current thread by bind() */
+    static STORAGE_THREAD_LOCAL Binding m_binding;
+};
+
+/*
+ * StorageContextGuard binds the context to the current thread until the guard destruction
+ */
+class StorageContextGuard
+{
+private:
+    /* Previously bound context */
+    StorageContext* m_previous;
+
+public:
+    /*
+     * StorageContextGuard constructor
+     *
+     * @param context The context for bind
+     */
+    StorageContextGuard(StorageContext* context);
+
+    /*
+     * Restores previously bound context
+     */
+    ~StorageContextGuard();
+
+    StorageContextGuard(const StorageContextGuard&) = delete;
+    StorageContextGuard& operator=(const StorageContextGuard&) = delete;
+};
+
+/*
+ * StorageAccessGuard takes the instance reader/writer lock until the guard destruction
+ *
+ * The lock is taken only if the context locking is enabled. Nested StorageAT
+ * calls of the thread that already holds the lock do not lock it again.
+ * If the macroblock locking is enabled the guard also keeps the macroblock
+ * locks taken during the call. The macroblock locks are taken in the index
+ * order, a lock that is out of order is only tried to avoid deadlocks.
+ */
+class StorageAccessGuard
+{
+private:
+    /* Macroblock lock held by the guard */
+    typedef struct _MacroblockLock {
+        uint32_t index;     // Macroblock index
+        bool     exclusive; // Flag that indicates that the lock is exclusive
+    } MacroblockLock;
+
+    /* Locked context */
+    StorageContext* m_context;
+
+    /* Previous context locked by the current thread */
+    StorageContext* m_previous;
+
+    /* Previous guard that held the current thread locks */
+    StorageAccessGuard* m_previousGuard;
+
+    /* Flag that indicates that the guard holds the shared lock */
+    bool m_shared;
+
+    /* Flag that indicates that the guard holds the exclusive lock */
+    bool m_exclusive;
+
+    /* Flag that indicates that the instance lock is held by the parent call of another thread */
+    bool m_attached;
+
+    /* Macroblock locks held by the guard */
+    std::vector<MacroblockLock> m_macroblocks;
+
+    /* Context locked by the current thread */
+    static STORAGE_THREAD_LOCAL StorageContext* m_owner;
+
+    /* Guard that holds the current thread locks */
+    static STORAGE_THREAD_LOCAL StorageAccessGuard* m_current;
+
+    /*
+     * Searches the held macroblock lock
+     *
+     * @param macroblockIndex Macroblock index
+     * @return                Returns pointer to the held lock or nullptr
+     */
+    MacroblockLock* findMacroblock(uint32_t macroblockIndex);
+
+public:
+    /*
+     * StorageAccessGuard constructor
+     *
+     * @param context   The context for lock
+     * @param exclusive Flag that selects the exclusive (writer) lock
+     */
+    StorageAccessGuard(StorageContext* context, bool exclusive);
+
+    /*
+     * StorageAccessGuard constructor for the worker threads of the call that holds
+     * the instance lock. The worker uses the parent lock and takes its own macroblock locks.
+     *
+     * @param context The locked context
+     * @param parent  The guard of the parent call (StorageAccessGuard::current())
+     */
+    StorageAccessGuard(StorageContext* context, StorageAccessGuard* parent);
+
+    /*
+     * Releases the lock
+     */
+    ~StorageAccessGuard();
+
+    /*
+     * Replaces the shared lock with the exclusive one (the lock is released for a while,
+     * so the instance state has to be checked again)
+     */
+    void exclusive();
+
+    /*
+     * Locks the macroblock until the end of the current StorageAT call.
+     * Does nothing if the macroblock locking is disabled or the thread holds
+     * the exclusive instance lock.
+     *
+     * @param macroblockIndex Macroblock index
+     * @param exclusive       Flag that selects the exclusive (writer) lock
+     * @param acquired        Pointer to the flag that is set if the lock was taken by this call
+     * @return                Returns STORAGE_OK if the macroblock is locked or STORAGE_BUSY
+     *                        if the lock is out of order and is held by another thread
+     */
+    static StorageStatus lockMacroblock(uint32_t macroblockIndex, bool exclusive, bool* acquired = nullptr);
+
+    /*
+     * Releases the macroblock lock before the end of the current StorageAT call
+     *
+     * @param macroblockIndex Macroblock index
+     */
+    static void unlockMacroblock(uint32_t macroblockIndex);
+
+    /*
+     * Releases all the macroblock locks of the current StorageAT call
+     */
+    static void unlockMacroblocks();
+
+    /*
+     * @return Returns true if the writers of the current context lock macroblocks
+     */
+    static bool isMacroblockLocking();
+
+    /*
+     * @return Returns true if the current StorageAT call holds any macroblock lock
+     */
+    static bool isHoldingMacroblocks();
+
+    /*
+     * @return Returns the guard that holds the current thread locks or nullptr
+     */
+    static StorageAccessGuard* current();
+
+    StorageAccessGuard(const StorageAccessGuard&) = delete;
+    StorageAccessGuard& operator=(const StorageAccessGuard&) = delete;
+};
+
+/*
+ * StorageMacroblockGuard locks the macroblock until the guard destruction
+ * (if the macroblock is not locked by the current StorageAT call yet)
+ */
+class StorageMacroblockGuard
+{
+private:
+    /* Macroblock index */
+    uint32_t m_index;
+
+    /* Flag that indicates that the lock was taken by the guard */
+    bool m_acquired;
+
+    /* Lock result */
+    StorageStatus m_status;
+
+public:
+    /*
+     * StorageMacroblockGuard constructor
+     *
+     * @param macroblockIndex Macroblock index
+     * @param exclusive       Flag that selects the exclusive (writer) lock
+     */
+    StorageMacroblockGuard(uint32_t macroblockIndex, bool exclusive);
+
+    /*
+     * Releases the lock if it was taken by the guard
+     */
+    ~StorageMacroblockGuard();
+
+    /*
+     * Replaces the shared lock taken by the guard with the exclusive one
+     *
+     * @return Returns STORAGE_OK if the macroblock is locked exclusively
+     */
+    StorageStatus exclusive();
+
+    /*
+     * @return Returns STORAGE_OK if the macroblock is locked
+     */
+    StorageStatus status();
+
+    StorageMacroblockGuard(const StorageMacroblockGuard&) = delete;
+    StorageMacroblockGuard& operator=(const StorageMacroblockGuard&) = delete;
+};
+
+/*
+ * StorageStateGuard locks the in-RAM state of the current context that is
+ * changed under the shared lock or by the pool threads (headers cache,
+ * free pages bitmap)
+ */
+class StorageStateGuard
+{
+private:
+    /* Locked context or nullptr if the locking is disabled */
+    StorageContext* m_context;
+
+public:
+    /*
+     * StorageStateGuard constructor
+     */
+    StorageStateGuard();
+
+    /*
+     * Releases the lock
+     */
+    ~StorageStateGuard();
+
+    StorageStateGuard(const StorageStateGuard&) = delete;
+    StorageStateGuard& operator=(const StorageStateGuard&) = delete;
+};
+
+
+#endif
\ No newline at end of file
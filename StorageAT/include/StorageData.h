@@ -4,6 +4,8 @@
 #define _STORAGE_DATA_H_
 
 
+#include <vector>
+
 #include "StoragePage.h"
 #include "StorageType.h"
 
@@ -14,6 +16,15 @@
 class StorageData
 {
 private:
+	friend class StorageOperation;
+
+	/* Contiguous data pages that were read by a single driver request */
+	typedef struct _Extent {
+		uint32_t   address;                            // Extent start address
+		uint32_t   count;                              // Extent pages count
+		PageStruct pages[STORAGE_EXTENT_PAGES_COUNT];  // Extent pages
+	} Extent;
+
 	/* Data start address */
 	uint32_t m_startAddress;
 
@@ -31,6 +42,316 @@ private:
 	 */
 	StorageStatus erasePage(const uint32_t address);
 
+	/*
+	 * Saves the batch of the data pages by vectored requests and blocks
+	 * the pages that were not saved in the macroblock header
+	 *
+	 * @param pages  Pointer to the batch of the data pages (the batch is cleared)
+	 * @param header Pointer to the macroblock header of the pages
+	 * @return       Returns STORAGE_OK if all the pages were saved successfully
+	 */
+	static StorageStatus saveBatch(std::vector<Page>* pages, Header* header);
+
+	/*
+	 * Calculates data pages count
+	 *
+	 * @param len Data length
+	 * @return    Returns pages count that the data occupies
+	 */
+	static uint32_t getPagesCount(uint32_t len);
+
+	/*
+	 * Loads and validates the data page from the extent, reads the next
+	 * extent if the page is out of the current one
+	 *
+	 * @param extent     Pointer to the extent buffer
+	 * @param page       Pointer to the page for load (page address must be set)
+	 * @param startPage  Flag for validate that the page is the data start page
+	 * @param pagesCount Data pages count that still have to be loaded
+	 * @return           Returns STORAGE_OK if the page was loaded successfully
+	 */
+	static StorageStatus loadExtentPage(Extent* extent, Page* page, bool startPage, uint32_t pagesCount);
+
+	/*
+	 * Loads and validates next data page through the extent buffer
+	 *
+	 * @param extent     Pointer to the extent buffer
+	 * @param page       Pointer to the current data page
+	 * @param pagesCount Data pages count that still have to be loaded
+	 * @return           Returns STORAGE_OK if the next page exists and was loaded successfully
+	 */
+	static StorageStatus loadExtentNext(Extent* extent, Page* page, uint32_t pagesCount);
+
+	/*
+	 * Searches empty page address for the data, uses the free pages bitmap
+	 * if the allocator is enabled and memory search otherwise. With the wear
+	 * leveling the search wraps to the memory start and ends at the data start.
+	 *
+	 * @param prefix             The prefix of the data
+	 * @param id                 The id of the data
+	 * @param startSearchAddress The address from which the search begins
+	 * @param pagesCount         Data pages count that still have to be allocated
+	 * @param dataAddress        The data start address
+	 * @param address            Pointer that used to find empty page address
+	 * @return                   Returns STORAGE_OK if the empty page was found
+	 */
+	static StorageStatus findEmptyAddress(
+		const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t id,
+		uint32_t       startSearchAddress,
+		uint32_t       pagesCount,
+		uint32_t       dataAddress,
+		uint32_t*      address
+	);
+
+	/*
+	 * Searches empty page address for the data and locks its macroblock if the
+	 * macroblock locking is enabled (the page is checked again after the lock)
+	 *
+	 * @param prefix             The prefix of the data
+	 * @param id                 The id of the data
+	 * @param startSearchAddress The address from which the search begins
+	 * @param pagesCount         Data pages count that still have to be allocated
+	 * @param dataAddress        The data start address
+	 * @param address            Pointer that used to find empty page address
+	 * @return                   Returns STORAGE_OK if the empty page was found
+	 */
+	static StorageStatus reserveEmptyAddress(
+		const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t id,
+		uint32_t       startSearchAddress,
+		uint32_t       pagesCount,
+		uint32_t       dataAddress,
+		uint32_t*      address
+	);
+
+	/*
+	 * Rewrite user data on m_startAddress storage address
+	 *
+	 * @param data       Pointer to data array for save data
+	 * @param len        Array size
+	 * @param checkEmpty Flag that requires the empty start page after the old data removal
+	 * @return           Returns STORAGE_OK if the data was rewritten successfully
+	 */
+	StorageStatus rewrite(
+		uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+		uint32_t id,
+		uint8_t* data,
+		uint32_t len,
+		bool     checkEmpty
+	);
+
+	/*
+	 * Checks that the data may be saved on m_startAddress storage address and
+	 * prepares the rewrite (see prepareRewrite)
+	 *
+	 * @param prefix  The prefix of the data
+	 * @param id      The id of the data
+	 * @param len     Data length
+	 * @param targets Pointer to the planned data page addresses in the data order
+	 * @return        Returns STORAGE_OK if the data pages are ready for the write
+	 */
+	StorageStatus prepareSave(
+		uint8_t                prefix[STORAGE_PAGE_PREFIX_SIZE],
+		uint32_t               id,
+		uint32_t               len,
+		std::vector<uint32_t>* targets
+	);
+
+	/*
+	 * Removes the old data, plans and erases the data pages from m_startAddress
+	 *
+	 * @param prefix     The prefix of the data
+	 * @param id         The id of the data
+	 * @param len        Data length
+	 * @param checkEmpty Flag that requires the empty start page after the old data removal
+	 * @param targets    Pointer to the planned data page addresses in the data order
+	 * @return           Returns STORAGE_OK if the data pages are ready for the write
+	 */
+	StorageStatus prepareRewrite(
+		uint8_t                prefix[STORAGE_PAGE_PREFIX_SIZE],
+		uint32_t               id,
+		uint32_t               len,
+		bool                   checkEmpty,
+		std::vector<uint32_t>* targets
+	);
+
+	/*
+	 * Writes one planned data page (the page is not registrated in the macroblock header)
+	 *
+	 * @param prefix      The prefix of the data
+	 * @param id          The id of the data
+	 * @param data        Pointer to data array for save data
+	 * @param len         Array size
+	 * @param targets     The planned data page addresses in the data order
+	 * @param targetIndex The written page index in targets
+	 * @return            Returns STORAGE_OK if the page was written successfully
+	 */
+	static StorageStatus writePlannedPage(
+		const uint8_t                prefix[STORAGE_PAGE_PREFIX_SIZE],
+		uint32_t                     id,
+		const uint8_t*               data,
+		uint32_t                     len,
+		const std::vector<uint32_t>& targets,
+		uint32_t                     targetIndex
+	);
+
+	/*
+	 * Plans all the data pages before the write: the pages after the planned
+	 * ones are searched (the first page is searched from the memory start if
+	 * nothing is planned)
+	 *
+	 * @param prefix      The prefix of the data
+	 * @param id          The id of the data
+	 * @param pagesCount  Data pages count
+	 * @param skipSector  The erase sector index that is not used for the data
+	 *                    (StorageAT::MAX_ADDRESS if all the sectors are used)
+	 * @param targets     Pointer to the data page addresses in the data order
+	 * @return            Returns STORAGE_OK if all the pages were found
+	 */
+	static StorageStatus planPages(
+		const uint8_t          prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t         id,
+		uint32_t               pagesCount,
+		uint32_t               skipSector,
+		std::vector<uint32_t>* targets
+	);
+
+	/*
+	 * Widens the erase sector pages for erase to the whole sector if the driver
+	 * erases sectors natively and other sector pages are empty (the sector
+	 * pages are kept if the sector has headers of not aligned macroblocks or
+	 * other writers may use its empty pages)
+	 *
+	 * @param sectorAddress The erase sector start address
+	 * @param addresses     Pointer to the sorted sector page addresses for erase
+	 * @param headers       Pointer to the aligned group headers to save after the sector erase
+	 * @return              Returns STORAGE_OK if the sector was checked successfully
+	 */
+	static StorageStatus getSectorErase(
+		uint32_t               sectorAddress,
+		std::vector<uint32_t>* addresses,
+		std::vector<Header>*   headers
+	);
+
+	/*
+	 * Erases the planned data pages with one erase request for every erase sector
+	 *
+	 * @param targets The data page addresses
+	 * @return        Returns STORAGE_OK if all the pages were erased successfully
+	 */
+	static StorageStatus eraseTargets(const std::vector<uint32_t>& targets);
+
+	/*
+	 * Writes the data pages from m_startAddress and registrates them in the
+	 * macroblock headers (the pages have to be erased)
+	 *
+	 * @param prefix  The prefix of the data
+	 * @param id      The id of the data
+	 * @param data    Pointer to data array for save data
+	 * @param len     Array size
+	 * @param log     Flag that takes the next pages from the log write head
+	 * @param targets The planned data page addresses or nullptr if the next
+	 *                pages are searched during the write
+	 * @return        Returns STORAGE_OK if the data pages were written successfully
+	 */
+	StorageStatus writePages(
+		uint8_t                      prefix[STORAGE_PAGE_PREFIX_SIZE],
+		uint32_t                     id,
+		uint8_t*                     data,
+		uint32_t                     len,
+		bool                         log,
+		const std::vector<uint32_t>* targets
+	);
+
+	/*
+	 * Collects the macroblocks that may have the data pages
+	 *
+	 * @param prefix      The prefix of the data
+	 * @param index       The id of the data
+	 * @param scan        Flag that loads the headers to skip the macroblocks without
+	 *                    the data if the index is not built
+	 * @param macroblocks Pointer to the macroblock indexes in the ascending order
+	 * @param targeted    Pointer to the flag that is set if the built index knows the macroblocks
+	 * @return            Returns STORAGE_OK if the macroblocks were collected successfully
+	 */
+	static StorageStatus findDataMacroblocks(
+		const uint8_t          prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t         index,
+		bool                   scan,
+		std::vector<uint32_t>* macroblocks,
+		bool*                  targeted
+	);
+
+	/*
+	 * Locks the macroblocks in the ascending order until the end of the call. If a
+	 * lock is out of order or has to be upgraded, all the call macroblock locks are
+	 * released and taken again, so nothing has to be changed before the call.
+	 *
+	 * @param macroblocks The macroblock indexes in the ascending order
+	 */
+	static void lockMacroblocks(const std::vector<uint32_t>& macroblocks);
+
+	/*
+	 * Removes the data pages from the macroblocks
+	 *
+	 * @param macroblocks The macroblock indexes
+	 * @param targeted    Flag that indicates that the built index knows the macroblocks
+	 * @param prefix      The prefix of the data
+	 * @param index       The id of the data
+	 * @param stale       Flag that marks the pages as stale instead of empty
+	 * @return            Returns STORAGE_OK if the data pages were removed successfully
+	 */
+	static StorageStatus deleteMacroblocksData(
+		const std::vector<uint32_t>& macroblocks,
+		bool                         targeted,
+		const uint8_t                prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t               index,
+		bool                         stale
+	);
+
+	/*
+	 * Removes the data pages from the macroblock header (the header is not saved
+	 * if it has no data pages)
+	 *
+	 * @param macroblockIndex Target macroblock index
+	 * @param prefix          The prefix of the data
+	 * @param index           The id of the data
+	 * @param stale           Flag that marks the pages as stale instead of empty
+	 * @return                Returns STORAGE_OK if the data pages were removed successfully
+	 */
+	static StorageStatus deleteMacroblockData(
+		const uint32_t macroblockIndex,
+		const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t index,
+		bool           stale
+	);
+
+	/*
+	 * Closes the log write head sector if the page becomes empty without the
+	 * erase (the log hands out the open sector pages without the erase)
+	 *
+	 * @param address The page address
+	 */
+	static void releaseLogPage(uint32_t address);
+
+	/*
+	 * Sets the pages status in the macroblock headers: the data meta is set to the
+	 * pages that become PAGE_OK and only the data pages are removed for other statuses
+	 *
+	 * @param addresses  Page addresses in any order
+	 * @param prefix     The prefix of the data
+	 * @param id         The id of the data
+	 * @param pageStatus Target page status
+	 * @return           Returns STORAGE_OK if the headers were saved successfully
+	 */
+	static StorageStatus setPagesStatus(
+		std::vector<uint32_t>    addresses,
+		const uint8_t            prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t           id,
+		const Header::PageStatus pageStatus
+	);
+
 public:
 	/*
 	 * Storage data constructor
@@ -76,14 +397,52 @@ public:
 		uint32_t len
 	);
 	
+	/*
+	 * Writes the new version of the data at the log write head, the previous
+	 * version pages become stale (m_startAddress is set to the new data start)
+	 *
+	 * @param prefix The prefix of the data
+	 * @param id     The id of the data
+	 * @param data   Pointer to data array for save data
+	 * @param len    Array size
+	 * @return       Returns STORAGE_OK if the data was appended successfully
+	 */
+	StorageStatus append(
+		uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+		uint32_t id,
+		uint8_t* data,
+		uint32_t len
+	);
+
+	/*
+	 * Moves the data from m_startAddress to the empty pages out of the erase
+	 * sector (the new pages are erased before the write). The new pages are
+	 * registrated in the headers before the old pages become empty, the data
+	 * pages of the old format are rewritten in the current format.
+	 *
+	 * @param sectorIndex Erase sector index that the data leaves
+	 * @param pagesCount  Pointer to the written pages count
+	 * @return            Returns STORAGE_OK if the data was moved (m_startAddress
+	 *                    is set to the new data start) and STORAGE_NOT_FOUND if
+	 *                    the data chain is broken
+	 */
+	StorageStatus relocate(uint32_t sectorIndex, uint32_t* pagesCount);
+
+	/*
+	 * @return Returns the data start address
+	 */
+	uint32_t getStartAddress();
+
 	/*
 	 * Delete data
 	 *
 	 * @param  prefix The prefix of the data for delete
 	 * @param  index  The index of the data for delete
+	 * @param  stale  Flag that marks the pages as stale (the log mode previous
+	 *                version pages are kept until the erase of their sector)
 	 * @return Returns STORAGE_OK if the data was deleted successfully
 	 */
-	StorageStatus deleteData(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE], const uint32_t index);
+	StorageStatus deleteData(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE], const uint32_t index, bool stale = false);
 
 	/*
 	 * Removes data from address
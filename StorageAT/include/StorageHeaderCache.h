@@ -0,0 +1,99 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_HEADER_CACHE_H_
+#define _STORAGE_HEADER_CACHE_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#include "StoragePage.h"
+#include "StorageType.h"
+
+
+/*
+ * StorageHeaderCache is a bounded write-back cache of the macroblock headers
+ *
+ * Headers are kept decoded by macroblock index, the least recently used header
+ * is evicted (and written back if it was changed) when the cache is full.
+ */
+class StorageHeaderCache
+{
+private:
+    /* Single cached header */
+    typedef struct _CacheEntry {
+        Header   header;   // Cached header copy
+        bool     dirty;    // Header was changed and has not been saved yet
+        uint32_t lastUse;  // Last request number for LRU eviction
+    } CacheEntry;
+
+    /* Max cached headers count */
+    uint32_t m_capacity;
+
+    /* Request counter for LRU eviction */
+    uint32_t m_useCounter;
+
+    /* Cached headers */
+    std::vector<CacheEntry> m_entries;
+
+    /*
+     * Searches the cached header
+     *
+     * @param macroblockIndex Header macroblock index
+     * @return                Returns pointer to the cache entry or nullptr
+     */
+    CacheEntry* findEntry(uint32_t macroblockIndex);
+
+public:
+    /*
+     * StorageHeaderCache constructor
+     *
+     * @param capacity Max cached headers count
+     */
+    StorageHeaderCache(uint32_t capacity);
+
+    /*
+     * Copies the cached header
+     *
+     * @param header Pointer to the target header (macroblock index must be set)
+     * @return       Returns true if the header was found in the cache
+     */
+    bool get(Header* header);
+
+    /*
+     * Puts the header to the cache
+     *
+     * @param header Pointer to the header for cache
+     * @param dirty  Flag that indicates that the header has to be written back
+     * @return       Returns STORAGE_OK if the header was cached successfully
+     */
+    StorageStatus put(Header* header, bool dirty);
+
+    /*
+     * Saves all the changed headers to memory
+     *
+     * @return Returns STORAGE_OK if the headers were saved successfully
+     */
+    StorageStatus flush();
+
+    /*
+     * Drops the cached header without saving
+     *
+     * @param macroblockIndex Header macroblock index
+     */
+    void remove(uint32_t macroblockIndex);
+
+    /*
+     * Drops all the cached headers without saving
+     */
+    void invalidate();
+
+    /*
+     * @return Returns true if there are not saved headers in the cache
+     */
+    bool isDirty();
+};
+
+
+#endif
\ No newline at end of file
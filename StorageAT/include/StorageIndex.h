@@ -0,0 +1,156 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_INDEX_H_
+#define _STORAGE_INDEX_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+#include <unordered_map>
+
+#include "StoragePage.h"
+#include "StorageType.h"
+
+
+/*
+ * StorageIndex is an in-RAM table of data start addresses by prefix and id
+ *
+ * The index is built from the macroblock headers and then kept up to date by
+ * StorageData, so FIND_MODE_EQUAL, FIND_MODE_NEXT, FIND_MODE_MIN and
+ * FIND_MODE_MAX requests are served without memory reads. The index also keeps
+ * the macroblocks whose headers have pages of the data, so deleteData loads
+ * only these headers.
+ */
+class StorageIndex
+{
+private:
+    /* Flag that indicates that the index matches the headers in memory */
+    bool m_built;
+
+    /* Data start addresses by prefix and id */
+    std::unordered_map<uint64_t, uint32_t> m_addresses;
+
+    /* Sorted data ids by prefix */
+    std::unordered_map<uint32_t, std::vector<uint32_t>> m_ids;
+
+    /* Sorted indexes of the macroblocks with the data pages by prefix and id */
+    std::unordered_map<uint64_t, std::vector<uint32_t>> m_macroblocks;
+
+    /*
+     * Packs prefix and id to the index key
+     *
+     * @param prefix String page prefix of header
+     * @param id     Integer page prefix of header
+     * @return       Returns the index key
+     */
+    static uint64_t getKey(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE], uint32_t id);
+
+    /*
+     * Packs prefix to the sorted ids key
+     *
+     * @param prefix String page prefix of header
+     * @return       Returns the sorted ids key
+     */
+    static uint32_t getPrefixKey(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE]);
+
+    /*
+     * Searches data id in the prefix sorted ids
+     *
+     * @param mode   Current search mode
+     * @param ids    Sorted ids of the prefix
+     * @param id     Integer page prefix of header
+     * @param result Pointer that used to find needed id
+     * @return       Returns true if the id was found
+     */
+    static bool findId(
+        StorageFindMode              mode,
+        const std::vector<uint32_t>& ids,
+        const uint32_t               id,
+        uint32_t*                    result
+    );
+
+public:
+    /*
+     * StorageIndex constructor
+     */
+    StorageIndex();
+
+    /*
+     * Builds the index from all macroblock headers
+     *
+     * @return Returns STORAGE_OK if the index was built successfully
+     */
+    StorageStatus build();
+
+    /*
+     * Drops the index content, the index has to be built again before use
+     */
+    void invalidate();
+
+    /*
+     * @return Returns true if the index matches the headers in memory
+     */
+    bool isBuilt();
+
+    /*
+     * Searches data start address in the index
+     *
+     * @param mode    Current search mode (FIND_MODE_EMPTY is not supported)
+     * @param prefix  String page prefix of header
+     * @param id      Integer page prefix of header
+     * @param address Pointer that used to find needed page address
+     * @return        Returns STORAGE_OK if the data was found
+     */
+    StorageStatus find(
+        StorageFindMode mode,
+        const uint8_t   prefix[STORAGE_PAGE_PREFIX_SIZE],
+        const uint32_t  id,
+        uint32_t*       address
+    );
+
+    /*
+     * Registrates data start address in the index
+     *
+     * @param prefix  String page prefix of header
+     * @param id      Integer page prefix of header
+     * @param address Data start address
+     */
+    void insert(
+        const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+        const uint32_t id,
+        const uint32_t address
+    );
+
+    /*
+     * Removes data from the index
+     *
+     * @param prefix String page prefix of header
+     * @param id     Integer page prefix of header
+     */
+    void remove(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE], const uint32_t id);
+
+    /*
+     * Registrates the data pages of the macroblock header (the removed pages stay
+     * registrated until the data removal)
+     *
+     * @param header Loaded or saved macroblock header
+     */
+    void update(Header* header);
+
+    /*
+     * Copies the macroblock indexes whose headers may have pages of the data
+     *
+     * @param prefix      String page prefix of header
+     * @param id          Integer page prefix of header
+     * @param macroblocks Pointer to the sorted macroblock indexes
+     */
+    void getMacroblocks(
+        const uint8_t          prefix[STORAGE_PAGE_PREFIX_SIZE],
+        const uint32_t         id,
+        std::vector<uint32_t>* macroblocks
+    );
+};
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,186 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_JOURNAL_H_
+#define _STORAGE_JOURNAL_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#include "StorageAT.h"
+#include "StorageType.h"
+
+
+/*
+ * StorageJournal is a driver proxy that records the finished requests of
+ * a resumable operation step
+ *
+ * The step is executed again after STORAGE_BUSY and the recorded requests
+ * are replayed from RAM, so only the unfinished requests reach the driver.
+ * If the driver declares STORAGE_DRIVER_CAP_ASYNC the requests are submitted
+ * and the step is suspended until the driver completes them. The journal keeps
+ * the requests of one step only, the owner clears it after every finished step
+ * and when another call changes memory.
+ */
+class StorageJournal: public IStorageDriver
+{
+private:
+    /* Journal request types */
+    typedef enum _RequestType {
+        REQUEST_READ         = 0x01,
+        REQUEST_WRITE        = 0x02,
+        REQUEST_ERASE        = 0x03,
+        REQUEST_READV        = 0x04,
+        REQUEST_WRITEV       = 0x05,
+        REQUEST_ERASE_SECTOR = 0x06,
+    } RequestType;
+
+    /* Finished (or submitted) driver request */
+    typedef struct _Request {
+        RequestType   type;    // Request type
+        uint32_t      address; // Request address (first page address for erase, sector address for sector erase)
+        uint32_t      len;     // Request data length in bytes
+        uint32_t      count;   // Vectored request ranges count
+        uint32_t      offset;  // Request data offset in m_data
+        StorageStatus status;  // Request result
+    } Request;
+
+    /* Vectored request range, the request data is the ranges table and the ranges data after it */
+    typedef struct _Range {
+        uint32_t address; // Range start address
+        uint32_t len;     // Range length in bytes
+    } Range;
+
+    /* Target driver */
+    IStorageDriver* m_driver;
+
+    /* Finished requests */
+    std::vector<Request> m_requests;
+
+    /* Finished requests data */
+    std::vector<uint8_t> m_data;
+
+    /* Next replayed request index */
+    uint32_t m_position;
+
+    /* Flag that indicates that the current step got STORAGE_BUSY */
+    bool m_busy;
+
+    /* Flag that indicates that the asynchronous request is in progress */
+    bool m_pending;
+
+    /* Flag that indicates that the request in progress is submitted before the journal clear (the result is dropped) */
+    bool m_pendingStale;
+
+    /* Asynchronous request in progress */
+    Request m_pendingRequest;
+
+    /* Asynchronous request data */
+    std::vector<uint8_t> m_pendingData;
+
+    /*
+     * @param type Request type
+     * @return     Returns true if the request reads memory
+     */
+    static bool isRead(RequestType type);
+
+    /*
+     * Compares the request with the recorded one
+     *
+     * @param recorded Recorded request
+     * @param request  Current request
+     * @param data     Recorded request data
+     * @param reqData  Current request data (not compared for read)
+     * @return         Returns true if the requests are the same
+     */
+    static bool isSame(const Request& recorded, const Request& request, const uint8_t* data, const uint8_t* reqData);
+
+    /*
+     * Executes the request if the current step has not got STORAGE_BUSY yet
+     *
+     * @param request Current request
+     * @param data    Read target or write (erase) source data
+     * @return        Returns the request result or STORAGE_BUSY if the request is not finished
+     */
+    StorageStatus execute(Request request, uint8_t* data);
+
+    /*
+     * Replays the recorded request, records and executes the new one
+     *
+     * @param request Current request
+     * @param data    Read target or write (erase) source data
+     * @return        Returns the request result or STORAGE_BUSY if the request is not finished
+     */
+    StorageStatus executeRequest(Request request, uint8_t* data);
+
+    /*
+     * Executes the vectored request as one journal request
+     *
+     * @param type  REQUEST_READV or REQUEST_WRITEV
+     * @param vec   Memory ranges
+     * @param count Memory ranges count
+     * @return      Returns the request result or STORAGE_BUSY if the request is not finished
+     */
+    StorageStatus executeVectored(RequestType type, const StorageIOVec* vec, const uint32_t count);
+
+    /*
+     * Records the finished request
+     *
+     * @param request Finished request
+     * @param data    Request data
+     */
+    void record(const Request& request, const uint8_t* data);
+
+public:
+    /*
+     * StorageJournal constructor
+     *
+     * @param driver Target driver
+     */
+    StorageJournal(IStorageDriver* driver = nullptr);
+
+    /*
+     * Changes the target driver and clears the journal
+     *
+     * @param driver Target driver
+     */
+    void setDriver(IStorageDriver* driver);
+
+    /*
+     * @return Returns the target driver
+     */
+    IStorageDriver* getDriver();
+
+    /*
+     * Starts the step replay from the first recorded request
+     */
+    void rewind();
+
+    /*
+     * @return Returns true if the current step got STORAGE_BUSY
+     */
+    bool isBusy();
+
+    /*
+     * Drops all the recorded requests (the request in progress is kept)
+     */
+    void clear();
+
+    StorageStatus read(const uint32_t address, uint8_t* data, const uint32_t len) override;
+    StorageStatus write(const uint32_t address, const uint8_t* data, const uint32_t len) override;
+    StorageStatus erase(const uint32_t* addresses, const uint32_t count) override;
+    StorageStatus readv(const StorageIOVec* vec, const uint32_t count) override;
+    StorageStatus writev(const StorageIOVec* vec, const uint32_t count) override;
+    StorageStatus eraseSector(const uint32_t address) override;
+
+    /*
+     * @return Returns the target driver capabilities that the journal supports: the
+     *         journal is not shared by threads and the asynchronous driver gets only
+     *         the single range requests (the journal itself is synchronous)
+     */
+    uint32_t capabilities() override;
+};
+
+
+#endif
\ No newline at end of file
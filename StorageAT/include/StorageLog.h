@@ -0,0 +1,91 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_LOG_H_
+#define _STORAGE_LOG_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "StorageType.h"
+
+
+/*
+ * StorageLog is the write head of the log-structured writes
+ *
+ * The head hands out the empty pages of one open erase sector in the address
+ * order and then opens the next erase sector that has empty or stale pages.
+ * Opening erases all the empty and stale pages of the sector by one request
+ * and marks the stale pages as empty, so the data pages are written without
+ * the erase of every write. The head position is kept in RAM only, after the
+ * mount the head starts from the memory start.
+ */
+class StorageLog
+{
+private:
+    /* Address from which the next data search begins */
+    uint32_t m_head;
+
+    /* Open erase sector index */
+    uint32_t m_sectorIndex;
+
+    /* Flag that indicates that the erase sector is open */
+    bool m_opened;
+
+    /*
+     * Searches the empty page of the erase sector starting from the address
+     *
+     * @param sectorIndex  Erase sector index
+     * @param startAddress The address from which the search begins
+     * @param address      Pointer that used to find needed page address
+     * @return             Returns STORAGE_OK if the empty page was found
+     */
+    StorageStatus findSectorFree(uint32_t sectorIndex, uint32_t startAddress, uint32_t* address);
+
+    /*
+     * Erases the empty and stale pages of the erase sector and marks the stale pages as empty
+     *
+     * @param sectorIndex Erase sector index
+     * @return            Returns STORAGE_OK if the sector was opened successfully
+     */
+    StorageStatus openSector(uint32_t sectorIndex);
+
+public:
+    /*
+     * StorageLog constructor
+     */
+    StorageLog();
+
+    /*
+     * Hands out the next empty page of the write head
+     *
+     * @param startSearchAddress The address from which the search begins (the head
+     *                           address for the data start page)
+     * @param dataAddress        The data start address (StorageAT::MAX_ADDRESS for
+     *                           the data start page), the search ends at its erase sector
+     * @param address            Pointer that used to find needed page address
+     * @return                   Returns STORAGE_OK if the empty page was found
+     */
+    StorageStatus reserve(uint32_t startSearchAddress, uint32_t dataAddress, uint32_t* address);
+
+    /*
+     * Closes the open erase sector (after the memory change by other writers)
+     */
+    void reset();
+
+    /*
+     * Closes the open erase sector if the page that becomes empty without the erase
+     * may be handed out (its empty pages are erased again on the next open)
+     *
+     * @param address The page address
+     */
+    void release(uint32_t address);
+
+    /*
+     * @return Returns the address from which the next data search begins
+     */
+    uint32_t getHead();
+};
+
+
+#endif
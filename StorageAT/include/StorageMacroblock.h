@@ -21,6 +21,16 @@ public:
 	static const uint32_t PAGES_COUNT = RESERVED_PAGES_COUNT + Header::PAGES_COUNT;
 
 
+	/*
+	 * Calculates the pages count of the macroblocks group. If the erase sector fits
+	 * one or more macroblocks, every group starts at the erase sector start and the
+	 * pages after the last group macroblock are not used (they are handled as the
+	 * reserved pages of the next macroblock), else the macroblocks follow each other
+	 *
+	 * @return Returns the macroblocks group pages count
+	 */
+	static uint32_t getGroupPagesCount();
+
 	/*
 	 * Calculates macroblock start address
 	 *
@@ -77,6 +87,15 @@ public:
 	 */
 	static StorageStatus formatMacroblock(uint32_t macroblockIndex);
 
+	/*
+	 * Formats several macroblocks, the headers are saved by vectored requests
+	 *
+	 * @param macroblockIndex First target macroblock index
+	 * @param count           Target macroblocks count
+	 * @return                Returns STORAGE_OK if the macroblocks were formatted successfully
+	 */
+	static StorageStatus formatMacroblocks(uint32_t macroblockIndex, uint32_t count);
+
 	/*
 	 * Loads header from the header macroblock
 	 * 
@@ -84,6 +103,92 @@ public:
 	 * @return       Returns STORAGE_OK if the header was loaded successfully
 	 */
 	static StorageStatus loadHeader(Header *header);
+
+	/*
+	 * Saves header to the header macroblock
+	 *
+	 * @param header    Pointer to the target header
+	 * @param writeBack Flag that allows to postpone saving until the header cache flush
+	 * @return          Returns STORAGE_OK if the header was saved successfully
+	 */
+	static StorageStatus saveHeader(Header *header, bool writeBack = false);
+
+	/*
+	 * Saves several headers by vectored requests (without the header cache write-back)
+	 *
+	 * @param headers  Pointers to the target headers
+	 * @param count    Headers count
+	 * @param statuses Pointer to the array for the headers save results
+	 * @return         Returns STORAGE_BUSY if memory is busy and STORAGE_OK otherwise
+	 */
+	static StorageStatus saveHeaders(Header* const* headers, uint32_t count, StorageStatus* statuses);
+
+	/*
+	 * Checks that the macroblock header is waiting for the rebuild (the macroblock is read-only)
+	 *
+	 * @param macroblockIndex Macroblock index
+	 * @return                Returns true if the header is waiting for the rebuild
+	 */
+	static bool isRebuildQueued(uint32_t macroblockIndex);
+
+	/*
+	 * Rebuilds the broken headers in the queue order
+	 *
+	 * @param count Max rebuilt headers count
+	 * @return      Returns STORAGE_OK if the headers were rebuilt successfully
+	 */
+	static StorageStatus rebuildHeaders(uint32_t count);
+
+private:
+	/*
+	 * Updates the free pages bitmap and the header cache after the header save
+	 * (the header that is not saved is dropped from the cache and the bitmap and
+	 * the index are invalidated)
+	 *
+	 * @param header Pointer to the saved header
+	 * @param status The header save result
+	 * @return       Returns the header save result or STORAGE_BUSY
+	 */
+	static StorageStatus updateSavedHeader(Header* header, StorageStatus status);
+
+	/*
+	 * Clears all the not blocked pages in the header
+	 *
+	 * @param header Pointer to the target header
+	 */
+	static void clearHeader(Header* header);
+
+	/*
+	 * Erases the macroblock pages if the cleared header was not saved
+	 *
+	 * @param macroblockIndex Target macroblock index
+	 * @param status          The cleared header save result
+	 * @return                Returns STORAGE_OK if the macroblock was formatted successfully
+	 */
+	static StorageStatus completeFormat(uint32_t macroblockIndex, StorageStatus status);
+
+	/*
+	 * Rebuilds and saves the broken header (the checkpoint is marked as stale before)
+	 *
+	 * @param header  Pointer to the target header
+	 * @param scanned Flag that indicates that the header was scanned and has no data pages
+	 * @return        Returns STORAGE_OK if the header was rebuilt successfully
+	 */
+	static StorageStatus rebuildHeader(Header* header, bool scanned);
+
+	/*
+	 * Blocks the empty pages of the scanned header and queues the header for the rebuild
+	 *
+	 * @param header Pointer to the scanned header
+	 */
+	static void setReadOnly(Header* header);
+
+	/*
+	 * Removes the header from the rebuild queue before the format and resets the read-only statuses
+	 *
+	 * @param header Pointer to the target header
+	 */
+	static void cancelRebuild(Header* header);
 };
 
 
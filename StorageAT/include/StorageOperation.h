@@ -0,0 +1,229 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_OPERATION_H_
+#define _STORAGE_OPERATION_H_
+
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "StorageAT.h"
+#include "StoragePage.h"
+#include "StorageType.h"
+#include "StorageSearch.h"
+#include "StorageJournal.h"
+
+
+/*
+ * StorageOperation is a resumable (non-blocking) StorageAT request
+ *
+ * The operation is started by one of the start methods and then advanced by
+ * process() calls. Every operation is a sequence of steps with its own cursor:
+ * load reads one data page per step, find searches one macroblock, save plans
+ * and erases the pages, writes one page per step and then registrates the pages
+ * macroblock by macroblock, format formats one macroblock (group) per step.
+ * When memory is busy (or the asynchronous driver request is in progress) process()
+ * returns STORAGE_BUSY and the next call repeats the unfinished step: the finished
+ * driver requests of the step are replayed from the operation journal. If another
+ * call changes memory between process() calls the journal is dropped, load, find
+ * and save start again from the first step (format continues).
+ * The data, address and prefix buffers must stay valid until the operation ends.
+ */
+class StorageOperation
+{
+private:
+    /* Operation types */
+    typedef enum _OperationType {
+        OPERATION_NONE   = 0x00,
+        OPERATION_LOAD   = 0x01,
+        OPERATION_SAVE   = 0x02,
+        OPERATION_FIND   = 0x03,
+        OPERATION_FORMAT = 0x04,
+    } OperationType;
+
+    /* Operation phases */
+    typedef enum _OperationPhase {
+        PHASE_START  = 0x00, // Checks and the first step (load start page, save pages plan)
+        PHASE_NEXT   = 0x01, // Next data pages (load) or macroblocks (find, format)
+        PHASE_WRITE  = 0x02, // Save data pages write
+        PHASE_COMMIT = 0x03, // Save data pages registration in the headers
+    } OperationPhase;
+
+    /* Target allocation table */
+    StorageAT* m_storage;
+
+    /* Finished driver requests of the current step */
+    StorageJournal m_journal;
+
+    /* Current operation type */
+    OperationType m_type;
+
+    /* Current operation phase */
+    OperationPhase m_phase;
+
+    /* Last operation result */
+    StorageStatus m_status;
+
+    /* Operation storage address */
+    uint32_t m_address;
+
+    /* Pointer to the find result address */
+    uint32_t* m_resAddress;
+
+    /* Operation data prefix */
+    char m_prefix[STORAGE_PAGE_PREFIX_SIZE + 1];
+
+    /* Operation data id */
+    uint32_t m_id;
+
+    /* Operation data */
+    uint8_t* m_data;
+
+    /* Operation data length */
+    uint32_t m_len;
+
+    /* Operation find mode */
+    StorageFindMode m_mode;
+
+    /* Phase cursor: next data page (save write), target (save commit) or macroblock (find, format) index */
+    uint32_t m_cursor;
+
+    /* Loaded data length */
+    uint32_t m_readLen;
+
+    /* Flag that indicates that the loaded page is the data end page */
+    bool m_hasEnd;
+
+    /* Last loaded data page */
+    Page m_page;
+
+    /* Planned data page addresses (save) */
+    std::vector<uint32_t> m_targets;
+
+    /* Search of the find operation */
+    std::unique_ptr<StorageSearchBase> m_search;
+
+    /* Memory changes counter after the last process() call (see StorageContext::changesCount) */
+    uint32_t m_changesCount;
+
+    /*
+     * Prepares the operation
+     *
+     * @param type   New operation type
+     * @param prefix Data prefix
+     * @param id     Data id
+     */
+    void start(OperationType type, const char* prefix, uint32_t id);
+
+    /*
+     * Ends the operation
+     *
+     * @param status The operation result
+     */
+    void finish(StorageStatus status);
+
+    /*
+     * Executes the next operation step through the journal
+     *
+     * @return Returns STORAGE_BUSY if the step is not finished
+     */
+    StorageStatus step();
+
+    /*
+     * Load steps: the start page and the next pages
+     *
+     * @return Returns STORAGE_BUSY if the step is not finished
+     */
+    StorageStatus stepLoad();
+
+    /*
+     * Save steps: the pages plan and erase, the page writes and the headers registration
+     *
+     * @return Returns STORAGE_BUSY if the step is not finished
+     */
+    StorageStatus stepSave();
+
+    /*
+     * Find steps: the index (bitmap) search or the macroblock search
+     *
+     * @return Returns STORAGE_BUSY if the step is not finished
+     */
+    StorageStatus stepFind();
+
+    /*
+     * Format steps: the checkpoint invalidation and the macroblock (group) formats
+     *
+     * @return Returns STORAGE_BUSY if the step is not finished
+     */
+    StorageStatus stepFormat();
+
+    /*
+     * Copies the payload of the loaded page to the load data
+     */
+    void copyPage();
+
+    /*
+     * @return Returns true if the step result is not trusted (some driver request of the step was not finished)
+     */
+    bool isStepBusy(StorageStatus status);
+
+public:
+    /*
+     * StorageOperation constructor
+     *
+     * @param storage Target allocation table
+     */
+    StorageOperation(StorageAT* storage);
+
+    /*
+     * Starts data load (see StorageAT::load)
+     *
+     * @param address Storage page address to load
+     * @param data    Pointer to data array for load data
+     * @param len     Data array length
+     */
+    void startLoad(uint32_t address, uint8_t* data, uint32_t len);
+
+    /*
+     * Starts data save (see StorageAT::save)
+     *
+     * @param address Storage page address to save
+     * @param prefix  String page prefix of header
+     * @param id      Integer page prefix of header
+     * @param data    Pointer to data array for save data
+     * @param len     Array size
+     */
+    void startSave(uint32_t address, const char* prefix, uint32_t id, uint8_t* data, uint32_t len);
+
+    /*
+     * Starts data search (see StorageAT::find)
+     *
+     * @param mode    Current search mode
+     * @param address Pointer that used to find needed page address
+     * @param prefix  String page prefix of header that needed to be found in storage
+     * @param id      Integer page prefix of header that needed to be found in storage
+     */
+    void startFind(StorageFindMode mode, uint32_t* address, const char* prefix = "", uint32_t id = 0);
+
+    /*
+     * Starts memory format (see StorageAT::format)
+     */
+    void startFormat();
+
+    /*
+     * Continues the operation
+     *
+     * @return Returns STORAGE_BUSY while the operation is in progress and the operation result after
+     */
+    StorageStatus process();
+
+    /*
+     * @return Returns true if there is no operation in progress
+     */
+    bool isDone();
+};
+
+
+#endif
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 
 #include <stdint.h>
+#include <unordered_map>
 
 #include "StorageType.h"
 
@@ -52,6 +53,25 @@ public:
      */
     virtual StorageStatus load(bool startPage = false);
 
+    /*
+     * Loads and validates only the page meta data (the payload is not loaded).
+     * v8 pages are validated by the page meta CRC16, the pages of the previous
+     * versions are loaded and validated as a whole.
+     *
+     * @param startPage Flag for validate that page page being loaded is the data start page
+     * @return          Returns STORAGE_OK if the page meta data was loaded successfully
+     */
+    StorageStatus loadMeta(bool startPage = false);
+
+    /*
+     * Validates the page that was read from memory by the caller
+     *
+     * @param raw       Page data read from the page address
+     * @param startPage Flag for validate that page page being loaded is the data start page
+     * @return          Returns STORAGE_OK if the page was loaded successfully
+     */
+    StorageStatus parse(const PageStruct* raw, bool startPage = false);
+
     /*
      * Saves page to memory
      *
@@ -59,19 +79,41 @@ public:
      */
     virtual StorageStatus save();
 
+    /*
+     * Saves page that is empty in the macroblock header to memory
+     * (STORAGE_VERIFY_SKIP_EMPTY policy does not read the page before write)
+     *
+     * @return Returns STORAGE_OK if page was saved successfully
+     */
+    StorageStatus saveEmpty();
+
+    /*
+     * Saves the pages to memory with one vectored write and checks them with
+     * one vectored read, the pages that were not saved by the batch are saved
+     * one by one
+     *
+     * @param pages    Pointers to the pages for save
+     * @param count    Pages count
+     * @param statuses Pointer to the array for the pages save results
+     * @return         Returns STORAGE_BUSY if memory is busy and STORAGE_OK otherwise
+     */
+    static StorageStatus saveBatch(Page* const* pages, uint32_t count, StorageStatus* statuses);
+
     /*
      * Loads and validates previously data page from memory
      *
-     * @return Returns STORAGE_OK if the previously page exists and was loaded successfully
+     * @param metaOnly Flag for load only the page meta data (loadMeta)
+     * @return         Returns STORAGE_OK if the previously page exists and was loaded successfully
      */
-    StorageStatus loadPrev();
+    StorageStatus loadPrev(bool metaOnly = false);
 
     /*
      * Loads and validates next data page from memory
      *
-     * @return Returns STORAGE_OK if the next page exists and was loaded successfully
+     * @param metaOnly Flag for load only the page meta data (loadMeta)
+     * @return         Returns STORAGE_OK if the next page exists and was loaded successfully
      */
-    StorageStatus loadNext();
+    StorageStatus loadNext(bool metaOnly = false);
 
     /*
      * Checks that the page is a data start page
@@ -113,6 +155,18 @@ public:
      */
     uint32_t getAddress();
 
+    /*
+     * @return Returns the page payload size (v6 pages loaded by STORAGE_PAGE_CRC32C and
+     *         STORAGE_PAGE_META_CRC builds keep the v6 payload size)
+     */
+    uint32_t getPayloadSize();
+
+    /*
+     * @return Returns pointer to the page payload (v6 pages loaded by STORAGE_PAGE_META_CRC
+     *         builds keep the payload right after the v6 page meta data)
+     */
+    uint8_t* getPayload();
+
     /*
      * Sets previously page address of the data
      *
@@ -145,12 +199,47 @@ protected:
      */
     uint16_t getCRC16(uint8_t* buf, uint16_t len);
 
+    /*
+     * Calculates the current page format checksum
+     *
+     * @return Returns CRC32C of the page data if STORAGE_PAGE_CRC32C is defined and CRC16 otherwise
+     */
+    StoragePageCRC getPageCRC();
+
+    /*
+     * Calculates the v8 page meta CRC16
+     *
+     * @param meta Page meta data
+     * @return     Returns CRC16 of the page meta fields before the meta CRC16
+     */
+    static uint16_t getMetaCRC(const PageMeta* meta);
+
+    /*
+     * Checks the v5 and v6 page CRC16 (the last two page bytes)
+     *
+     * @return Returns true if the page CRC16 is correct
+     */
+    bool validateCRC16();
+
 private:
+    /*
+     * Writes the page to memory according to the StorageAT verification policy
+     *
+     * @param emptyPage Flag that indicates that the page is empty in the macroblock header
+     * @return          Returns STORAGE_OK if page was saved successfully
+     */
+    StorageStatus write(bool emptyPage);
+
     /*
      * Tries to repair the page
      */
     void repair();
 
+    /*
+     * Sets the page magic, version and CRC16 before the page write
+     */
+    void prepare();
+
 };
 
 /*
@@ -165,6 +254,52 @@ private:
     /* Single page meta status bits count */
     static const uint8_t STATUS_BITS_COUNT = 2;
 
+    /* Data chain walk results */
+    typedef enum _ChainState {
+        CHAIN_UNKNOWN = 0, // The page was not walked in the direction
+        CHAIN_WALK,        // The page is on the current walk path (the chain loop check)
+        CHAIN_VALID,       // The walk reaches the data start (end) page
+        CHAIN_BROKEN,      // The walk does not reach the data start (end) page
+    } ChainState;
+
+    /* Data page node of the chains validation link graph */
+    typedef struct _ChainLink {
+        bool     valid; // The page was loaded successfully
+        PageMeta meta;  // Page meta data
+        uint8_t  start; // Previously pages walk result (ChainState)
+        uint8_t  end;   // Next pages walk result (ChainState)
+    } ChainLink;
+
+    /*
+     * Finds the page in the link graph and loads it from memory if it is not there
+     *
+     * @param links   Pointer to the link graph by page address
+     * @param address Page address
+     * @param link    Pointer to the page node pointer
+     * @return        Returns STORAGE_OK if the page node was found or added
+     */
+    static StorageStatus loadChainLink(
+        std::unordered_map<uint32_t, ChainLink>* links,
+        uint32_t                                 address,
+        ChainLink**                              link
+    );
+
+    /*
+     * Walks the page links to the data start (or end) page, the result is kept
+     * for every page of the walk, so each page is walked once per direction
+     *
+     * @param links   Pointer to the link graph by page address
+     * @param address Walk start page address
+     * @param next    Walk direction (true for the next pages)
+     * @return        Returns STORAGE_OK if the data start (end) page was reached
+     *                and STORAGE_NOT_FOUND if the data chain is broken
+     */
+    static StorageStatus walkChain(
+        std::unordered_map<uint32_t, ChainLink>* links,
+        uint32_t                                 address,
+        bool                                     next
+    );
+
 protected:
     /*
      * Validates the header data
@@ -176,6 +311,7 @@ protected:
 public:
     /* Header page statuses */
     typedef enum _PageHeaderStatus {
+        PAGE_STALE   = static_cast<uint8_t>(0b00), // Page keeps the superseded data and has to be erased before reuse
         PAGE_OK      = static_cast<uint8_t>(0b01), // Data on page exists
         PAGE_EMPTY   = static_cast<uint8_t>(0b10), // Page is empty
         PAGE_BLOCKED = static_cast<uint8_t>(0b11), // Page is blocked for load and save by StorageAT library
@@ -286,6 +422,16 @@ public:
      */
     StorageStatus create();
 
+    /*
+     * Fills the header from the macroblock pages meta data without the data chains
+     * validation and without saving (the not valid pages are empty)
+     *
+     * @param dataPagesCount Pointer to the valid data pages count
+     * @param metas          Pointer to the array for the valid pages meta data (optional)
+     * @return               Returns STORAGE_OK if the pages were read successfully
+     */
+    StorageStatus scan(uint32_t* dataPagesCount, PageMeta* metas = nullptr);
+
     /*
      * Sets the page status in the header
      *
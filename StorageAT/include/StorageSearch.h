@@ -4,12 +4,14 @@
 #define _STORAGE_SEARCH_H_
 
 
+#include <memory>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "StorageAT.h"
 #include "StoragePage.h"
 #include "StorageType.h"
+#include "StorageThreadPool.h"
 
 
 /*
@@ -31,7 +33,9 @@ public:
 	virtual ~StorageSearchBase() { foundOnce = false; }
 
 	/*
-	 * Searches data in all memory
+	 * Searches data in all memory. The macroblocks are searched by the thread
+	 * pool of the current instance if the pool is enabled, the driver declares
+	 * STORAGE_DRIVER_CAP_PARALLEL and the current call holds no macroblock locks.
 	 * 
 	 * @param prefix     String page prefix of header
 	 * @param id         Integer page prefix of header
@@ -44,7 +48,25 @@ public:
 		uint32_t*      resAddress
 	);
 
+	/*
+	 * Creates the search object of the find mode
+	 *
+	 * @param mode               Search mode
+	 * @param startSearchAddress The address from which the search begins
+	 * @return                   Returns the new search object or nullptr if the mode is unknown
+	 */
+	static std::unique_ptr<StorageSearchBase> create(StorageFindMode mode, uint32_t startSearchAddress = 0);
+
 protected:
+	friend class StorageOperation;
+
+	/* Search result of the single macroblock */
+	typedef struct _MacroblockResult {
+		StorageStatus status;  // Macroblock search status
+		uint32_t      address; // Found page address
+		uint32_t      id;      // Found page header ID
+	} MacroblockResult;
+
 	/* Start search address */
 	uint32_t startSearchAddress;
 
@@ -70,6 +92,59 @@ protected:
 	 */
 	virtual bool isNeededFirstResult() { return false; }
 
+	/*
+	 * @return Returns the new search object of the current mode
+	 */
+	virtual std::unique_ptr<StorageSearchBase> clone() = 0;
+
+	/*
+	 * Resets the search result before the macroblock by macroblock search
+	 */
+	void startSearch();
+
+	/*
+	 * Searches data in the next macroblock of the started search (the result of
+	 * the previous macroblocks is kept in the search object)
+	 *
+	 * @param macroblockIndex Macroblock index
+	 * @param prefix          String page prefix of header
+	 * @param id              Integer page prefix of header
+	 * @return                Returns STORAGE_OK if the search is finished by the macroblock
+	 *                        result, STORAGE_NOT_FOUND if the next macroblocks have to be
+	 *                        searched and STORAGE_BUSY or STORAGE_OOM on the header load error
+	 */
+	StorageStatus searchMacroblock(
+		uint32_t       macroblockIndex,
+		const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t id
+	);
+
+	/*
+	 * @param resAddress Pointer that used to find needed page address
+	 * @return           Returns STORAGE_OK if data was found by the search
+	 */
+	StorageStatus getResult(uint32_t* resAddress);
+
+	/*
+	 * Searches data in the macroblocks from startMacroblockIndex by the pool threads.
+	 * The macroblock results are reduced in the macroblock index order: the first
+	 * result for the first result modes and the best id (isIdFound) for others.
+	 *
+	 * @param pool                 Instance thread pool
+	 * @param startMacroblockIndex The macroblock index from which the search begins
+	 * @param prefix               String page prefix of header
+	 * @param id                   Integer page prefix of header
+	 * @param resAddress           Pointer that used to find needed page address
+	 * @return                     Returns STORAGE_OK if data was found
+	 */
+	StorageStatus searchPageAddressParallel(
+		StorageThreadPool* pool,
+		uint32_t           startMacroblockIndex,
+		const uint8_t      prefix[STORAGE_PAGE_PREFIX_SIZE],
+		const uint32_t     id,
+		uint32_t*          resAddress
+	);
+
 	/*
 	 * Searches data in current macroblock
 	 * 
@@ -107,6 +182,11 @@ public:
 	StorageSearchEqual(uint32_t startSearchAddress = 0): StorageSearchBase(startSearchAddress) {}
 
 protected:
+	/*
+	 * @return Returns the new search object of the current mode
+	 */
+	std::unique_ptr<StorageSearchBase> clone() override { return std::make_unique<StorageSearchEqual>(startSearchAddress); }
+
 	/*
 	 * @return Returns true if current mode needed first result
 	 */
@@ -135,6 +215,11 @@ public:
 	StorageSearchNext(uint32_t startSearchAddress = 0): StorageSearchBase(startSearchAddress) {}
 
 protected:
+	/*
+	 * @return Returns the new search object of the current mode
+	 */
+	std::unique_ptr<StorageSearchBase> clone() override { return std::make_unique<StorageSearchNext>(startSearchAddress); }
+
 	/*
 	 * @return Returns current mode start search address
 	 */
@@ -163,6 +248,11 @@ public:
 	StorageSearchMin(uint32_t startSearchAddress = 0): StorageSearchBase(startSearchAddress) {}
 
 protected:
+	/*
+	 * @return Returns the new search object of the current mode
+	 */
+	std::unique_ptr<StorageSearchBase> clone() override { return std::make_unique<StorageSearchMin>(startSearchAddress); }
+
 	/*
 	 * @return Returns current mode start search address
 	 */
@@ -191,6 +281,11 @@ public:
 	StorageSearchMax(uint32_t startSearchAddress = 0): StorageSearchBase(startSearchAddress) {}
 
 protected:
+	/*
+	 * @return Returns the new search object of the current mode
+	 */
+	std::unique_ptr<StorageSearchBase> clone() override { return std::make_unique<StorageSearchMax>(startSearchAddress); }
+
 	/*
 	 * @return Returns true if current header ids matches the mode condition
 	 */
@@ -214,6 +309,11 @@ public:
 	StorageSearchEmpty(uint32_t startSearchAddress = 0): StorageSearchBase(startSearchAddress) {}
 
 protected:
+	/*
+	 * @return Returns the new search object of the current mode
+	 */
+	std::unique_ptr<StorageSearchBase> clone() override { return std::make_unique<StorageSearchEmpty>(startSearchAddress); }
+
 	/*
 	 * @return Returns true if current mode needed first result
 	 */
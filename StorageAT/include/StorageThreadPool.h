@@ -0,0 +1,114 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_THREAD_POOL_H_
+#define _STORAGE_THREAD_POOL_H_
+
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <functional>
+
+#include "StorageType.h"
+#ifndef STORAGE_NO_THREADS
+#   include <mutex>
+#   include <thread>
+#   include <condition_variable>
+#endif
+
+
+/*
+ * StorageThreadPool runs numbered tasks of one job on the worker threads
+ * and the calling thread
+ *
+ * Tasks are taken in the index order, so every task with a smaller index
+ * is started before the task with a bigger one. If the pool is busy with
+ * the job of another thread (or the library is built without STORAGE_THREADS)
+ * the tasks are run by the calling thread only.
+ */
+class StorageThreadPool
+{
+private:
+    /* Threads count including the calling thread */
+    uint32_t m_threadsCount;
+
+    /* Current job tasks */
+    const std::function<void(uint32_t)>* m_task;
+
+    /* Current job tasks count */
+    uint32_t m_tasksCount;
+
+    /* Next task index of the current job */
+    std::atomic<uint32_t> m_nextTask;
+
+#ifndef STORAGE_NO_THREADS
+    /* Worker threads */
+    std::vector<std::thread> m_threads;
+
+    /* Lock of the current job state */
+    std::mutex m_mutex;
+
+    /* Lock of the pool owner (one job at a time) */
+    std::mutex m_runMutex;
+
+    /* Notifies the workers about the new job or the pool stop */
+    std::condition_variable m_wakeup;
+
+    /* Notifies the job owner about the workers end */
+    std::condition_variable m_done;
+
+    /* Current job number */
+    uint32_t m_generation;
+
+    /* Workers count that run the current job tasks */
+    uint32_t m_activeWorkers;
+
+    /* Flag that stops the workers */
+    bool m_stop;
+
+    /*
+     * Worker thread loop
+     */
+    void work();
+#endif
+
+    /*
+     * Runs the current job tasks until all the tasks are taken
+     *
+     * @param task       The job task
+     * @param tasksCount The job tasks count
+     */
+    void runTasks(const std::function<void(uint32_t)>& task, uint32_t tasksCount);
+
+public:
+    /*
+     * StorageThreadPool constructor
+     *
+     * @param threadsCount Threads count including the calling thread
+     */
+    StorageThreadPool(uint32_t threadsCount);
+
+    /*
+     * Stops the worker threads
+     */
+    ~StorageThreadPool();
+
+    /*
+     * @return Returns threads count including the calling thread
+     */
+    uint32_t getThreadsCount();
+
+    /*
+     * Runs the tasks and waits for their end
+     *
+     * @param tasksCount Tasks count
+     * @param task       The task that gets the task index
+     */
+    void run(uint32_t tasksCount, const std::function<void(uint32_t)>& task);
+
+    StorageThreadPool(const StorageThreadPool&) = delete;
+    StorageThreadPool& operator=(const StorageThreadPool&) = delete;
+};
+
+
+#endif
@@ -15,6 +15,16 @@
 #   endif
 #endif
 
+/*
+ * The instance locks and the thread pool are built only with STORAGE_THREADS,
+ * STORAGE_NO_THREADS is defined for single thread targets otherwise
+ */
+#ifndef STORAGE_THREADS
+#   ifndef STORAGE_NO_THREADS
+#       define STORAGE_NO_THREADS
+#   endif
+#endif
+
 
 /* 
  * StorageAT method exit codes 
@@ -42,16 +52,67 @@ typedef enum _StorageFindMode {
 } StorageFindMode;
 
 
+/*
+ * StorageAT driver capabilities (IStorageDriver::capabilities bit mask)
+ */
+typedef enum _StorageDriverCapability {
+	STORAGE_DRIVER_CAP_NONE         = (0x00), // Only single range read, write and erase
+	STORAGE_DRIVER_CAP_READV        = (0x01), // Driver supports vectored read (readv)
+	STORAGE_DRIVER_CAP_WRITEV       = (0x02), // Driver supports vectored write (writev)
+	STORAGE_DRIVER_CAP_ASYNC        = (0x04), // Driver supports asynchronous requests (submit and poll)
+	STORAGE_DRIVER_CAP_PARALLEL     = (0x08), // Driver supports parallel requests from several threads
+	STORAGE_DRIVER_CAP_SECTOR_ERASE = (0x10), // Driver supports native whole erase sector erase (eraseSector)
+} StorageDriverCapability;
+
+
+/*
+ * StorageAT long operation progress callback
+ *
+ * @param done  Processed macroblocks count
+ * @param total Total macroblocks count
+ * @param arg   User argument
+ */
+typedef void (*StorageProgressCallback)(uint32_t done, uint32_t total, void* arg);
+
+
+/*
+ * StorageAT page write verification policy
+ */
+typedef enum _StorageVerifyPolicy {
+	STORAGE_VERIFY_FULL       = (0x00), // Read before write (same data is not written) and full read back
+	STORAGE_VERIFY_CRC        = (0x01), // No read before write, only the stored page checksum is read back
+	STORAGE_VERIFY_SKIP_EMPTY = (0x02), // Full verification without the read before write of empty pages
+	STORAGE_VERIFY_NONE       = (0x03), // Write without verification (the memory controller verifies writes)
+} StorageVerifyPolicy;
+
+
 /* Data storage page size in bytes */
 #define STORAGE_PAGE_SIZE              (256)
 
 /* Page structure validator */
 #define STORAGE_MAGIC                  (0xBEDAC0DE)
 
-/* Current page structure version */
-#define STORAGE_VERSION                (0x06)
+/*
+ * Current page structure version (v7 pages are protected by CRC32C instead of CRC16,
+ * v8 pages have the separate page meta CRC16 for the page meta only reads)
+ */
+#if defined(STORAGE_PAGE_CRC32C) && defined(STORAGE_PAGE_META_CRC)
+#   error "STORAGE_PAGE_META_CRC is not supported by the STORAGE_PAGE_CRC32C page format"
+#elif defined(STORAGE_PAGE_META_CRC)
+#   define STORAGE_VERSION             (0x08)
+#elif defined(STORAGE_PAGE_CRC32C)
+#   define STORAGE_VERSION             (0x07)
+#else
+#   define STORAGE_VERSION             (0x06)
+#endif
+
+/* Current page structure version v8 */
+#define STORAGE_VERSION_V8             (0x08)
 
-/* Current page structure version v5 */
+/* Current page structure version v7 */
+#define STORAGE_VERSION_V7             (0x07)
+
+/* Current page structure version v6 */
 #define STORAGE_VERSION_V6             (0x06)
 
 /* Current page structure version v5 */
@@ -63,8 +124,31 @@ typedef enum _StorageFindMode {
 /* Storage AT default minimal erase size of the memory sector */
 #define STORAGE_DEFAULT_MIN_ERASE_SIZE (4096)
 
+/* Max pages count of a single driver read in the contiguous allocation mode */
+#ifndef STORAGE_EXTENT_PAGES_COUNT
+#   define STORAGE_EXTENT_PAGES_COUNT  (16)
+#endif
+
 
 /* Packed page header meta data structure */
+#ifdef STORAGE_PAGE_META_CRC
+STORAGE_PACK(typedef struct, _PageMeta {
+	 // Special code
+    uint32_t magic;
+    // StorageAT library version
+    uint8_t  version;
+    // Previously data address
+    uint32_t prev_addr;
+    // Next data address
+    uint32_t next_addr;
+    // String page prefix for searching
+    uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE];
+    // ID for searching
+    uint32_t id;
+    // CRC16 of the previous page meta fields (v8)
+    uint16_t crc;
+} PageMeta);
+#else
 STORAGE_PACK(typedef struct, _PageMeta {
 	 // Special code
     uint32_t magic;
@@ -79,10 +163,24 @@ STORAGE_PACK(typedef struct, _PageMeta {
     // ID for searching
     uint32_t id;
 } PageMeta);
+#endif
+
+/* Page meta data size of the v5, v6 and v7 page structure */
+#define STORAGE_PAGE_META_SIZE_V6    (3 * sizeof(uint32_t) + sizeof(uint8_t) + STORAGE_PAGE_PREFIX_SIZE + sizeof(uint32_t))
 
 
+/* Page checksum type */
+#ifdef STORAGE_PAGE_CRC32C
+typedef uint32_t StoragePageCRC;
+#else
+typedef uint16_t StoragePageCRC;
+#endif
+
 /* Available payload bytes in page structure */
-#define STORAGE_PAGE_PAYLOAD_SIZE (STORAGE_PAGE_SIZE - sizeof(struct _PageMeta) - sizeof(uint16_t))
+#define STORAGE_PAGE_PAYLOAD_SIZE    (STORAGE_PAGE_SIZE - sizeof(struct _PageMeta) - sizeof(StoragePageCRC))
+
+/* Available payload bytes in v5 and v6 page structure (CRC16) */
+#define STORAGE_PAGE_PAYLOAD_SIZE_V6 (STORAGE_PAGE_SIZE - STORAGE_PAGE_META_SIZE_V6 - sizeof(uint16_t))
 
 /* Page structure */
 STORAGE_PACK(typedef struct, _PageStruct {
@@ -90,11 +188,22 @@ STORAGE_PACK(typedef struct, _PageStruct {
     PageMeta header;
     // User payload data
     uint8_t  payload[STORAGE_PAGE_PAYLOAD_SIZE];
-    // Page CRC16
-    uint16_t crc;
+    // Page CRC16 (CRC32C if STORAGE_PAGE_CRC32C is defined)
+    StoragePageCRC crc;
 } PageStruct);
 
 
+/* Single memory range of the vectored driver request */
+typedef struct _StorageIOVec {
+	// Range start address (page aligned)
+	uint32_t address;
+	// Range data buffer (is not changed by writev)
+	uint8_t* data;
+	// Range length in bytes
+	uint32_t len;
+} StorageIOVec;
+
+
 bool storage_at_data_success(StorageStatus status);
 
 
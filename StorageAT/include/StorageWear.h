@@ -0,0 +1,120 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#ifndef _STORAGE_WEAR_H_
+#define _STORAGE_WEAR_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#include "StorageType.h"
+
+
+/*
+ * StorageWear is an in-RAM table of the erase counts of every minimum erase
+ * size sector of the allocation table
+ *
+ * Every erase request of StorageAT increments the counters of the erased
+ * sectors once. The counters are kept in the memory region outside of the
+ * allocation table: a superblock page and the counters pages, the superblock
+ * is written after the counters, so an interrupted save leaves the previous
+ * counters. The free pages bitmap uses the counters to start the new data in
+ * the least worn sector.
+ */
+class StorageWear
+{
+private:
+    /* Wear counters superblock validator */
+    static const uint32_t MAGIC = 0x3EA4C047;
+
+    /* Wear counters format version */
+    static const uint8_t VERSION = 0x01;
+
+    /* Wear counters superblock (the first region page) */
+    STORAGE_PACK(typedef struct, _Superblock {
+        uint32_t magic;        // Wear counters validator
+        uint8_t  version;      // Wear counters format version
+        uint32_t sectorSize;   // Erase sector size in bytes
+        uint32_t sectorsCount; // Counters count
+        uint32_t countersCRC;  // CRC32C of the counters
+        uint32_t crc;          // CRC32C of the previous superblock fields
+    } Superblock);
+
+    /* Wear counters region start address */
+    uint32_t m_address;
+
+    /* Erase counts by sector index */
+    std::vector<uint32_t> m_counters;
+
+    /*
+     * @return Returns counters size in bytes rounded up to the pages
+     */
+    static uint32_t getCountersSize();
+
+public:
+    /*
+     * StorageWear constructor (the counters start from zero)
+     *
+     * @param address Wear counters region start address (page aligned, outside of the allocation table)
+     */
+    StorageWear(uint32_t address);
+
+    /*
+     * Loads the counters from memory
+     *
+     * @return Returns STORAGE_OK if the counters were loaded and STORAGE_NOT_FOUND
+     *         if there are no valid counters in memory (the counters are reset)
+     */
+    StorageStatus load();
+
+    /*
+     * Saves the counters to memory
+     *
+     * @return Returns STORAGE_OK if the counters were saved successfully
+     */
+    StorageStatus save();
+
+    /*
+     * Registrates the erase request (every erased sector is counted once)
+     *
+     * @param addresses Erased page addresses
+     * @param count     Erased pages count
+     */
+    void registrate(const uint32_t* addresses, const uint32_t count);
+
+    /*
+     * @param sectorIndex Erase sector index
+     * @return            Returns the sector erase count
+     */
+    uint32_t getEraseCount(uint32_t sectorIndex);
+
+    /*
+     * @return Returns wear counters region start address
+     */
+    uint32_t getAddress();
+
+    /*
+     * @return Returns erase sector size in bytes (not less than the page size)
+     */
+    static uint32_t getSectorSize();
+
+    /*
+     * @return Returns erase sectors count of the allocation table
+     */
+    static uint32_t getSectorsCount();
+
+    /*
+     * @param address Memory address
+     * @return        Returns erase sector index of the address
+     */
+    static uint32_t getSectorIndex(uint32_t address);
+
+    /*
+     * @return Returns wear counters region size in bytes for the current memory geometry
+     */
+    static uint32_t getSize();
+};
+
+
+#endif
@@ -2,33 +2,56 @@
 
 #include "StorageAT.h"
 
+#include <atomic>
+#include <algorithm>
 #include <memory>
 #include <utility>
+#include <assert.h>
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
+#ifndef STORAGE_NO_THREADS
+#   include <mutex>
+#endif
 
+#include "StorageLog.h"
 #include "StorageData.h"
 #include "StorageType.h"
+#include "StorageWear.h"
 #include "StorageSearch.h"
+#include "StorageContext.h"
+#include "StorageCompactor.h"
+#include "StorageCheckpoint.h"
 #include "StorageMacroblock.h"
-
-
-uint32_t StorageAT::m_pagesCount = 0;
-IStorageDriver* StorageAT::m_driver = nullptr;
-uint32_t StorageAT::m_minEraseSize = 0;
+#include "StorageThreadPool.h"
 
 
 StorageAT::StorageAT(
 	uint32_t        pagesCount,
 	IStorageDriver* driver,
 	uint32_t        minEraseSize
-) {
-	m_pagesCount   = pagesCount;
-	m_driver       = driver;
-	m_minEraseSize = minEraseSize;
+):
+	m_context(pagesCount, driver, minEraseSize)
+{
+	// The static functions of the single instance work without the explicit bind
+	m_context.bind();
+}
 
-	while (minEraseSize > STORAGE_DEFAULT_MIN_ERASE_SIZE);
+StorageAT::~StorageAT()
+{
+	m_context.unbind();
+	// The other threads keep the pointer to the destroyed instance until they unbind it
+	assert(!m_context.boundThreadsCount && "StorageAT instance is bound to another thread");
+}
+
+void StorageAT::bind()
+{
+	m_context.bind();
+}
+
+void StorageAT::unbind()
+{
+	m_context.unbind();
 }
 
 StorageStatus StorageAT::find(
@@ -37,6 +60,9 @@ StorageStatus StorageAT::find(
     const char*     prefix,
     uint32_t        id
 ) {
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/false);
+
     if (!address) {
         return STORAGE_ERROR;
     }
@@ -48,31 +74,57 @@ StorageStatus StorageAT::find(
     uint8_t tmpPrefix[STORAGE_PAGE_PREFIX_SIZE + 1] = { 0 };
     memcpy(tmpPrefix, prefix, std::min(static_cast<size_t>(STORAGE_PAGE_PREFIX_SIZE), strlen(prefix)));
 
-    switch (mode) {
-    case FIND_MODE_EQUAL:
-        return (StorageSearchEqual(/*startSearchAddress=*/0)).searchPageAddress(tmpPrefix, id, address);
-    case FIND_MODE_NEXT:
-        return (StorageSearchNext(/*startSearchAddress=*/0)).searchPageAddress(tmpPrefix, id, address);
-    case FIND_MODE_MIN:
-        return (StorageSearchMin(/*startSearchAddress=*/0)).searchPageAddress(tmpPrefix, id, address);
-    case FIND_MODE_MAX:
-        return (StorageSearchMax(/*startSearchAddress=*/0)).searchPageAddress(tmpPrefix, id, address);
-    case FIND_MODE_EMPTY:
-        return (StorageSearchEmpty(/*startSearchAddress=*/0)).searchPageAddress(tmpPrefix, id, address);
-    default:
+    // The index and bitmap lazy builds change the instance state
+    if ((mode != FIND_MODE_EMPTY && m_context.index && strlen(prefix) && !m_context.index->isBuilt()) ||
+        (mode == FIND_MODE_EMPTY && m_context.allocator && !m_context.allocator->isBuilt())
+    ) {
+        access.exclusive();
+    }
+
+    StorageIndex* index = m_context.index.get();
+    if (mode != FIND_MODE_EMPTY && index && strlen(prefix)) {
+        if (!index->isBuilt()) {
+            index->build();
+        }
+        if (index->isBuilt()) {
+            StorageStateGuard state;
+            return index->find(mode, tmpPrefix, id, address);
+        }
+    }
+
+    StorageAllocator* allocator = m_context.allocator.get();
+    if (mode == FIND_MODE_EMPTY && allocator) {
+        if (!allocator->isBuilt()) {
+            allocator->build();
+        }
+        if (allocator->isBuilt()) {
+            StorageStateGuard state;
+            if (m_context.wear) {
+                return allocator->findLeastWorn(address);
+            }
+            return allocator->findFree(/*startAddress=*/0, address);
+        }
+    }
+
+    std::unique_ptr<StorageSearchBase> search = StorageSearchBase::create(mode, /*startSearchAddress=*/0);
+    if (!search) {
         return STORAGE_ERROR;
     }
+    return search->searchPageAddress(tmpPrefix, id, address);
 }
 
 StorageStatus StorageAT::load(uint32_t address, uint8_t* data, uint32_t len)
 {
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/false);
+
     if (address % STORAGE_PAGE_SIZE > 0) {
         return STORAGE_ERROR;
     }
     if (!data) {
         return STORAGE_ERROR;
     }
-    if (address + len >= StorageAT::getStorageSize()) {
+    if (StorageAT::isOutOfMemory(address, len)) {
         return STORAGE_OOM;
     }
 
@@ -87,6 +139,14 @@ StorageStatus StorageAT::save(
     uint8_t* data,
     uint32_t len
 ) {
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/!m_context.isMacroblockLocking());
+
+    // The bitmap lazy build changes the instance state
+    if (m_context.allocator && !m_context.allocator->isBuilt()) {
+        access.exclusive();
+    }
+
     if (address % STORAGE_PAGE_SIZE > 0) {
         return STORAGE_ERROR;
     }
@@ -96,15 +156,20 @@ StorageStatus StorageAT::save(
     if (!prefix) {
         return STORAGE_ERROR;
     }
-    if (address + len >= StorageAT::getStorageSize()) {
+    if (StorageAT::isOutOfMemory(address, len)) {
         return STORAGE_OOM;
     }
 
     uint8_t tmpPrefix[STORAGE_PAGE_PREFIX_SIZE] = {};
     memcpy(tmpPrefix, prefix, std::min(static_cast<size_t>(STORAGE_PAGE_PREFIX_SIZE), strlen(prefix)));
 
+    StorageStatus status = invalidateCheckpoint();
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
     StorageData storageData(address);
-    return storageData.save(tmpPrefix, id, data, len);
+    return flushHeaders(storageData.save(tmpPrefix, id, data, len));
 }
 
 
@@ -116,6 +181,14 @@ StorageStatus StorageAT::rewrite(
     uint8_t* data,
     uint32_t len
 ) {
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/!m_context.isMacroblockLocking());
+
+    // The bitmap lazy build changes the instance state
+    if (m_context.allocator && !m_context.allocator->isBuilt()) {
+        access.exclusive();
+    }
+
     if (address % STORAGE_PAGE_SIZE > 0) {
         return STORAGE_ERROR;
     }
@@ -125,55 +198,534 @@ StorageStatus StorageAT::rewrite(
     if (!prefix) {
         return STORAGE_ERROR;
     }
-    if (address + len >= StorageAT::getStorageSize()) {
+    if (StorageAT::isOutOfMemory(address, len)) {
         return STORAGE_OOM;
     }
 
     uint8_t tmpPrefix[STORAGE_PAGE_PREFIX_SIZE + 1] = {};
     memcpy(tmpPrefix, prefix, std::min(static_cast<size_t>(STORAGE_PAGE_PREFIX_SIZE), strlen(prefix)));
 
+    StorageStatus status = invalidateCheckpoint();
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
     StorageData storageData(address);
-    return storageData.rewrite(tmpPrefix, id, data, len);
+    return flushHeaders(storageData.rewrite(tmpPrefix, id, data, len));
+}
+
+StorageStatus StorageAT::append(
+    const char* prefix,
+    uint32_t id,
+    uint8_t* data,
+    uint32_t len,
+    uint32_t* address
+) {
+    StorageContextGuard guard(&m_context);
+    // The log write head is shared by all writers
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (!m_context.log || !m_context.allocator) {
+        return STORAGE_ERROR;
+    }
+    if (!data) {
+        return STORAGE_ERROR;
+    }
+    if (!prefix) {
+        return STORAGE_ERROR;
+    }
+    if (!m_context.allocator->isBuilt()) {
+        m_context.allocator->build();
+    }
+    if (!m_context.allocator->isBuilt()) {
+        return STORAGE_ERROR;
+    }
+
+    uint8_t tmpPrefix[STORAGE_PAGE_PREFIX_SIZE + 1] = {};
+    memcpy(tmpPrefix, prefix, std::min(static_cast<size_t>(STORAGE_PAGE_PREFIX_SIZE), strlen(prefix)));
+
+    StorageStatus status = invalidateCheckpoint();
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    StorageData storageData(0);
+    status = flushHeaders(storageData.append(tmpPrefix, id, data, len));
+    if (status == STORAGE_OK && address) {
+        *address = storageData.getStartAddress();
+    }
+    return status;
 }
 
 StorageStatus StorageAT::format()
 {
-    for (unsigned i = 0; i < StorageMacroblock::getMacroblocksCount(); i++) {
-        StorageStatus status = StorageMacroblock::formatMacroblock(i);
+    return this->format(/*progress=*/nullptr);
+}
+
+StorageStatus StorageAT::format(StorageProgressCallback progress, void* arg)
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    StorageStatus status = invalidateCheckpoint();
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    if (m_context.index) {
+        m_context.index->invalidate();
+    }
+    if (m_context.log) {
+        m_context.log->reset();
+    }
+    if (m_context.compactor) {
+        m_context.compactor->reset();
+    }
+
+    // Headers of several macroblocks are saved by one vectored request
+    uint32_t macroblocksCount = StorageMacroblock::getMacroblocksCount();
+    uint32_t groupSize = driverHasCapability(STORAGE_DRIVER_CAP_WRITEV) ? STORAGE_EXTENT_PAGES_COUNT : 1;
+    uint32_t groupsCount = (macroblocksCount + groupSize - 1) / groupSize;
+
+    auto formatGroup = [&](uint32_t group) {
+        uint32_t macroblockIndex = group * groupSize;
+        if (groupSize == 1) {
+            return StorageMacroblock::formatMacroblock(macroblockIndex);
+        }
+        return StorageMacroblock::formatMacroblocks(macroblockIndex, std::min(groupSize, macroblocksCount - macroblockIndex));
+    };
+
+#ifndef STORAGE_NO_THREADS
+    StorageThreadPool* pool = m_context.threadPool.get();
+    if (pool && driverHasCapability(STORAGE_DRIVER_CAP_PARALLEL)) {
+        StorageAccessGuard* parent = StorageAccessGuard::current();
+        std::atomic<bool> busy(false);
+        std::mutex progressMutex;
+        uint32_t done = 0;
+
+        pool->run(groupsCount, [&](uint32_t group) {
+            if (busy) {
+                return;
+            }
+
+            StorageContextGuard workerGuard(&m_context);
+            StorageAccessGuard workerAccess(&m_context, parent);
+            if (formatGroup(group) == STORAGE_BUSY) {
+                busy = true;
+                return;
+            }
+
+            if (progress) {
+                std::lock_guard<std::mutex> lock(progressMutex);
+                done += std::min(groupSize, macroblocksCount - group * groupSize);
+                progress(done, macroblocksCount, arg);
+            }
+        });
+
+        if (busy) {
+            return STORAGE_BUSY;
+        }
+        return flushHeaders(STORAGE_OK);
+    }
+#endif
+
+    for (uint32_t group = 0; group < groupsCount; group++) {
+        StorageStatus status = formatGroup(group);
         if (status == STORAGE_BUSY) {
             return STORAGE_BUSY;
         }
+        if (progress) {
+            progress(std::min((group + 1) * groupSize, macroblocksCount), macroblocksCount, arg);
+        }
     }
-    return STORAGE_OK;
+    return flushHeaders(STORAGE_OK);
 }
 
 StorageStatus StorageAT::deleteData(const char* prefix, const uint32_t index)
 {
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/!m_context.isMacroblockLocking());
+
+    StorageStatus status = invalidateCheckpoint();
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
     uint8_t tmpPrefix[STORAGE_PAGE_PREFIX_SIZE + 1] = {};
     memcpy(tmpPrefix, prefix, std::min(static_cast<size_t>(STORAGE_PAGE_PREFIX_SIZE), strlen(prefix)));
 
-    return StorageData(0).deleteData(tmpPrefix, index);
+    return flushHeaders(StorageData(0).deleteData(tmpPrefix, index));
 }
 
 StorageStatus StorageAT::clearAddress(const uint32_t address)
 {
-	return StorageData(0).clearAddress(address);
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/!m_context.isMacroblockLocking());
+
+    StorageStatus status = invalidateCheckpoint();
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+	return flushHeaders(StorageData(0).clearAddress(address));
+}
+
+StorageStatus StorageAT::enableIndex()
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (!m_context.index) {
+        m_context.index = std::make_unique<StorageIndex>();
+    }
+    return m_context.index->build();
+}
+
+void StorageAT::disableIndex()
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+    m_context.index.reset();
+}
+
+StorageStatus StorageAT::enableAllocator(bool contiguous)
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (!m_context.allocator || m_context.allocator->isContiguous() != contiguous) {
+        m_context.allocator = std::make_unique<StorageAllocator>(contiguous);
+    }
+    return m_context.allocator->build();
+}
+
+void StorageAT::disableAllocator()
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+    m_context.allocator.reset();
+}
+
+StorageStatus StorageAT::setHeaderCacheSize(uint32_t headersCount)
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    StorageStatus status = this->flush();
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+
+    m_context.headerCache.reset();
+    if (headersCount) {
+        m_context.headerCache = std::make_unique<StorageHeaderCache>(headersCount);
+    }
+    return status;
+}
+
+StorageStatus StorageAT::flush()
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (!m_context.headerCache) {
+        return STORAGE_OK;
+    }
+    return m_context.headerCache->flush();
+}
+
+void StorageAT::setVerifyPolicy(StorageVerifyPolicy policy)
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    m_context.verifyPolicy = policy;
+}
+
+void StorageAT::enableLazyRebuild()
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+    m_context.lazyRebuild = true;
+}
+
+void StorageAT::disableLazyRebuild()
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+    m_context.lazyRebuild = false;
+}
+
+StorageStatus StorageAT::rebuildHeaders(uint32_t headersCount)
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/!m_context.isMacroblockLocking());
+
+    return StorageMacroblock::rebuildHeaders(headersCount);
+}
+
+uint32_t StorageAT::getRebuildQueueSize()
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/false);
+
+    StorageStateGuard state;
+    return static_cast<uint32_t>(m_context.rebuildQueue.size());
+}
+
+StorageStatus StorageAT::enableCheckpoint(uint32_t address, bool verify)
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (address % STORAGE_PAGE_SIZE > 0) {
+        return STORAGE_ERROR;
+    }
+    if (address < StorageAT::getStorageSize()) {
+        return STORAGE_ERROR;
+    }
+
+    m_context.checkpoint = std::make_unique<StorageCheckpoint>(address);
+    return m_context.checkpoint->load(verify);
+}
+
+void StorageAT::disableCheckpoint()
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+    m_context.checkpoint.reset();
+}
+
+StorageStatus StorageAT::saveCheckpoint()
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (!m_context.checkpoint) {
+        return STORAGE_ERROR;
+    }
+
+    StorageStatus status = flushHeaders(STORAGE_OK);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+    return m_context.checkpoint->save();
+}
+
+StorageStatus StorageAT::enableWearLeveling(uint32_t address)
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (address % STORAGE_PAGE_SIZE > 0) {
+        return STORAGE_ERROR;
+    }
+    if (address < StorageAT::getStorageSize()) {
+        return STORAGE_ERROR;
+    }
+
+    if (!m_context.allocator) {
+        m_context.allocator = std::make_unique<StorageAllocator>();
+    }
+    if (!m_context.allocator->isBuilt()) {
+        m_context.allocator->build();
+    }
+
+    m_context.wear = std::make_unique<StorageWear>(address);
+    return m_context.wear->load();
+}
+
+void StorageAT::disableWearLeveling()
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+    m_context.wear.reset();
+}
+
+StorageStatus StorageAT::saveWearCounters()
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (!m_context.wear) {
+        return STORAGE_ERROR;
+    }
+    return m_context.wear->save();
+}
+
+uint32_t StorageAT::getEraseCount(uint32_t address)
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/false);
+
+    if (!m_context.wear) {
+        return 0;
+    }
+
+    StorageStateGuard state;
+    return m_context.wear->getEraseCount(StorageWear::getSectorIndex(address));
+}
+
+StorageStatus StorageAT::enableLogMode()
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (!m_context.allocator) {
+        m_context.allocator = std::make_unique<StorageAllocator>();
+    }
+    if (!m_context.log) {
+        m_context.log = std::make_unique<StorageLog>();
+    }
+    return m_context.allocator->build();
+}
+
+void StorageAT::disableLogMode()
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+    m_context.log.reset();
+}
+
+StorageStatus StorageAT::compact(uint32_t pagesCount)
+{
+    StorageContextGuard guard(&m_context);
+    // The moved data may be in any macroblock
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    if (!m_context.allocator) {
+        return STORAGE_ERROR;
+    }
+    if (!m_context.allocator->isBuilt()) {
+        m_context.allocator->build();
+    }
+    if (!m_context.allocator->isBuilt()) {
+        return STORAGE_ERROR;
+    }
+    if (!m_context.compactor) {
+        m_context.compactor = std::make_unique<StorageCompactor>();
+    }
+
+    // The checkpoint is not marked as stale if there is nothing to compact
+    StorageStatus status = m_context.compactor->select();
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    status = invalidateCheckpoint();
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    return flushHeaders(m_context.compactor->collect(pagesCount));
+}
+
+#ifndef STORAGE_NO_THREADS
+StorageStatus StorageAT::enableLocking(bool macroblockLocks)
+{
+    StorageContextGuard guard(&m_context);
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    // The headers are written through in the macroblock locking mode
+    StorageStatus status = STORAGE_OK;
+    if (macroblockLocks && m_context.headerCache) {
+        status = m_context.headerCache->flush();
+    }
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+
+    m_context.setMacroblockLocks(macroblockLocks ? StorageMacroblock::getMacroblocksCount() + 1 : 0);
+    m_context.locking = true;
+
+    return status;
+}
+
+void StorageAT::disableLocking()
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    m_context.locking = false;
+    m_context.setMacroblockLocks(0);
+}
+
+void StorageAT::setThreadsCount(uint32_t threadsCount)
+{
+    StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+    m_context.threadPool.reset();
+    if (threadsCount > 1) {
+        m_context.threadPool = std::make_unique<StorageThreadPool>(threadsCount);
+    }
+}
+#endif
+
+StorageStatus StorageAT::flushHeaders(StorageStatus status)
+{
+    StorageHeaderCache* cache = headerCache();
+    if (!cache) {
+        return status;
+    }
+    StorageStatus flushStatus = cache->flush();
+    if (status == STORAGE_OK && !storage_at_data_success(flushStatus)) {
+        return flushStatus;
+    }
+    return status;
+}
+
+bool StorageAT::isOutOfMemory(uint32_t address, uint32_t len)
+{
+    StorageContext* context = StorageContext::current();
+    if (context && (context->wear || context->log)) {
+        return address >= StorageAT::getStorageSize();
+    }
+    return address + len >= StorageAT::getStorageSize();
+}
+
+StorageStatus StorageAT::invalidateCheckpoint()
+{
+    StorageCheckpoint* checkpoint = StorageAT::checkpoint();
+    if (!checkpoint) {
+        return STORAGE_OK;
+    }
+
+    // Writers of different macroblocks may mark the checkpoint at once
+    StorageStateGuard state;
+    return checkpoint->invalidate();
 }
 
 void StorageAT::setPagesCount(const uint32_t pagesCount)
 {
-	m_pagesCount = pagesCount;
+	StorageContextGuard guard(&m_context);
+	StorageAccessGuard access(&m_context, /*exclusive=*/true);
+
+	StorageContext* context = &m_context;
+	context->pagesCount = pagesCount;
+	if (context->index) {
+		context->index->invalidate();
+	}
+	if (context->allocator) {
+		context->allocator->invalidate();
+	}
+	if (context->headerCache) {
+		context->headerCache->invalidate();
+	}
+	if (context->log) {
+		context->log->reset();
+	}
+	if (context->compactor) {
+		context->compactor->reset();
+	}
+	if (context->isMacroblockLocking()) {
+		context->setMacroblockLocks(StorageMacroblock::getMacroblocksCount() + 1);
+	}
 }
 
 uint32_t StorageAT::getStoragePagesCount()
 {
-    return m_pagesCount;
+    StorageContext* context = StorageContext::current();
+    return context ? context->pagesCount : 0;
 }
 
 uint32_t StorageAT::getPayloadPagesCount()
 {
-    uint32_t pagesCount = (getStoragePagesCount() / StorageMacroblock::PAGES_COUNT) * Header::PAGES_COUNT;
-    uint32_t lastPagesCount = getStoragePagesCount() % StorageMacroblock::PAGES_COUNT;
+    uint32_t macroblocksCount = StorageMacroblock::getMacroblocksCount();
+    uint32_t pagesCount = macroblocksCount * Header::PAGES_COUNT;
+    // The pages after the last whole macroblock (the unused group pages are skipped)
+    uint32_t lastAddress = StorageMacroblock::getMacroblockAddress(macroblocksCount);
+    uint32_t lastPagesCount = getStorageSize() > lastAddress ? (getStorageSize() - lastAddress) / STORAGE_PAGE_SIZE : 0;
     if (lastPagesCount > StorageMacroblock::RESERVED_PAGES_COUNT) {
         pagesCount += (lastPagesCount - StorageMacroblock::RESERVED_PAGES_COUNT);
     }
@@ -190,12 +742,161 @@ uint32_t StorageAT::getPayloadSize()
     return StorageAT::getPayloadPagesCount() * STORAGE_PAGE_PAYLOAD_SIZE;
 }
 
+uint32_t StorageAT::getCheckpointSize()
+{
+    return StorageCheckpoint::getSize();
+}
+
+uint32_t StorageAT::getWearCountersSize()
+{
+    return StorageWear::getSize();
+}
+
 IStorageDriver* StorageAT::driverCallback()
 {
-    return StorageAT::m_driver;
+    StorageContext* context = StorageContext::current();
+    return context ? context->driver : nullptr;
 }
 
 uint32_t StorageAT::getMinEraseSize()
 {
-	return m_minEraseSize;
+	StorageContext* context = StorageContext::current();
+	return context ? context->minEraseSize : 0;
+}
+
+StorageIndex* StorageAT::index()
+{
+    StorageContext* context = StorageContext::current();
+    return context ? context->index.get() : nullptr;
+}
+
+bool StorageAT::driverHasCapability(StorageDriverCapability capability)
+{
+    IStorageDriver* driver = driverCallback();
+    return driver && (driver->capabilities() & capability);
+}
+
+StorageStatus StorageAT::driverReadv(const StorageIOVec* vec, const uint32_t count)
+{
+    IStorageDriver* driver = driverCallback();
+    if (driverHasCapability(STORAGE_DRIVER_CAP_READV)) {
+        return driver->readv(vec, count);
+    }
+    // The driver read requests are not longer than a page
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t offset = 0; offset < vec[i].len; offset += STORAGE_PAGE_SIZE) {
+            uint32_t len = std::min(vec[i].len - offset, static_cast<uint32_t>(STORAGE_PAGE_SIZE));
+            StorageStatus status = driver->read(vec[i].address + offset, vec[i].data + offset, len);
+            if (status != STORAGE_OK) {
+                return status;
+            }
+        }
+    }
+    return STORAGE_OK;
+}
+
+StorageStatus StorageAT::driverWrite(const uint32_t address, const uint8_t* data, const uint32_t len)
+{
+    IStorageDriver* driver = driverCallback();
+    if (!driver) {
+        return STORAGE_ERROR;
+    }
+    StorageContext::current()->changesCount++;
+    return driver->write(address, data, len);
+}
+
+StorageStatus StorageAT::driverWritev(const StorageIOVec* vec, const uint32_t count)
+{
+    IStorageDriver* driver = driverCallback();
+    if (!driver) {
+        return STORAGE_ERROR;
+    }
+    StorageContext::current()->changesCount++;
+    if (driverHasCapability(STORAGE_DRIVER_CAP_WRITEV)) {
+        return driver->writev(vec, count);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        StorageStatus status = driver->write(vec[i].address, vec[i].data, vec[i].len);
+        if (status != STORAGE_OK) {
+            return status;
+        }
+    }
+    return STORAGE_OK;
+}
+
+StorageAllocator* StorageAT::allocator()
+{
+    StorageContext* context = StorageContext::current();
+    return context ? context->allocator.get() : nullptr;
+}
+
+StorageHeaderCache* StorageAT::headerCache()
+{
+    StorageContext* context = StorageContext::current();
+    return context ? context->headerCache.get() : nullptr;
+}
+
+StorageCheckpoint* StorageAT::checkpoint()
+{
+    StorageContext* context = StorageContext::current();
+    return context ? context->checkpoint.get() : nullptr;
+}
+
+StorageWear* StorageAT::wear()
+{
+    StorageContext* context = StorageContext::current();
+    return context ? context->wear.get() : nullptr;
+}
+
+StorageLog* StorageAT::log()
+{
+    StorageContext* context = StorageContext::current();
+    return context ? context->log.get() : nullptr;
+}
+
+bool StorageAT::isSectorErase(const uint32_t* addresses, const uint32_t count)
+{
+    uint32_t sectorSize = StorageWear::getSectorSize();
+    if (!driverHasCapability(STORAGE_DRIVER_CAP_SECTOR_ERASE) ||
+        count != sectorSize / STORAGE_PAGE_SIZE ||
+        addresses[0] % sectorSize
+    ) {
+        return false;
+    }
+    for (uint32_t i = 1; i < count; i++) {
+        if (addresses[i] != addresses[0] + i * STORAGE_PAGE_SIZE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+StorageStatus StorageAT::driverErase(const uint32_t* addresses, const uint32_t count)
+{
+    IStorageDriver* driver = driverCallback();
+    if (!driver) {
+        return STORAGE_ERROR;
+    }
+    StorageContext::current()->changesCount++;
+
+    StorageStatus status = STORAGE_OK;
+    if (isSectorErase(addresses, count)) {
+        status = driver->eraseSector(addresses[0]);
+    } else {
+        status = driver->erase(addresses, count);
+    }
+
+    StorageWear* wear = StorageAT::wear();
+    if (status == STORAGE_OK && wear) {
+        // Writers of different macroblocks may erase at once
+        StorageStateGuard state;
+        wear->registrate(addresses, count);
+    }
+    return status;
+}
+
+StorageVerifyPolicy StorageAT::getVerifyPolicy()
+{
+    StorageContext* context = StorageContext::current();
+    return context ? context->verifyPolicy : STORAGE_VERIFY_FULL;
 }
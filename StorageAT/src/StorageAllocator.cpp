@@ -0,0 +1,292 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageAllocator.h"
+
+#include <stdint.h>
+
+#include "StorageAT.h"
+#include "StoragePage.h"
+#include "StorageType.h"
+#include "StorageWear.h"
+#include "StorageMacroblock.h"
+
+
+StorageAllocator::StorageAllocator(bool contiguous): m_built(false), m_contiguous(contiguous), m_pagesCount(0), m_wearCursor(0) {}
+
+uint32_t StorageAllocator::getBitIndex(uint32_t address)
+{
+    return StorageMacroblock::getMacroblockIndex(address) * Header::PAGES_COUNT +
+           StorageMacroblock::getPageIndexByAddress(address);
+}
+
+uint32_t StorageAllocator::getBitAddress(uint32_t bitIndex)
+{
+    return StorageMacroblock::getPageAddressByIndex(bitIndex / Header::PAGES_COUNT, bitIndex % Header::PAGES_COUNT);
+}
+
+uint32_t StorageAllocator::countTrailingZeros(uint32_t word)
+{
+#if defined(__GNUC__)
+    return static_cast<uint32_t>(__builtin_ctz(word));
+#else
+    uint32_t count = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+uint32_t StorageAllocator::countBits(uint32_t word)
+{
+#if defined(__GNUC__)
+    return static_cast<uint32_t>(__builtin_popcount(word));
+#else
+    uint32_t count = 0;
+    for (; word; count++) {
+        word &= word - 1;
+    }
+    return count;
+#endif
+}
+
+uint32_t StorageAllocator::findFreeBit(uint32_t bitIndex)
+{
+    if (bitIndex >= m_pagesCount) {
+        return m_pagesCount;
+    }
+
+    uint32_t wordIndex = bitIndex / WORD_BITS;
+    uint32_t word = m_freeBits[wordIndex] & (0xFFFFFFFF << (bitIndex % WORD_BITS));
+    while (!word) {
+        if (++wordIndex >= m_freeBits.size()) {
+            return m_pagesCount;
+        }
+        word = m_freeBits[wordIndex];
+    }
+
+    uint32_t freeIndex = wordIndex * WORD_BITS + countTrailingZeros(word);
+    return freeIndex < m_pagesCount ? freeIndex : m_pagesCount;
+}
+
+void StorageAllocator::setBit(
+    std::vector<uint32_t>* bits,
+    std::vector<uint32_t>* sectorCounts,
+    uint32_t               bitIndex,
+    bool                   value
+) {
+    uint32_t mask = static_cast<uint32_t>(1) << (bitIndex % WORD_BITS);
+    if (value == static_cast<bool>((*bits)[bitIndex / WORD_BITS] & mask)) {
+        return;
+    }
+
+    uint32_t sectorIndex = StorageWear::getSectorIndex(getBitAddress(bitIndex));
+    if (value) {
+        (*bits)[bitIndex / WORD_BITS] |= mask;
+        (*sectorCounts)[sectorIndex]++;
+    } else {
+        (*bits)[bitIndex / WORD_BITS] &= ~mask;
+        (*sectorCounts)[sectorIndex]--;
+    }
+}
+
+StorageStatus StorageAllocator::build()
+{
+    this->invalidate();
+
+    m_pagesCount = StorageMacroblock::getMacroblocksCount() * Header::PAGES_COUNT;
+    m_freeBits.assign(m_pagesCount / WORD_BITS + (m_pagesCount % WORD_BITS ? 1 : 0), 0);
+    m_staleBits.assign(m_freeBits.size(), 0);
+    m_blockedBits.assign(m_freeBits.size(), 0);
+    m_sectorFreeCounts.assign(StorageWear::getSectorsCount(), 0);
+    m_sectorStaleCounts.assign(StorageWear::getSectorsCount(), 0);
+    m_sectorBlockedCounts.assign(StorageWear::getSectorsCount(), 0);
+
+    for (uint32_t macroblockIndex = 0; macroblockIndex < StorageMacroblock::getMacroblocksCount(); macroblockIndex++) {
+        Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+
+        StorageStatus status = StorageMacroblock::loadHeader(&header);
+        if (status == STORAGE_BUSY || status == STORAGE_OOM) {
+            this->invalidate();
+            return status;
+        }
+
+        this->update(&header);
+    }
+
+    m_built = true;
+
+    return STORAGE_OK;
+}
+
+void StorageAllocator::invalidate()
+{
+    m_built = false;
+    m_pagesCount = 0;
+    m_freeBits.clear();
+    m_staleBits.clear();
+    m_blockedBits.clear();
+    m_sectorFreeCounts.clear();
+    m_sectorStaleCounts.clear();
+    m_sectorBlockedCounts.clear();
+}
+
+bool StorageAllocator::isBuilt()
+{
+    return m_built;
+}
+
+void StorageAllocator::update(Header* header)
+{
+    uint32_t bitIndex = header->getMacroblockIndex() * Header::PAGES_COUNT;
+    for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++, bitIndex++) {
+        if (bitIndex >= m_pagesCount) {
+            return;
+        }
+
+        setBit(&m_freeBits, &m_sectorFreeCounts, bitIndex, header->isPageStatus(pageIndex, Header::PAGE_EMPTY));
+        setBit(&m_staleBits, &m_sectorStaleCounts, bitIndex, header->isPageStatus(pageIndex, Header::PAGE_STALE));
+        setBit(&m_blockedBits, &m_sectorBlockedCounts, bitIndex, header->isPageStatus(pageIndex, Header::PAGE_BLOCKED));
+    }
+}
+
+StorageStatus StorageAllocator::findFree(uint32_t startAddress, uint32_t* address)
+{
+    uint32_t freeIndex = this->findFreeBit(getBitIndex(startAddress));
+    if (freeIndex >= m_pagesCount) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    *address = getBitAddress(freeIndex);
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageAllocator::findLeastWorn(uint32_t* address)
+{
+    StorageWear* wear = StorageAT::wear();
+    if (!wear) {
+        return this->findFree(/*startAddress=*/0, address);
+    }
+
+    uint32_t sectorsCount = static_cast<uint32_t>(m_sectorFreeCounts.size());
+    uint32_t leastIndex   = sectorsCount;
+    uint32_t leastCount   = 0;
+    for (uint32_t i = 0; i < sectorsCount; i++) {
+        uint32_t sectorIndex = (m_wearCursor + i) % sectorsCount;
+        if (!m_sectorFreeCounts[sectorIndex]) {
+            continue;
+        }
+        uint32_t eraseCount = wear->getEraseCount(sectorIndex);
+        if (leastIndex == sectorsCount || eraseCount < leastCount) {
+            leastIndex = sectorIndex;
+            leastCount = eraseCount;
+        }
+    }
+    if (leastIndex == sectorsCount) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    // The sector may start with the macroblock header pages
+    uint32_t sectorAddress = leastIndex * StorageWear::getSectorSize();
+    uint32_t sectorEnd     = sectorAddress + StorageWear::getSectorSize();
+    for (; sectorAddress < sectorEnd; sectorAddress += STORAGE_PAGE_SIZE) {
+        if (!StorageMacroblock::isMacroblockAddress(sectorAddress)) {
+            break;
+        }
+    }
+    if (this->findFree(sectorAddress, address) != STORAGE_OK || *address >= sectorEnd) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    m_wearCursor = (leastIndex + 1) % sectorsCount;
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageAllocator::findFreeRun(uint32_t startAddress, uint32_t count, uint32_t* address)
+{
+    if (!count || count > Header::PAGES_COUNT) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    uint32_t runIndex = this->findFreeBit(getBitIndex(startAddress));
+    uint32_t runCount = 1;
+    while (runIndex < m_pagesCount && runCount < count) {
+        uint32_t freeIndex = this->findFreeBit(runIndex + runCount);
+        if (freeIndex == runIndex + runCount &&
+            freeIndex / Header::PAGES_COUNT == runIndex / Header::PAGES_COUNT
+        ) {
+            runCount++;
+            continue;
+        }
+        runIndex = freeIndex;
+        runCount = 1;
+    }
+
+    if (runIndex >= m_pagesCount) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    *address = getBitAddress(runIndex);
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageAllocator::findExtent(uint32_t startAddress, uint32_t pagesCount, uint32_t* address)
+{
+    if (!m_contiguous || pagesCount <= 1) {
+        return this->findFree(startAddress, address);
+    }
+
+    uint32_t startIndex = getBitIndex(startAddress);
+    uint32_t freeIndex  = this->findFreeBit(startIndex);
+    if (freeIndex >= m_pagesCount) {
+        return STORAGE_NOT_FOUND;
+    }
+    if (freeIndex == startIndex) {
+        *address = getBitAddress(freeIndex);
+        return STORAGE_OK;
+    }
+
+    uint32_t runCount = pagesCount < Header::PAGES_COUNT ? pagesCount : Header::PAGES_COUNT;
+    for (; runCount > 1; runCount /= 2) {
+        if (this->findFreeRun(startAddress, runCount, address) == STORAGE_OK) {
+            return STORAGE_OK;
+        }
+    }
+
+    *address = getBitAddress(freeIndex);
+
+    return STORAGE_OK;
+}
+
+bool StorageAllocator::isContiguous()
+{
+    return m_contiguous;
+}
+
+uint32_t StorageAllocator::getSectorFreeCount(uint32_t sectorIndex)
+{
+    return sectorIndex < m_sectorFreeCounts.size() ? m_sectorFreeCounts[sectorIndex] : 0;
+}
+
+uint32_t StorageAllocator::getSectorStaleCount(uint32_t sectorIndex)
+{
+    return sectorIndex < m_sectorStaleCounts.size() ? m_sectorStaleCounts[sectorIndex] : 0;
+}
+
+uint32_t StorageAllocator::getSectorBlockedCount(uint32_t sectorIndex)
+{
+    return sectorIndex < m_sectorBlockedCounts.size() ? m_sectorBlockedCounts[sectorIndex] : 0;
+}
+
+uint32_t StorageAllocator::getFreePagesCount()
+{
+    uint32_t count = 0;
+    for (uint32_t word : m_freeBits) {
+        count += countBits(word);
+    }
+    return count;
+}
@@ -0,0 +1,237 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageCheckpoint.h"
+
+#include <memory>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "StorageAT.h"
+#include "StorageCRC.h"
+#include "StoragePage.h"
+#include "StorageType.h"
+#include "StorageIndex.h"
+#include "StorageMacroblock.h"
+
+
+typedef StorageAT AT;
+
+
+StorageCheckpoint::StorageCheckpoint(uint32_t address): m_address(address), m_clean(false) {}
+
+uint32_t StorageCheckpoint::getSummarySize()
+{
+    uint32_t size = StorageMacroblock::getMacroblocksCount() * sizeof(Entry);
+    return (size / STORAGE_PAGE_SIZE + (size % STORAGE_PAGE_SIZE ? 1 : 0)) * STORAGE_PAGE_SIZE;
+}
+
+uint32_t StorageCheckpoint::getSize()
+{
+    return STORAGE_PAGE_SIZE + getSummarySize();
+}
+
+uint32_t StorageCheckpoint::getAddress()
+{
+    return m_address;
+}
+
+StorageStatus StorageCheckpoint::writeSuperblock(bool clean, uint32_t summaryCRC)
+{
+    uint8_t buffer[STORAGE_PAGE_SIZE] = {};
+    Superblock* superblock = reinterpret_cast<Superblock*>(buffer);
+    superblock->magic            = MAGIC;
+    superblock->version          = VERSION;
+    superblock->clean            = clean ? 1 : 0;
+    superblock->macroblocksCount = StorageMacroblock::getMacroblocksCount();
+    superblock->summaryCRC       = summaryCRC;
+    superblock->crc              = storage_at_crc32c(buffer, offsetof(Superblock, crc));
+
+    return AT::driverWrite(m_address, buffer, sizeof(buffer));
+}
+
+StorageStatus StorageCheckpoint::load(bool verify)
+{
+    m_entries.clear();
+    m_clean = false;
+
+    uint8_t buffer[STORAGE_PAGE_SIZE] = {};
+    StorageStatus status = AT::driverCallback()->read(m_address, buffer, sizeof(buffer));
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+    if (status != STORAGE_OK) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    Superblock* superblock = reinterpret_cast<Superblock*>(buffer);
+    if (superblock->magic != MAGIC ||
+        superblock->version != VERSION ||
+        superblock->crc != storage_at_crc32c(buffer, offsetof(Superblock, crc)) ||
+        superblock->macroblocksCount != StorageMacroblock::getMacroblocksCount()
+    ) {
+        return STORAGE_NOT_FOUND;
+    }
+    if (!superblock->clean) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    // The summary is read sequentially by one request
+    uint32_t count = superblock->macroblocksCount;
+    std::unique_ptr<uint8_t[]> summary = std::make_unique<uint8_t[]>(getSummarySize());
+    StorageIOVec vec = { m_address + STORAGE_PAGE_SIZE, summary.get(), getSummarySize() };
+    status = count ? AT::driverReadv(&vec, 1) : STORAGE_OK;
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+    if (status != STORAGE_OK ||
+        storage_at_crc32c(summary.get(), count * sizeof(Entry)) != superblock->summaryCRC
+    ) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    std::vector<Entry> entries(count);
+    memcpy(reinterpret_cast<void*>(entries.data()), summary.get(), count * sizeof(Entry));
+
+    // Only the header checksums are read to find the headers changed without the checkpoint
+    for (uint32_t i = 0; verify && i < count; i++) {
+        StoragePageCRC crc = 0;
+        status = AT::driverCallback()->read(
+            entries[i].headerAddress + offsetof(PageStruct, crc),
+            reinterpret_cast<uint8_t*>(&crc),
+            sizeof(crc)
+        );
+        if (status == STORAGE_BUSY) {
+            return status;
+        }
+        if (status != STORAGE_OK || crc != entries[i].headerCRC) {
+            return STORAGE_NOT_FOUND;
+        }
+    }
+
+    m_entries = std::move(entries);
+    m_clean   = true;
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageCheckpoint::save()
+{
+    if (m_clean) {
+        return STORAGE_OK;
+    }
+
+    StorageIndex* index = AT::index();
+    bool indexBuilt = index && index->isBuilt();
+
+    uint32_t count = StorageMacroblock::getMacroblocksCount();
+    std::unique_ptr<uint8_t[]> summary = std::make_unique<uint8_t[]>(getSummarySize());
+    memset(summary.get(), 0, getSummarySize());
+
+    Entry* entry = reinterpret_cast<Entry*>(summary.get());
+    for (uint32_t macroblockIndex = 0; macroblockIndex < count; macroblockIndex++, entry++) {
+        Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+        StorageStatus status = StorageMacroblock::loadHeader(&header);
+        if (status != STORAGE_OK) {
+            return status;
+        }
+
+        entry->headerAddress = header.getAddress();
+        entry->headerCRC     = header.page.crc;
+        memcpy(reinterpret_cast<void*>(&entry->meta), header.data, sizeof(entry->meta));
+
+        // The start pages are marked the same way the index registrates them
+        Header::MetaUnit* metaUnitPtr = header.data->metaUnits;
+        for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++, metaUnitPtr++) {
+            if (!header.isPageStatus(pageIndex, Header::PAGE_OK)) {
+                continue;
+            }
+
+            uint32_t pageAddress = StorageMacroblock::getPageAddressByIndex(macroblockIndex, pageIndex);
+            bool start = false;
+            if (indexBuilt) {
+                uint32_t startAddress = 0;
+                start = index->find(FIND_MODE_EQUAL, (*metaUnitPtr).prefix, (*metaUnitPtr).id, &startAddress) == STORAGE_OK &&
+                        startAddress == pageAddress;
+            } else {
+                Page page(pageAddress);
+                status = page.loadMeta(/*startPage=*/true);
+                if (status == STORAGE_BUSY) {
+                    return status;
+                }
+                start = status == STORAGE_OK;
+            }
+            if (start) {
+                entry->startPages[pageIndex / 8] |= static_cast<uint8_t>(1 << (pageIndex % 8));
+            }
+        }
+    }
+
+    // The summary pages are written by one vectored request if the driver supports it,
+    // the superblock is written after the summary, so an interrupted save leaves a stale checkpoint
+    uint32_t pagesCount = getSummarySize() / STORAGE_PAGE_SIZE;
+    std::vector<StorageIOVec> vec(pagesCount);
+    for (uint32_t i = 0; i < pagesCount; i++) {
+        vec[i] = { m_address + (i + 1) * STORAGE_PAGE_SIZE, summary.get() + i * STORAGE_PAGE_SIZE, STORAGE_PAGE_SIZE };
+    }
+    StorageStatus status = pagesCount ? AT::driverWritev(vec.data(), pagesCount) : STORAGE_OK;
+    if (status != STORAGE_OK) {
+        return status;
+    }
+    status = this->writeSuperblock(/*clean=*/true, storage_at_crc32c(summary.get(), count * sizeof(Entry)));
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    m_clean = true;
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageCheckpoint::invalidate()
+{
+    m_entries.clear();
+    m_entries.shrink_to_fit();
+
+    if (!m_clean) {
+        return STORAGE_OK;
+    }
+
+    StorageStatus status = this->writeSuperblock(/*clean=*/false, /*summaryCRC=*/0);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    m_clean = false;
+
+    return STORAGE_OK;
+}
+
+bool StorageCheckpoint::isLoaded()
+{
+    return !m_entries.empty();
+}
+
+bool StorageCheckpoint::get(Header* header)
+{
+    uint32_t macroblockIndex = header->getMacroblockIndex();
+    if (macroblockIndex >= m_entries.size()) {
+        return false;
+    }
+
+    memcpy(header->data, reinterpret_cast<void*>(&m_entries[macroblockIndex].meta), sizeof(Header::HeaderMeta));
+    header->page.crc = m_entries[macroblockIndex].headerCRC;
+
+    return true;
+}
+
+bool StorageCheckpoint::isStartPage(uint32_t macroblockIndex, uint32_t pageIndex, bool* start)
+{
+    if (macroblockIndex >= m_entries.size() || pageIndex >= Header::PAGES_COUNT) {
+        return false;
+    }
+
+    *start = m_entries[macroblockIndex].startPages[pageIndex / 8] & (1 << (pageIndex % 8));
+
+    return true;
+}
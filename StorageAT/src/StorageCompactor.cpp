@@ -0,0 +1,266 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageCompactor.h"
+
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+
+#include "StorageAT.h"
+#include "StorageData.h"
+#include "StoragePage.h"
+#include "StorageType.h"
+#include "StorageWear.h"
+#include "StorageIndex.h"
+#include "StorageContext.h"
+#include "StorageAllocator.h"
+#include "StorageMacroblock.h"
+
+
+typedef StorageAT AT;
+
+
+StorageCompactor::StorageCompactor(): m_sectorIndex(0), m_selected(false) {}
+
+bool StorageCompactor::getSectorPages(uint32_t sectorIndex, std::vector<uint32_t>* addresses)
+{
+    uint32_t sectorAddress = sectorIndex * StorageWear::getSectorSize();
+    uint32_t sectorEnd     = std::min(sectorAddress + StorageWear::getSectorSize(), AT::getStorageSize());
+
+    addresses->clear();
+    for (uint32_t address = sectorAddress; address < sectorEnd; address += STORAGE_PAGE_SIZE) {
+        uint32_t macroblockIndex = StorageMacroblock::getMacroblockIndex(address);
+        if (macroblockIndex >= StorageMacroblock::getMacroblocksCount() ||
+            StorageMacroblock::isMacroblockAddress(address)
+        ) {
+            continue;
+        }
+        // The macroblock is read-only until the header rebuild
+        if (StorageMacroblock::isRebuildQueued(macroblockIndex)) {
+            return false;
+        }
+        addresses->push_back(address);
+    }
+    return true;
+}
+
+bool StorageCompactor::isErased(uint32_t address)
+{
+    uint8_t buffer[STORAGE_PAGE_SIZE] = {};
+    if (AT::driverCallback()->read(address, buffer, sizeof(buffer)) != STORAGE_OK) {
+        return false;
+    }
+    for (uint8_t byte : buffer) {
+        if (byte != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+StorageStatus StorageCompactor::select()
+{
+    if (m_selected) {
+        return STORAGE_OK;
+    }
+
+    StorageAllocator* allocator = AT::allocator();
+    uint32_t freeCount = allocator->getFreePagesCount();
+
+    bool     found      = false;
+    uint32_t bestLive   = 0;
+    uint32_t bestPages  = 0;
+    uint32_t bestStale  = 0;
+    std::vector<uint32_t> addresses;
+    for (uint32_t sectorIndex = 0; sectorIndex < StorageWear::getSectorsCount(); sectorIndex++) {
+        uint32_t staleCount = allocator->getSectorStaleCount(sectorIndex);
+        if (!staleCount || !getSectorPages(sectorIndex, &addresses) || addresses.empty()) {
+            continue;
+        }
+
+        uint32_t pagesCount   = static_cast<uint32_t>(addresses.size());
+        uint32_t sectorFree   = allocator->getSectorFreeCount(sectorIndex);
+        uint32_t deadCount    = sectorFree + staleCount + allocator->getSectorBlockedCount(sectorIndex);
+        uint32_t liveCount    = pagesCount > deadCount ? pagesCount - deadCount : 0;
+        // The live data has to fit the empty pages of other sectors
+        if (liveCount > freeCount - sectorFree) {
+            continue;
+        }
+
+        // The lowest live pages ratio, more stale pages for the same ratio
+        uint64_t ratio     = static_cast<uint64_t>(liveCount) * bestPages;
+        uint64_t bestRatio = static_cast<uint64_t>(bestLive) * pagesCount;
+        if (found && (ratio > bestRatio || (ratio == bestRatio && staleCount <= bestStale))) {
+            continue;
+        }
+
+        found         = true;
+        bestLive      = liveCount;
+        bestPages     = pagesCount;
+        bestStale     = staleCount;
+        m_sectorIndex = sectorIndex;
+    }
+    if (!found) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    m_selected = true;
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageCompactor::findLivePage(const std::vector<uint32_t>& addresses, uint32_t* address)
+{
+    uint32_t macroblockIndex = AT::MAX_ADDRESS;
+    Header header(addresses.empty() ? 0 : addresses[0]);
+    for (uint32_t pageAddress : addresses) {
+        if (StorageMacroblock::getMacroblockIndex(pageAddress) != macroblockIndex) {
+            header = Header(pageAddress);
+            StorageStatus status = StorageMacroblock::loadHeader(&header);
+            if (status != STORAGE_OK) {
+                return status;
+            }
+            macroblockIndex = header.getMacroblockIndex();
+        }
+
+        if (header.isPageStatus(StorageMacroblock::getPageIndexByAddress(pageAddress), Header::PAGE_OK)) {
+            *address = pageAddress;
+            return STORAGE_OK;
+        }
+    }
+    return STORAGE_NOT_FOUND;
+}
+
+StorageStatus StorageCompactor::dropPage(uint32_t address)
+{
+    Header header(address);
+    StorageStatus status = StorageMacroblock::loadHeader(&header);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    uint32_t pageIndex = StorageMacroblock::getPageIndexByAddress(address);
+    Header::MetaUnit* metaUnitPtr = &(header.data->metaUnits[pageIndex]);
+    memset((*metaUnitPtr).prefix, 0, STORAGE_PAGE_PREFIX_SIZE);
+    (*metaUnitPtr).id = 0;
+    header.setPageStatus(pageIndex, Header::PAGE_STALE);
+
+    // The index may keep the broken data start
+    if (AT::index()) {
+        StorageStateGuard state;
+        AT::index()->invalidate();
+    }
+
+    status = StorageMacroblock::saveHeader(&header, /*writeBack=*/true);
+    if (!storage_at_data_success(status)) {
+        return status;
+    }
+    return STORAGE_OK;
+}
+
+StorageStatus StorageCompactor::eraseSector(const std::vector<uint32_t>& addresses)
+{
+    m_selected = false;
+    if (addresses.empty()) {
+        return STORAGE_OK;
+    }
+
+    StorageStatus status = AT::driverErase(addresses.data(), static_cast<uint32_t>(addresses.size()));
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    uint32_t macroblockIndex = AT::MAX_ADDRESS;
+    bool changed = false;
+    Header header(addresses[0]);
+    for (uint32_t address : addresses) {
+        if (StorageMacroblock::getMacroblockIndex(address) != macroblockIndex) {
+            if (changed) {
+                status = StorageMacroblock::saveHeader(&header, /*writeBack=*/true);
+            }
+            if (!storage_at_data_success(status)) {
+                return status;
+            }
+            header = Header(address);
+            status = StorageMacroblock::loadHeader(&header);
+            if (status != STORAGE_OK) {
+                return status;
+            }
+            macroblockIndex = header.getMacroblockIndex();
+            changed = false;
+        }
+
+        // The blocked page gets one more chance if it was erased
+        uint32_t pageIndex = StorageMacroblock::getPageIndexByAddress(address);
+        if (header.isPageStatus(pageIndex, Header::PAGE_STALE) ||
+            (header.isPageStatus(pageIndex, Header::PAGE_BLOCKED) && isErased(address))
+        ) {
+            header.setPageStatus(pageIndex, Header::PAGE_EMPTY);
+            changed = true;
+        }
+    }
+    if (changed) {
+        status = StorageMacroblock::saveHeader(&header, /*writeBack=*/true);
+    }
+    if (!storage_at_data_success(status)) {
+        return status;
+    }
+    return STORAGE_OK;
+}
+
+StorageStatus StorageCompactor::collect(uint32_t pagesCount)
+{
+    if (!m_selected) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    std::vector<uint32_t> addresses;
+    if (!getSectorPages(m_sectorIndex, &addresses)) {
+        m_selected = false;
+        return STORAGE_OK;
+    }
+
+    uint32_t movedCount  = 0;
+    uint32_t lastAddress = AT::MAX_ADDRESS;
+    do {
+        uint32_t address = 0;
+        StorageStatus status = this->findLivePage(addresses, &address);
+        if (status == STORAGE_NOT_FOUND) {
+            return this->eraseSector(addresses);
+        }
+        if (status != STORAGE_OK) {
+            return status;
+        }
+
+        // The page that stays after the data move is not a part of the data
+        uint32_t count = 0;
+        uint32_t startAddress = address;
+        if (address != lastAddress) {
+            status = StorageData::findStartAddress(&startAddress);
+            status = status == STORAGE_OK || status == STORAGE_BUSY ? status : STORAGE_NOT_FOUND;
+        } else {
+            status = STORAGE_NOT_FOUND;
+        }
+        if (status == STORAGE_OK) {
+            StorageData data(startAddress);
+            status = data.relocate(m_sectorIndex, &count);
+        }
+        if (status == STORAGE_NOT_FOUND) {
+            status = this->dropPage(address);
+        }
+        if (status != STORAGE_OK) {
+            return status;
+        }
+
+        lastAddress = address;
+        movedCount += std::max(count, static_cast<uint32_t>(1));
+    } while (movedCount < pagesCount);
+
+    return STORAGE_OK;
+}
+
+void StorageCompactor::reset()
+{
+    m_selected = false;
+}
@@ -0,0 +1,344 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageContext.h"
+
+#include <stdint.h>
+
+#include "StorageType.h"
+
+
+STORAGE_THREAD_LOCAL StorageContext* StorageContext::m_bound = nullptr;
+STORAGE_THREAD_LOCAL StorageContext::Binding StorageContext::m_binding;
+STORAGE_THREAD_LOCAL StorageContext* StorageAccessGuard::m_owner = nullptr;
+STORAGE_THREAD_LOCAL StorageAccessGuard* StorageAccessGuard::m_current = nullptr;
+
+
+StorageContext::StorageContext(uint32_t pagesCount, IStorageDriver* driver, uint32_t minEraseSize):
+    pagesCount(pagesCount),
+    driver(driver),
+    minEraseSize(minEraseSize),
+    verifyPolicy(STORAGE_VERIFY_FULL),
+    lazyRebuild(false),
+    locking(false),
+    changesCount(0),
+    boundThreadsCount(0)
+#ifndef STORAGE_NO_THREADS
+    , macroblockMutexesCount(0)
+#endif
+{}
+
+void StorageContext::setMacroblockLocks(uint32_t macroblocksCount)
+{
+#ifndef STORAGE_NO_THREADS
+    macroblockMutexes.reset();
+    macroblockMutexesCount = 0;
+    if (macroblocksCount) {
+        macroblockMutexes = std::make_unique<std::shared_mutex[]>(macroblocksCount);
+        macroblockMutexesCount = macroblocksCount;
+    }
+#else
+    (void)macroblocksCount;
+#endif
+}
+
+bool StorageContext::isStateShared()
+{
+#ifndef STORAGE_NO_THREADS
+    return locking || threadPool;
+#else
+    return false;
+#endif
+}
+
+bool StorageContext::isMacroblockLocking()
+{
+#ifndef STORAGE_NO_THREADS
+    return locking && macroblockMutexes;
+#else
+    return false;
+#endif
+}
+
+void StorageContext::bind()
+{
+    if (m_binding.context != this) {
+        if (m_binding.context) {
+            m_binding.context->boundThreadsCount--;
+        }
+        m_binding.context = this;
+        boundThreadsCount++;
+    }
+    m_bound = this;
+}
+
+void StorageContext::unbind()
+{
+    if (m_binding.context == this) {
+        m_binding.context = nullptr;
+        boundThreadsCount--;
+    }
+    if (m_bound == this) {
+        m_bound = nullptr;
+    }
+}
+
+StorageContext::Binding::~Binding()
+{
+    if (context) {
+        context->boundThreadsCount--;
+        context = nullptr;
+    }
+}
+
+StorageContext* StorageContext::current()
+{
+    return m_bound;
+}
+
+StorageContextGuard::StorageContextGuard(StorageContext* context): m_previous(StorageContext::m_bound)
+{
+    StorageContext::m_bound = context;
+}
+
+StorageContextGuard::~StorageContextGuard()
+{
+    StorageContext::m_bound = m_previous;
+}
+
+StorageAccessGuard::StorageAccessGuard(StorageContext* context, bool exclusive):
+    m_context(context), m_previous(m_owner), m_previousGuard(m_current), m_shared(false), m_exclusive(false), m_attached(false)
+{
+#ifndef STORAGE_NO_THREADS
+    if (!m_context->locking || m_owner == m_context) {
+        return;
+    }
+    if (exclusive) {
+        m_context->accessMutex.lock();
+        m_exclusive = true;
+    } else {
+        m_context->accessMutex.lock_shared();
+        m_shared = true;
+    }
+    m_owner   = m_context;
+    m_current = this;
+#else
+    (void)exclusive;
+#endif
+}
+
+StorageAccessGuard::StorageAccessGuard(StorageContext* context, StorageAccessGuard* parent):
+    m_context(context), m_previous(m_owner), m_previousGuard(m_current), m_shared(false), m_exclusive(false), m_attached(true)
+{
+#ifndef STORAGE_NO_THREADS
+    if (!parent || parent->m_context != m_context) {
+        return;
+    }
+    m_exclusive = parent->m_exclusive;
+    m_owner     = m_context;
+    m_current   = this;
+#else
+    (void)parent;
+#endif
+}
+
+StorageAccessGuard::~StorageAccessGuard()
+{
+#ifndef STORAGE_NO_THREADS
+    for (auto it = m_macroblocks.rbegin(); it != m_macroblocks.rend(); ++it) {
+        if (it->exclusive) {
+            m_context->macroblockMutexes[it->index].unlock();
+        } else {
+            m_context->macroblockMutexes[it->index].unlock_shared();
+        }
+    }
+    if (m_exclusive && !m_attached) {
+        m_context->accessMutex.unlock();
+    }
+    if (m_shared) {
+        m_context->accessMutex.unlock_shared();
+    }
+    m_owner   = m_previous;
+    m_current = m_previousGuard;
+#endif
+}
+
+void StorageAccessGuard::exclusive()
+{
+#ifndef STORAGE_NO_THREADS
+    if (!m_shared) {
+        return;
+    }
+    // The macroblock locks are not needed under the exclusive lock
+    while (!m_macroblocks.empty()) {
+        unlockMacroblock(m_macroblocks.back().index);
+    }
+    m_context->accessMutex.unlock_shared();
+    m_shared = false;
+    m_context->accessMutex.lock();
+    m_exclusive = true;
+#endif
+}
+
+StorageAccessGuard::MacroblockLock* StorageAccessGuard::findMacroblock(uint32_t macroblockIndex)
+{
+    for (MacroblockLock& lock : m_macroblocks) {
+        if (lock.index == macroblockIndex) {
+            return &lock;
+        }
+    }
+    return nullptr;
+}
+
+StorageStatus StorageAccessGuard::lockMacroblock(uint32_t macroblockIndex, bool exclusive, bool* acquired)
+{
+    if (acquired) {
+        *acquired = false;
+    }
+#ifndef STORAGE_NO_THREADS
+    StorageAccessGuard* guard = m_current;
+    if (!guard || guard->m_exclusive || !guard->m_context->isMacroblockLocking()) {
+        return STORAGE_OK;
+    }
+    if (macroblockIndex >= guard->m_context->macroblockMutexesCount) {
+        macroblockIndex = guard->m_context->macroblockMutexesCount - 1;
+    }
+
+    MacroblockLock* held = guard->findMacroblock(macroblockIndex);
+    if (held) {
+        return held->exclusive || !exclusive ? STORAGE_OK : STORAGE_BUSY;
+    }
+
+    bool inOrder = true;
+    for (const MacroblockLock& lock : guard->m_macroblocks) {
+        if (lock.index > macroblockIndex) {
+            inOrder = false;
+        }
+    }
+
+    std::shared_mutex& mutex = guard->m_context->macroblockMutexes[macroblockIndex];
+    if (inOrder && exclusive) {
+        mutex.lock();
+    } else if (inOrder) {
+        mutex.lock_shared();
+    } else if (exclusive ? !mutex.try_lock() : !mutex.try_lock_shared()) {
+        return STORAGE_BUSY;
+    }
+
+    guard->m_macroblocks.push_back({ macroblockIndex, exclusive });
+    if (acquired) {
+        *acquired = true;
+    }
+#else
+    (void)macroblockIndex;
+    (void)exclusive;
+#endif
+    return STORAGE_OK;
+}
+
+void StorageAccessGuard::unlockMacroblock(uint32_t macroblockIndex)
+{
+#ifndef STORAGE_NO_THREADS
+    StorageAccessGuard* guard = m_current;
+    if (!guard || !guard->m_context->isMacroblockLocking()) {
+        return;
+    }
+    if (macroblockIndex >= guard->m_context->macroblockMutexesCount) {
+        macroblockIndex = guard->m_context->macroblockMutexesCount - 1;
+    }
+
+    for (auto it = guard->m_macroblocks.begin(); it != guard->m_macroblocks.end(); ++it) {
+        if (it->index != macroblockIndex) {
+            continue;
+        }
+        if (it->exclusive) {
+            guard->m_context->macroblockMutexes[macroblockIndex].unlock();
+        } else {
+            guard->m_context->macroblockMutexes[macroblockIndex].unlock_shared();
+        }
+        guard->m_macroblocks.erase(it);
+        return;
+    }
+#else
+    (void)macroblockIndex;
+#endif
+}
+
+void StorageAccessGuard::unlockMacroblocks()
+{
+#ifndef STORAGE_NO_THREADS
+    StorageAccessGuard* guard = m_current;
+    while (guard && !guard->m_macroblocks.empty()) {
+        unlockMacroblock(guard->m_macroblocks.back().index);
+    }
+#endif
+}
+
+bool StorageAccessGuard::isMacroblockLocking()
+{
+#ifndef STORAGE_NO_THREADS
+    return m_current && !m_current->m_exclusive && m_current->m_context->isMacroblockLocking();
+#else
+    return false;
+#endif
+}
+
+bool StorageAccessGuard::isHoldingMacroblocks()
+{
+#ifndef STORAGE_NO_THREADS
+    return m_current && !m_current->m_macroblocks.empty();
+#else
+    return false;
+#endif
+}
+
+StorageAccessGuard* StorageAccessGuard::current()
+{
+    return m_current;
+}
+
+StorageMacroblockGuard::StorageMacroblockGuard(uint32_t macroblockIndex, bool exclusive):
+    m_index(macroblockIndex), m_acquired(false), m_status(STORAGE_OK)
+{
+    m_status = StorageAccessGuard::lockMacroblock(m_index, exclusive, &m_acquired);
+}
+
+StorageMacroblockGuard::~StorageMacroblockGuard()
+{
+    if (m_acquired) {
+        StorageAccessGuard::unlockMacroblock(m_index);
+    }
+}
+
+StorageStatus StorageMacroblockGuard::exclusive()
+{
+    if (m_acquired) {
+        StorageAccessGuard::unlockMacroblock(m_index);
+    }
+    m_status = StorageAccessGuard::lockMacroblock(m_index, /*exclusive=*/true, &m_acquired);
+    return m_status;
+}
+
+StorageStatus StorageMacroblockGuard::status()
+{
+    return m_status;
+}
+
+StorageStateGuard::StorageStateGuard(): m_context(StorageContext::current())
+{
+#ifndef STORAGE_NO_THREADS
+    if (!m_context || !m_context->isStateShared()) {
+        m_context = nullptr;
+        return;
+    }
+    m_context->stateMutex.lock();
+#endif
+}
+
+StorageStateGuard::~StorageStateGuard()
+{
+#ifndef STORAGE_NO_THREADS
+    if (m_context) {
+        m_context->stateMutex.unlock();
+    }
+#endif
+}
@@ -2,18 +2,206 @@
 
 #include "StorageData.h"
 
+#include <memory>
+#include <vector>
 #include <cstring>
 #include <algorithm>
 
 #include "StorageAT.h"
+#include "StorageLog.h"
 #include "StoragePage.h"
 #include "StorageType.h"
+#include "StorageWear.h"
+#include "StorageIndex.h"
+#include "StorageAllocator.h"
 #include "StorageSearch.h"
+#include "StorageContext.h"
 #include "StorageMacroblock.h"
 
 
 StorageData::StorageData(uint32_t startAddress): m_startAddress(startAddress) {}
 
+uint32_t StorageData::getStartAddress()
+{
+    return m_startAddress;
+}
+
+StorageStatus StorageData::saveBatch(std::vector<Page>* pages, Header* header)
+{
+    if (pages->empty()) {
+        return STORAGE_OK;
+    }
+
+    std::vector<Page*> pagePtrs;
+    pagePtrs.reserve(pages->size());
+    for (Page& page : *pages) {
+        pagePtrs.push_back(&page);
+    }
+
+    std::unique_ptr<StorageStatus[]> statuses = std::make_unique<StorageStatus[]>(pages->size());
+    StorageStatus status = Page::saveBatch(pagePtrs.data(), static_cast<uint32_t>(pagePtrs.size()), statuses.get());
+    if (status != STORAGE_OK) {
+        pages->clear();
+        return status;
+    }
+
+    // The data pages are already linked, so the data can not skip a broken page
+    for (uint32_t i = 0; i < pages->size(); i++) {
+        if (statuses[i] == STORAGE_OK) {
+            continue;
+        }
+        header->setAddressBlocked((*pages)[i].getAddress());
+        status = STORAGE_ERROR;
+    }
+    pages->clear();
+
+    return status;
+}
+
+uint32_t StorageData::getPagesCount(uint32_t len)
+{
+    return len / STORAGE_PAGE_PAYLOAD_SIZE + (len % STORAGE_PAGE_PAYLOAD_SIZE ? 1 : 0);
+}
+
+StorageStatus StorageData::loadExtentPage(Extent* extent, Page* page, bool startPage, uint32_t pagesCount)
+{
+    uint32_t address = page->getAddress();
+    if (address < extent->address || address >= extent->address + extent->count * STORAGE_PAGE_SIZE) {
+        extent->count = 0;
+
+        uint32_t count = std::min(pagesCount, static_cast<uint32_t>(STORAGE_EXTENT_PAGES_COUNT));
+        if (!StorageMacroblock::isMacroblockAddress(address)) {
+            count = std::min(count, Header::PAGES_COUNT - StorageMacroblock::getPageIndexByAddress(address));
+        }
+        // The extent is read by one request only if the driver supports multi-page reads
+        if (count <= 1 ||
+            !StorageAT::driverHasCapability(STORAGE_DRIVER_CAP_READV) ||
+            StorageMacroblock::isMacroblockAddress(address) ||
+            address + count * STORAGE_PAGE_SIZE > StorageAT::getStorageSize()
+        ) {
+            return page->load(startPage);
+        }
+
+        StorageIOVec vec = { address, reinterpret_cast<uint8_t*>(extent->pages), count * STORAGE_PAGE_SIZE };
+        StorageStatus status = StorageAT::driverReadv(&vec, 1);
+        if (status == STORAGE_BUSY) {
+            return status;
+        }
+        if (status != STORAGE_OK) {
+            return page->load(startPage);
+        }
+
+        extent->address = address;
+        extent->count   = count;
+    }
+
+    StorageStatus status = page->parse(&(extent->pages[(address - extent->address) / STORAGE_PAGE_SIZE]), startPage);
+    if (status != STORAGE_OK) {
+        // The page may have been changed after the extent read
+        status = page->load(startPage);
+    }
+    return status;
+}
+
+StorageStatus StorageData::loadExtentNext(Extent* extent, Page* page, uint32_t pagesCount)
+{
+    if (!page->validateNextAddress()) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    Page nextPage(page->page.header.next_addr);
+    StorageStatus status = loadExtentPage(extent, &nextPage, /*startPage=*/false, pagesCount);
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+    if (status != STORAGE_OK) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    if (memcmp(nextPage.page.header.prefix, page->page.header.prefix, sizeof(nextPage.page.header.prefix))) {
+        return STORAGE_NOT_FOUND;
+    }
+    if (nextPage.page.header.id != page->page.header.id) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    *page = nextPage;
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageData::findEmptyAddress(
+    const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t id,
+    uint32_t       startSearchAddress,
+    uint32_t       pagesCount,
+    uint32_t       dataAddress,
+    uint32_t*      address
+) {
+    StorageAllocator* allocator = StorageAT::allocator();
+    if (allocator && !allocator->isBuilt()) {
+        allocator->build();
+    }
+    if (allocator && allocator->isBuilt()) {
+        StorageStateGuard state;
+        StorageStatus status = allocator->findExtent(startSearchAddress, pagesCount, address);
+        if (!StorageAT::wear()) {
+            return status;
+        }
+
+        // The least worn data start may be anywhere, so the search wraps once
+        // and the pages before the data start are the last ones
+        if (status == STORAGE_NOT_FOUND && startSearchAddress > dataAddress) {
+            startSearchAddress = 0;
+            status = allocator->findExtent(startSearchAddress, pagesCount, address);
+        }
+        if (status == STORAGE_OK && startSearchAddress <= dataAddress && *address >= dataAddress) {
+            return STORAGE_NOT_FOUND;
+        }
+        return status;
+    }
+    return StorageSearchEmpty(startSearchAddress).searchPageAddress(prefix, id, address);
+}
+
+StorageStatus StorageData::reserveEmptyAddress(
+    const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t id,
+    uint32_t       startSearchAddress,
+    uint32_t       pagesCount,
+    uint32_t       dataAddress,
+    uint32_t*      address
+) {
+    while (true) {
+        StorageStatus status = findEmptyAddress(prefix, id, startSearchAddress, pagesCount, dataAddress, address);
+        if (status != STORAGE_OK || !StorageAccessGuard::isMacroblockLocking()) {
+            return status;
+        }
+
+        // The macroblock that is locked out of order by another writer is skipped
+        bool acquired = false;
+        uint32_t macroblockIndex = StorageMacroblock::getMacroblockIndex(*address);
+        status = StorageAccessGuard::lockMacroblock(macroblockIndex, /*exclusive=*/true, &acquired);
+        if (status == STORAGE_BUSY) {
+            startSearchAddress = StorageMacroblock::getMacroblockAddress(macroblockIndex + 1);
+            continue;
+        }
+        if (status != STORAGE_OK || !acquired) {
+            return status;
+        }
+
+        // Another writer may have taken the page before the macroblock was locked
+        Header header(*address);
+        status = StorageMacroblock::loadHeader(&header);
+        if (status != STORAGE_OK) {
+            return status;
+        }
+        if (header.isAddressEmpty(*address)) {
+            return STORAGE_OK;
+        }
+        startSearchAddress = *address + STORAGE_PAGE_SIZE;
+    }
+}
+
 StorageStatus StorageData::load(uint8_t* data, uint32_t len)
 {
     Page page(m_startAddress);
@@ -26,7 +214,27 @@ StorageStatus StorageData::load(uint8_t* data, uint32_t len)
         return STORAGE_ERROR;
     }
 
-    StorageStatus status = page.load(/*startPage=*/true);
+    // Contiguous data pages are read by a single driver request
+    std::unique_ptr<Extent> extent;
+    if ((StorageAT::allocator() && StorageAT::allocator()->isContiguous()) ||
+        StorageAT::driverHasCapability(STORAGE_DRIVER_CAP_READV)
+    ) {
+        extent = std::make_unique<Extent>();
+        extent->address = 0;
+        extent->count   = 0;
+    }
+
+    // The data macroblocks stay locked until the end of the load, so the data is not changed while it is read
+    StorageStatus status = StorageAccessGuard::lockMacroblock(StorageMacroblock::getMacroblockIndex(m_startAddress), /*exclusive=*/false);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    if (extent) {
+        status = loadExtentPage(extent.get(), &page, /*startPage=*/true, getPagesCount(len));
+    } else {
+        status = page.load(/*startPage=*/true);
+    }
     if (status != STORAGE_OK) {
         return status;
     }
@@ -34,12 +242,21 @@ StorageStatus StorageData::load(uint8_t* data, uint32_t len)
     bool hasEnd = false;
     uint32_t readLen = 0;
     do {
-        uint32_t neededLen = std::min(static_cast<uint32_t>(len - readLen), static_cast<uint32_t>(sizeof(page.page.payload)));
+        uint32_t neededLen = std::min(static_cast<uint32_t>(len - readLen), page.getPayloadSize());
 
-        memcpy(&data[readLen], page.page.payload, neededLen);
+        memcpy(&data[readLen], page.getPayload(), neededLen);
         readLen += neededLen;
 
-        status = page.loadNext();
+        status = StorageAccessGuard::lockMacroblock(StorageMacroblock::getMacroblockIndex(page.page.header.next_addr), /*exclusive=*/false);
+        if (status != STORAGE_OK) {
+            break;
+        }
+
+        if (extent) {
+            status = loadExtentNext(extent.get(), &page, getPagesCount(len - readLen));
+        } else {
+            status = page.loadNext();
+        }
         if (status != STORAGE_OK) {
             break;
         }
@@ -52,7 +269,9 @@ StorageStatus StorageData::load(uint8_t* data, uint32_t len)
     	return STORAGE_NOT_FOUND;
     }
 
-    if (status == STORAGE_NOT_FOUND) {
+    // Parallel readers do not remove the broken data, it is removed by the next save
+    StorageContext* context = StorageContext::current();
+    if (status == STORAGE_NOT_FOUND && !(context && context->locking)) {
         this->deleteData(page.page.header.prefix, page.page.header.id);
     }
 
@@ -64,6 +283,27 @@ StorageStatus StorageData::save(
     uint32_t id,
     uint8_t* data,
     uint32_t len
+) {
+    std::vector<uint32_t> targets;
+    StorageStatus status = this->prepareSave(prefix, id, len, &targets);
+    // The busy preparation has not written the new data (the read-only macroblock keeps the old data)
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+    if (status == STORAGE_OK) {
+        status = this->writePages(prefix, id, data, len, /*log=*/false, &targets);
+    }
+    if (status != STORAGE_OK && status != STORAGE_DATA_EXISTS) {
+        this->deleteData(prefix, id);
+    }
+    return status;
+}
+
+StorageStatus StorageData::prepareSave(
+    uint8_t                prefix[STORAGE_PAGE_PREFIX_SIZE],
+    uint32_t               id,
+    uint32_t               len,
+    std::vector<uint32_t>* targets
 ) {
     uint32_t pageAddress = m_startAddress;
 
@@ -86,11 +326,7 @@ StorageStatus StorageData::save(
         status = StorageData::findStartAddress(&checkAddress); // TODO: tests
     }
 
-    status = this->rewrite(prefix, id, data, len);
-    if (status != STORAGE_OK) {
-        this->deleteData(prefix, id);
-    }
-    return status;
+    return this->prepareRewrite(prefix, id, len, /*checkEmpty=*/true, targets);
 }
 
 StorageStatus StorageData::rewrite(
@@ -98,6 +334,31 @@ StorageStatus StorageData::rewrite(
     uint32_t id,
     uint8_t* data,
     uint32_t len
+) {
+    return this->rewrite(prefix, id, data, len, /*checkEmpty=*/false);
+}
+
+StorageStatus StorageData::rewrite(
+    uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+    uint32_t id,
+    uint8_t* data,
+    uint32_t len,
+    bool     checkEmpty
+) {
+    std::vector<uint32_t> targets;
+    StorageStatus status = this->prepareRewrite(prefix, id, len, checkEmpty, &targets);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+    return this->writePages(prefix, id, data, len, /*log=*/false, &targets);
+}
+
+StorageStatus StorageData::prepareRewrite(
+    uint8_t                prefix[STORAGE_PAGE_PREFIX_SIZE],
+    uint32_t               id,
+    uint32_t               len,
+    bool                   checkEmpty,
+    std::vector<uint32_t>* targets
 ) {
     uint32_t pageAddress = m_startAddress;
 
@@ -105,88 +366,412 @@ StorageStatus StorageData::rewrite(
         return STORAGE_ERROR;
     }
 
-    StorageStatus status = deleteData(prefix, id);
+    // The old data macroblocks and the start macroblock stay locked until the end
+    // of the call, they are locked before any change
+    std::vector<uint32_t> macroblocks;
+    bool targeted = false;
+    StorageStatus status = findDataMacroblocks(prefix, id, StorageAccessGuard::isMacroblockLocking(), &macroblocks, &targeted);
     if (status != STORAGE_OK) {
-    	return status;
+        return status;
+    }
+    uint32_t macroblockIndex = StorageMacroblock::getMacroblockIndex(pageAddress);
+    std::vector<uint32_t> locks(macroblocks);
+    locks.insert(std::lower_bound(locks.begin(), locks.end(), macroblockIndex), macroblockIndex);
+    lockMacroblocks(locks);
+
+    // The macroblock is read-only until the header rebuild (the old data is kept)
+    if (StorageMacroblock::isRebuildQueued(macroblockIndex)) {
+        return STORAGE_BUSY;
     }
-    m_startAddress = pageAddress;
 
+    // Another writer may have saved the data to the address after the save check
     Header header(pageAddress);
     status = StorageMacroblock::loadHeader(&header);
     if (status == STORAGE_BUSY || status == STORAGE_OOM) {
         return status;
     }
+    if (checkEmpty && status == STORAGE_OK && !header.isAddressEmpty(pageAddress) &&
+        !header.isSameMeta(StorageMacroblock::getPageIndexByAddress(pageAddress), prefix, id)
+    ) {
+        return STORAGE_DATA_EXISTS;
+    }
 
-	/* Erase target addresses BEGIN */
-    {
-		uint32_t eraseAddrs[STORAGE_DEFAULT_MIN_ERASE_SIZE / STORAGE_PAGE_SIZE] = {};
-		unsigned eraseCnt       = 0;
-		uint32_t eraseLen       = 0;
-        uint32_t eraseTargetLen = STORAGE_PAGE_SIZE * (
-                                      len / STORAGE_PAGE_PAYLOAD_SIZE +
-                                      (len % STORAGE_PAGE_PAYLOAD_SIZE ? 1 : 0)
-                                  );
-		uint32_t eraseAddr      = pageAddress;
-		eraseAddrs[eraseCnt++]  = pageAddress;
-		while (eraseLen < eraseTargetLen) {
-			uint32_t eraseNextAddr = 0;
-
-			status = StorageSearchEmpty(
-				eraseAddr + STORAGE_PAGE_SIZE
-			).searchPageAddress(prefix, id, &eraseNextAddr);
-            if (eraseLen + STORAGE_PAGE_SIZE < eraseTargetLen &&
-                status != STORAGE_OK
-            ) {
-				return status;
-			}
-
-			uint32_t minEraseSize        = StorageAT::getMinEraseSize();
-			uint32_t eraseSectorAddr     = (eraseAddr / minEraseSize) * minEraseSize;
-			uint32_t eraseNextSectorAddr = (eraseNextAddr / minEraseSize) * minEraseSize;
-
-			status = STORAGE_OK;
-			if (eraseLen + STORAGE_PAGE_SIZE >= eraseTargetLen ||
-				eraseSectorAddr != eraseNextSectorAddr
-			) {
-				status = StorageAT::driverCallback()->erase(eraseAddrs, eraseCnt);
-
-				memset(
-					(uint8_t*)eraseAddrs,
-					0,
-					StorageAT::getMinEraseSize() / STORAGE_PAGE_SIZE * sizeof(eraseAddrs[0])
-				);
-
-				if (status == STORAGE_BUSY) {
-					return status;
-				}
-				if (status != STORAGE_OK) {
-					break;
-				}
-
-				eraseCnt = 0;
-			}
-
-			eraseAddr = eraseNextAddr;
-			eraseLen += STORAGE_PAGE_SIZE;
-			if (eraseLen < eraseTargetLen) {
-				eraseAddrs[eraseCnt++] = eraseNextAddr;
-			}
-		}
+    status = deleteMacroblocksData(macroblocks, targeted, prefix, id, /*stale=*/false);
+    if (status != STORAGE_OK) {
+    	return status;
+    }
+    m_startAddress = pageAddress;
 
-		if (eraseCnt) {
-			status = StorageAT::driverCallback()->erase(eraseAddrs, eraseCnt);
-		}
-		if (status != STORAGE_OK) {
-			return status;
-		}
+    // All the data pages are planned before the write, so every erase sector is erased once
+    targets->assign(1, pageAddress);
+    status = planPages(prefix, id, getPagesCount(len), /*skipSector=*/StorageAT::MAX_ADDRESS, targets);
+    if (status != STORAGE_OK) {
+        return status;
     }
-	/* Erase target addresses END */
+    return eraseTargets(*targets);
+}
+
+StorageStatus StorageData::writePlannedPage(
+    const uint8_t                prefix[STORAGE_PAGE_PREFIX_SIZE],
+    uint32_t                     id,
+    const uint8_t*               data,
+    uint32_t                     len,
+    const std::vector<uint32_t>& targets,
+    uint32_t                     targetIndex
+) {
+    uint32_t curAddr = targets[targetIndex];
+    uint32_t curLen  = targetIndex * STORAGE_PAGE_PAYLOAD_SIZE;
+
+    // The start page refers to itself as the previous page and the end page as the next one
+    Page page(curAddr);
+    page.setPrevAddress(targets[targetIndex ? targetIndex - 1 : targetIndex]);
+    page.setNextAddress(targets[targetIndex + 1 < targets.size() ? targetIndex + 1 : targetIndex]);
+
+    memcpy(page.page.header.prefix, prefix, STORAGE_PAGE_PREFIX_SIZE);
+    page.page.header.id = id;
+    memcpy(page.page.payload, data + curLen, std::min(len - curLen, static_cast<uint32_t>(sizeof(page.page.payload))));
+
+    // The planned pages are erased
+    return page.saveEmpty();
+}
+
+StorageStatus StorageData::append(
+    uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+    uint32_t id,
+    uint8_t* data,
+    uint32_t len
+) {
+    StorageLog* log = StorageAT::log();
+    if (!log || !len) {
+        return STORAGE_ERROR;
+    }
+
+    // The previous version pages become stale
+    StorageStatus status = deleteData(prefix, id, /*stale=*/true);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    status = log->reserve(log->getHead(), /*dataAddress=*/StorageAT::MAX_ADDRESS, &m_startAddress);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    status = this->writePages(prefix, id, data, len, /*log=*/true, /*targets=*/nullptr);
+    if (status != STORAGE_OK) {
+        this->deleteData(prefix, id, /*stale=*/true);
+    }
+    return status;
+}
+
+StorageStatus StorageData::relocate(uint32_t sectorIndex, uint32_t* pagesCount)
+{
+    *pagesCount = 0;
+
+    // The whole data is read before the move (the old format pages may have other payload size)
+    Page page(m_startAddress);
+    StorageStatus status = page.load(/*startPage=*/true);
+    std::vector<uint32_t> addresses;
+    std::vector<uint8_t> data;
+    while (status == STORAGE_OK) {
+        addresses.push_back(page.getAddress());
+        data.insert(data.end(), page.getPayload(), page.getPayload() + page.getPayloadSize());
+        if (page.isEnd()) {
+            break;
+        }
+        if (addresses.size() >= StorageAT::getPayloadPagesCount()) {
+            status = STORAGE_NOT_FOUND;
+            break;
+        }
+        status = page.loadNext();
+    }
+    if (status != STORAGE_OK) {
+        return status == STORAGE_BUSY ? status : STORAGE_NOT_FOUND;
+    }
+
+    uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE] = {};
+    uint32_t id = page.page.header.id;
+    memcpy(prefix, page.page.header.prefix, STORAGE_PAGE_PREFIX_SIZE);
+
+    // The new pages are taken out of the erase sector (the data is kept if there is no place)
+    uint32_t count = getPagesCount(static_cast<uint32_t>(data.size()));
+    std::vector<uint32_t> targets;
+    status = planPages(prefix, id, count, sectorIndex, &targets);
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+    if (status != STORAGE_OK) {
+        return STORAGE_OOM;
+    }
+    status = eraseTargets(targets);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    std::vector<Page> pages;
+    std::vector<Page*> pagePtrs;
+    pages.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        pages.emplace_back(targets[i]);
+        Page& newPage = pages.back();
+        uint32_t offset = i * STORAGE_PAGE_PAYLOAD_SIZE;
+        memcpy(newPage.page.header.prefix, prefix, STORAGE_PAGE_PREFIX_SIZE);
+        newPage.page.header.id = id;
+        memcpy(newPage.page.payload, data.data() + offset, std::min(static_cast<uint32_t>(data.size()) - offset, static_cast<uint32_t>(STORAGE_PAGE_PAYLOAD_SIZE)));
+        newPage.setPrevAddress(i ? targets[i - 1] : targets[i]);
+        newPage.setNextAddress(i + 1 < count ? targets[i + 1] : targets[i]);
+        pagePtrs.push_back(&newPage);
+    }
+
+    std::unique_ptr<StorageStatus[]> statuses = std::make_unique<StorageStatus[]>(count);
+    status = Page::saveBatch(pagePtrs.data(), count, statuses.get());
+    if (status != STORAGE_OK) {
+        return status;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (statuses[i] == STORAGE_OK) {
+            continue;
+        }
+        // The not saved page is blocked, the saved ones stay empty
+        std::vector<uint32_t> blocked = { targets[i] };
+        setPagesStatus(blocked, prefix, id, Header::PAGE_BLOCKED);
+        return STORAGE_ERROR;
+    }
+
+    // The new pages are registrated before the old ones are removed, so the data is not lost.
+    // The old pages are empty: every writer erases the empty pages before the write
+    status = setPagesStatus(targets, prefix, id, Header::PAGE_OK);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+    status = setPagesStatus(addresses, prefix, id, Header::PAGE_EMPTY);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    if (StorageAT::index()) {
+        StorageStateGuard state;
+        StorageAT::index()->insert(prefix, id, targets[0]);
+    }
+    m_startAddress = targets[0];
+    *pagesCount    = count;
+
+    return STORAGE_OK;
+}
+
+void StorageData::releaseLogPage(uint32_t address)
+{
+    if (StorageAT::log()) {
+        StorageStateGuard state;
+        StorageAT::log()->release(address);
+    }
+}
+
+StorageStatus StorageData::setPagesStatus(
+    std::vector<uint32_t>    addresses,
+    const uint8_t            prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t           id,
+    const Header::PageStatus pageStatus
+) {
+    if (addresses.empty()) {
+        return STORAGE_OK;
+    }
+    std::sort(addresses.begin(), addresses.end());
+
+    Header header(addresses[0]);
+    StorageStatus status = StorageMacroblock::loadHeader(&header);
+    for (uint32_t i = 0; i < addresses.size(); i++) {
+        if (StorageMacroblock::getMacroblockIndex(addresses[i]) != header.getMacroblockIndex()) {
+            status = StorageMacroblock::saveHeader(&header, /*writeBack=*/true);
+            if (!storage_at_data_success(status)) {
+                return status;
+            }
+            header = Header(addresses[i]);
+            status = StorageMacroblock::loadHeader(&header);
+        }
+        if (status != STORAGE_OK) {
+            return status;
+        }
+
+        // Only the pages of the data are removed
+        uint32_t pageIndex = StorageMacroblock::getPageIndexByAddress(addresses[i]);
+        Header::MetaUnit* metaUnitPtr = &(header.data->metaUnits[pageIndex]);
+        if (pageStatus == Header::PAGE_OK) {
+            memcpy((*metaUnitPtr).prefix, prefix, STORAGE_PAGE_PREFIX_SIZE);
+            (*metaUnitPtr).id = id;
+        } else if (pageStatus != Header::PAGE_BLOCKED) {
+            if (!header.isPageStatus(pageIndex, Header::PAGE_OK) || !header.isSameMeta(pageIndex, prefix, id)) {
+                continue;
+            }
+            memset((*metaUnitPtr).prefix, 0, STORAGE_PAGE_PREFIX_SIZE);
+            (*metaUnitPtr).id = 0;
+        }
+        if (pageStatus == Header::PAGE_EMPTY) {
+            releaseLogPage(addresses[i]);
+        }
+        header.setPageStatus(pageIndex, pageStatus);
+    }
+
+    status = StorageMacroblock::saveHeader(&header, /*writeBack=*/true);
+    if (!storage_at_data_success(status)) {
+        return status;
+    }
+    return STORAGE_OK;
+}
+
+StorageStatus StorageData::planPages(
+    const uint8_t          prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t         id,
+    uint32_t               pagesCount,
+    uint32_t               skipSector,
+    std::vector<uint32_t>* targets
+) {
+    uint32_t searchAddress = targets->empty() ? 0 : targets->back() + STORAGE_PAGE_SIZE;
+    while (targets->size() < pagesCount) {
+        uint32_t address = 0;
+        StorageStatus status = reserveEmptyAddress(
+            prefix,
+            id,
+            /*startSearchAddress=*/searchAddress,
+            /*pagesCount=*/pagesCount - static_cast<uint32_t>(targets->size()),
+            /*dataAddress=*/targets->empty() ? StorageAT::MAX_ADDRESS : targets->front(),
+            &address
+        );
+        if (status != STORAGE_OK) {
+            return status;
+        }
+
+        searchAddress = address + STORAGE_PAGE_SIZE;
+        if (StorageWear::getSectorIndex(address) == skipSector) {
+            searchAddress = (skipSector + 1) * StorageWear::getSectorSize();
+            continue;
+        }
+        targets->push_back(address);
+    }
+    return STORAGE_OK;
+}
+
+StorageStatus StorageData::getSectorErase(
+    uint32_t               sectorAddress,
+    std::vector<uint32_t>* addresses,
+    std::vector<Header>*   headers
+) {
+    headers->clear();
+
+    // Other writers may write the empty pages of the sector in the macroblock locking mode
+    uint32_t sectorSize = StorageWear::getSectorSize();
+    if (!StorageAT::driverHasCapability(STORAGE_DRIVER_CAP_SECTOR_ERASE) ||
+        StorageAccessGuard::isMacroblockLocking() ||
+        sectorAddress + sectorSize > StorageAT::getStorageSize()
+    ) {
+        return STORAGE_OK;
+    }
+
+    // The sector of the aligned macroblock group has the group headers and the unused group tail pages
+    bool aligned = StorageMacroblock::getGroupPagesCount() * STORAGE_PAGE_SIZE == sectorSize;
+
+    std::vector<uint32_t> sectorPages;
+    std::vector<Header> sectorHeaders;
+    for (uint32_t address = sectorAddress; address < sectorAddress + sectorSize; address += STORAGE_PAGE_SIZE) {
+        sectorPages.push_back(address);
+        if (StorageMacroblock::isMacroblockAddress(address)) {
+            if (!aligned) {
+                return STORAGE_OK;
+            }
+            continue;
+        }
+
+        uint32_t macroblockIndex = StorageMacroblock::getMacroblockIndex(address);
+        if (sectorHeaders.empty() || sectorHeaders.back().getMacroblockIndex() != macroblockIndex) {
+            Header header(address);
+            StorageStatus status = StorageMacroblock::loadHeader(&header);
+            if (status == STORAGE_BUSY || status == STORAGE_OOM) {
+                return status;
+            }
+            if (status != STORAGE_OK || StorageMacroblock::isRebuildQueued(macroblockIndex)) {
+                return STORAGE_OK;
+            }
+            sectorHeaders.push_back(header);
+        }
+        if (std::binary_search(addresses->begin(), addresses->end(), address)) {
+            continue;
+        }
+        if (!sectorHeaders.back().isAddressEmpty(address)) {
+            return STORAGE_OK;
+        }
+    }
+
+    *addresses = sectorPages;
+    if (aligned) {
+        *headers = sectorHeaders;
+    }
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageData::eraseTargets(const std::vector<uint32_t>& targets)
+{
+    std::vector<uint32_t> addresses(targets);
+    std::sort(addresses.begin(), addresses.end());
+
+    uint32_t sectorSize = StorageWear::getSectorSize();
+    std::vector<uint32_t> sectorAddresses;
+    std::vector<Header> headers;
+    for (auto it = addresses.begin(); it != addresses.end();) {
+        uint32_t sectorAddress = *it / sectorSize * sectorSize;
+        auto sectorEnd = std::lower_bound(it, addresses.end(), sectorAddress + sectorSize);
+        sectorAddresses.assign(it, sectorEnd);
+        it = sectorEnd;
+
+        // The sector without other data is erased as a whole
+        StorageStatus status = getSectorErase(sectorAddress, &sectorAddresses, &headers);
+        if (status != STORAGE_OK) {
+            return status;
+        }
+
+        status = StorageAT::driverErase(sectorAddresses.data(), static_cast<uint32_t>(sectorAddresses.size()));
+        if (status != STORAGE_OK) {
+            return status;
+        }
+
+        // The erased group headers are restored
+        for (Header& header : headers) {
+            status = StorageMacroblock::saveHeader(&header);
+            if (!storage_at_data_success(status)) {
+                return status;
+            }
+        }
+    }
+    return STORAGE_OK;
+}
+
+StorageStatus StorageData::writePages(
+    uint8_t                      prefix[STORAGE_PAGE_PREFIX_SIZE],
+    uint32_t                     id,
+    uint8_t*                     data,
+    uint32_t                     len,
+    bool                         log,
+    const std::vector<uint32_t>* targets
+) {
+    uint32_t pageAddress = m_startAddress;
+    StorageStatus status = STORAGE_OK;
+    Header header(pageAddress);
 
     uint32_t curLen = 0;
     uint32_t curAddr = pageAddress;
     uint32_t prevAddr = pageAddress;
+    uint32_t dataStartAddr = pageAddress;
     uint32_t macroblockAddress = STORAGE_PAGE_SIZE + 1;
+    uint32_t targetIndex = 0;
     bool headerLoaded = false;
+
+    // The data pages are written by vectored requests if the driver supports it
+    std::unique_ptr<std::vector<Page>> batch;
+    if (StorageAT::driverHasCapability(STORAGE_DRIVER_CAP_WRITEV)) {
+        batch = std::make_unique<std::vector<Page>>();
+        batch->reserve(STORAGE_EXTENT_PAGES_COUNT);
+    }
+
     while (curLen < len) {
         if (curAddr - 1 + STORAGE_PAGE_SIZE > StorageAT::getStorageSize()) {
             return STORAGE_OOM;
@@ -198,9 +783,24 @@ StorageStatus StorageData::rewrite(
         bool isStart = curLen == 0;
         bool isEnd   = curLen + neededLen >= len;
 
-        // Search
+        // Search (the log write head does not hand out a page after the end page,
+        // the pages after the planned ones are searched for the blocked pages)
         uint32_t nextAddr = 0;
-        status = StorageSearchEmpty(/*startSearchAddress=*/curAddr + STORAGE_PAGE_SIZE).searchPageAddress(prefix, id, &nextAddr);
+        if (targets && ++targetIndex < targets->size()) {
+            nextAddr = (*targets)[targetIndex];
+            status = STORAGE_OK;
+        } else if (log) {
+            status = isEnd ? STORAGE_NOT_FOUND : StorageAT::log()->reserve(curAddr + STORAGE_PAGE_SIZE, pageAddress, &nextAddr);
+        } else {
+            status = reserveEmptyAddress(
+                prefix,
+                id,
+                /*startSearchAddress=*/curAddr + STORAGE_PAGE_SIZE,
+                /*pagesCount=*/getPagesCount(len - curLen - neededLen),
+                /*dataAddress=*/pageAddress,
+                &nextAddr
+            );
+        }
         if (status != STORAGE_OK) {
             nextAddr = curAddr + STORAGE_PAGE_SIZE;
         }
@@ -222,8 +822,14 @@ StorageStatus StorageData::rewrite(
 
         // Check header (and save)
         uint32_t curMacroblockAddress = Header::getMacroblockStartAddress(curAddr);
+        if (headerLoaded && macroblockAddress != curMacroblockAddress && batch) {
+            status = saveBatch(batch.get(), &header);
+        }
+        if (status != STORAGE_OK) {
+            break;
+        }
         if (headerLoaded && macroblockAddress != curMacroblockAddress) {
-            status = header.save();
+            status = StorageMacroblock::saveHeader(&header, /*writeBack=*/true);
         }
         if (status == STORAGE_BUSY) {
             break;
@@ -245,6 +851,12 @@ StorageStatus StorageData::rewrite(
             memcpy(page.page.header.prefix, prefix, STORAGE_PAGE_PREFIX_SIZE);
             page.page.header.id = id;
             memcpy(page.page.payload, data + curLen, neededLen);
+        }
+        if (status == STORAGE_OK && batch) {
+            batch->push_back(page);
+        } else if (status == STORAGE_OK && header.isAddressEmpty(curAddr)) {
+            status = page.saveEmpty();
+        } else if (status == STORAGE_OK) {
             status = page.save();
         }
         if (status == STORAGE_BUSY) {
@@ -264,82 +876,209 @@ StorageStatus StorageData::rewrite(
         memcpy((*metaUnitPtr).prefix, prefix, STORAGE_PAGE_PREFIX_SIZE);
         (*metaUnitPtr).id = id;
         header.setPageStatus(pageIndex, Header::PAGE_OK);
+        if (isStart) {
+            dataStartAddr = curAddr;
+        }
 
 
         // Update current values
         prevAddr = curAddr;
         curAddr  = nextAddr;
         curLen  += neededLen;
+
+        if (batch && batch->size() >= STORAGE_EXTENT_PAGES_COUNT) {
+            status = saveBatch(batch.get(), &header);
+        }
+        if (status != STORAGE_OK) {
+            break;
+        }
     }
 
+    if (status == STORAGE_OK && batch) {
+        status = saveBatch(batch.get(), &header);
+    }
     if (status != STORAGE_OK) {
         return status;
     }
 
-    status = header.save();
-    if (storage_at_data_success(status)) {
-        return STORAGE_OK;
+    status = StorageMacroblock::saveHeader(&header, /*writeBack=*/true);
+    if (!storage_at_data_success(status)) {
+        return status;
     }
-    return status;
+
+    if (StorageAT::index()) {
+        StorageStateGuard state;
+        StorageAT::index()->insert(prefix, id, dataStartAddr);
+    }
+    return STORAGE_OK;
+}
+
+
+StorageStatus StorageData::deleteData(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE], const uint32_t index, bool stale)
+{
+    std::vector<uint32_t> macroblocks;
+    bool targeted = false;
+    StorageStatus status = findDataMacroblocks(prefix, index, /*scan=*/false, &macroblocks, &targeted);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+    return deleteMacroblocksData(macroblocks, targeted, prefix, index, stale);
 }
 
+StorageStatus StorageData::findDataMacroblocks(
+    const uint8_t          prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t         index,
+    bool                   scan,
+    std::vector<uint32_t>* macroblocks,
+    bool*                  targeted
+) {
+    // The built index knows the macroblocks with the data pages, other headers are not loaded
+    macroblocks->clear();
+    *targeted = false;
+    if (StorageAT::index()) {
+        StorageStateGuard state;
+        *targeted = StorageAT::index()->isBuilt();
+        if (*targeted) {
+            StorageAT::index()->getMacroblocks(prefix, index, macroblocks);
+            std::sort(macroblocks->begin(), macroblocks->end());
+            return STORAGE_OK;
+        }
+    }
+
+    for (uint32_t macroblockIndex = 0; macroblockIndex < StorageMacroblock::getMacroblocksCount(); macroblockIndex++) {
+        if (!scan) {
+            macroblocks->push_back(macroblockIndex);
+            continue;
+        }
+
+        // The broken header pages are removed by the page meta
+        Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+        StorageStatus status = StorageMacroblock::loadHeader(&header);
+        if (status == STORAGE_BUSY || status == STORAGE_OOM) {
+            return status;
+        }
+        bool found = status != STORAGE_OK;
+        for (uint32_t pageIndex = 0; !found && pageIndex < Header::PAGES_COUNT; pageIndex++) {
+            found = header.isSameMeta(pageIndex, prefix, index);
+        }
+        if (found) {
+            macroblocks->push_back(macroblockIndex);
+        }
+    }
+    return STORAGE_OK;
+}
 
-StorageStatus StorageData::deleteData(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE], const uint32_t index)
+void StorageData::lockMacroblocks(const std::vector<uint32_t>& macroblocks)
 {
+    for (uint32_t macroblockIndex : macroblocks) {
+        if (StorageAccessGuard::lockMacroblock(macroblockIndex, /*exclusive=*/true) == STORAGE_OK) {
+            continue;
+        }
+        // Nothing is held after the release, so the locks are taken in order
+        StorageAccessGuard::unlockMacroblocks();
+        for (uint32_t lockIndex : macroblocks) {
+            StorageAccessGuard::lockMacroblock(lockIndex, /*exclusive=*/true);
+        }
+        return;
+    }
+}
+
+StorageStatus StorageData::deleteMacroblocksData(
+    const std::vector<uint32_t>& macroblocks,
+    bool                         targeted,
+    const uint8_t                prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t               index,
+    bool                         stale
+) {
     StorageStatus resStatus = STORAGE_OK;
-	for (uint32_t macroblockIndex = 0; macroblockIndex < StorageMacroblock::getMacroblocksCount(); macroblockIndex++) {
-	    StorageStatus status = STORAGE_OK;
-		Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+    for (uint32_t macroblockIndex : macroblocks) {
+        StorageStatus status = StorageData::deleteMacroblockData(macroblockIndex, prefix, index, stale);
+        if (status == STORAGE_BUSY || status == STORAGE_OOM) {
+            resStatus = status;
+            break;
+        }
+        if (!storage_at_data_success(status)) {
+            resStatus = status;
+        }
+    }
 
+    if (StorageAT::index()) {
+        StorageStateGuard state;
+        StorageAT::index()->remove(prefix, index);
+        // The not removed pages have to be found by the index build again
+        if (targeted && !storage_at_data_success(resStatus)) {
+            StorageAT::index()->invalidate();
+        }
+    }
+
+    if (storage_at_data_success(resStatus)) {
+        return STORAGE_OK;
+    }
+    return resStatus;
+}
+
+StorageStatus StorageData::deleteMacroblockData(
+    const uint32_t macroblockIndex,
+    const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t index,
+    bool           stale
+) {
+	Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+
+	StorageMacroblockGuard lock(macroblockIndex, /*exclusive=*/true);
+	StorageStatus status = lock.status();
+	if (status == STORAGE_OK) {
 		status = StorageMacroblock::loadHeader(&header);
-		if (status == STORAGE_BUSY || status == STORAGE_OOM) {
-			resStatus = status;
-			break;
-		}
+	}
+	if (status == STORAGE_BUSY || status == STORAGE_OOM) {
+		return status;
+	}
 
-	    Header::MetaUnit *metUnitPtr = header.data->metaUnits;
-		for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++, metUnitPtr++) {
-			if (memcmp((*metUnitPtr).prefix, prefix, STORAGE_PAGE_PREFIX_SIZE) ||
-				(*metUnitPtr).id != index
-			) {
-				continue;
-			}
-
-	        Header::MetaUnit* metaUnitPtr = &(header.data->metaUnits[pageIndex]);
-	        memset((*metaUnitPtr).prefix, 0, STORAGE_PAGE_PREFIX_SIZE);
-	        (*metaUnitPtr).id = 0;
-	        header.setPageStatus(pageIndex, Header::PAGE_EMPTY);
+	// The header is not saved again if it has no data pages
+	bool changed = status != STORAGE_OK;
+	Header::MetaUnit *metUnitPtr = header.data->metaUnits;
+	for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++, metUnitPtr++) {
+		if (memcmp((*metUnitPtr).prefix, prefix, STORAGE_PAGE_PREFIX_SIZE) ||
+			(*metUnitPtr).id != index
+		) {
+			continue;
 		}
 
-		status = header.save();
-		if (status != STORAGE_OK) {
-			unsigned count = 0;
-			uint32_t addresess[Header::PAGES_COUNT] = {};
-            for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++, metUnitPtr++) {
-                Page page(StorageMacroblock::getPageAddressByIndex(macroblockIndex, pageIndex));
-                if (page.load() != STORAGE_OK) {
-                    continue;
-                }
-                if (memcmp(page.page.header.prefix, prefix, STORAGE_PAGE_PREFIX_SIZE) ||
-                    page.page.header.id != index
-                ) {
-                    continue;
-                }
-                addresess[count++] = page.getAddress();
-            }
-            if (!count) {
-                continue;
-            }
-			status = StorageAT::driverCallback()->erase(addresess, count);
-			if (!storage_at_data_success(status)) {
-				resStatus = status;
-			}
-		}
+        memset((*metUnitPtr).prefix, 0, STORAGE_PAGE_PREFIX_SIZE);
+        (*metUnitPtr).id = 0;
+        header.setPageStatus(pageIndex, stale ? Header::PAGE_STALE : Header::PAGE_EMPTY);
+        if (!stale) {
+            releaseLogPage(StorageMacroblock::getPageAddressByIndex(macroblockIndex, pageIndex));
+        }
+        changed = true;
 	}
-    if (storage_at_data_success(resStatus)) {
+	if (!changed) {
+		return STORAGE_OK;
+	}
+
+	status = StorageMacroblock::saveHeader(&header);
+	if (status == STORAGE_OK) {
+		return status;
+	}
+
+	unsigned count = 0;
+	uint32_t addresess[Header::PAGES_COUNT] = {};
+    for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++) {
+        Page page(StorageMacroblock::getPageAddressByIndex(macroblockIndex, pageIndex));
+        if (page.loadMeta() != STORAGE_OK) {
+            continue;
+        }
+        if (memcmp(page.page.header.prefix, prefix, STORAGE_PAGE_PREFIX_SIZE) ||
+            page.page.header.id != index
+        ) {
+            continue;
+        }
+        addresess[count++] = page.getAddress();
+    }
+    if (!count) {
         return STORAGE_OK;
     }
-    return resStatus;
+	return StorageAT::driverErase(addresess, count);
 }
 
 StorageStatus StorageData::clearAddress(const uint32_t address)
@@ -360,7 +1099,7 @@ StorageStatus StorageData::clearAddress(const uint32_t address)
 
 	uint32_t curAddress = m_startAddress;
 	Page page(curAddress);
-	status = page.load();
+	status = page.loadMeta();
 	if (status != STORAGE_OK) {
 		return status;
 	}
@@ -371,13 +1110,13 @@ StorageStatus StorageData::clearAddress(const uint32_t address)
 StorageStatus StorageData::findStartAddress(uint32_t* address)
 {
     Page page(*address);
-    StorageStatus status = page.load();
+    StorageStatus status = page.loadMeta();
     if (status != STORAGE_OK) {
         return status;
     }
 
     while (!page.isStart()) {
-        status = page.loadPrev();
+        status = page.loadPrev(/*metaOnly=*/true);
         if (status != STORAGE_OK) {
             break;
         }
@@ -387,7 +1126,7 @@ StorageStatus StorageData::findStartAddress(uint32_t* address)
         return status;
     }
 
-    status = page.load(/*startPage=*/true);
+    status = page.loadMeta(/*startPage=*/true);
     if (status != STORAGE_OK) {
         return status;
     }
@@ -404,13 +1143,13 @@ StorageStatus StorageData::findStartAddress(uint32_t* address)
 StorageStatus StorageData::findEndAddress(uint32_t* address)
 {
     Page page(*address);
-    StorageStatus status = page.load();
+    StorageStatus status = page.loadMeta();
     if (status != STORAGE_OK) {
         return status;
     }
 
     while (!page.isEnd()) {
-        status = page.loadNext();
+        status = page.loadNext(/*metaOnly=*/true);
         if (status != STORAGE_OK) {
             break;
         }
@@ -420,7 +1159,7 @@ StorageStatus StorageData::findEndAddress(uint32_t* address)
         return status;
     }
 
-    status = page.load(/*startPage=*/true);
+    status = page.loadMeta(/*startPage=*/true);
     if (status != STORAGE_OK) {
         return status;
     }
@@ -0,0 +1,122 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageHeaderCache.h"
+
+#include <stdint.h>
+
+#include "StoragePage.h"
+#include "StorageType.h"
+
+
+StorageHeaderCache::StorageHeaderCache(uint32_t capacity): m_capacity(capacity), m_useCounter(0)
+{
+    m_entries.reserve(capacity);
+}
+
+StorageHeaderCache::CacheEntry* StorageHeaderCache::findEntry(uint32_t macroblockIndex)
+{
+    for (CacheEntry& entry : m_entries) {
+        if (entry.header.getMacroblockIndex() == macroblockIndex) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool StorageHeaderCache::get(Header* header)
+{
+    CacheEntry* entry = this->findEntry(header->getMacroblockIndex());
+    if (!entry) {
+        return false;
+    }
+
+    entry->lastUse = ++m_useCounter;
+    *header = entry->header;
+
+    return true;
+}
+
+StorageStatus StorageHeaderCache::put(Header* header, bool dirty)
+{
+    if (!m_capacity) {
+        return dirty ? header->save() : STORAGE_OK;
+    }
+
+    CacheEntry* entry = this->findEntry(header->getMacroblockIndex());
+    if (entry) {
+        entry->header  = *header;
+        entry->dirty   = entry->dirty || dirty;
+        entry->lastUse = ++m_useCounter;
+        return STORAGE_OK;
+    }
+
+    if (m_entries.size() < m_capacity) {
+        m_entries.push_back({ *header, dirty, ++m_useCounter });
+        return STORAGE_OK;
+    }
+
+    CacheEntry* victim = &m_entries[0];
+    for (CacheEntry& tmpEntry : m_entries) {
+        if (tmpEntry.lastUse < victim->lastUse) {
+            victim = &tmpEntry;
+        }
+    }
+
+    if (victim->dirty) {
+        StorageStatus status = victim->header.save();
+        if (!storage_at_data_success(status)) {
+            return status;
+        }
+    }
+
+    victim->header  = *header;
+    victim->dirty   = dirty;
+    victim->lastUse = ++m_useCounter;
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageHeaderCache::flush()
+{
+    StorageStatus resStatus = STORAGE_OK;
+    for (CacheEntry& entry : m_entries) {
+        if (!entry.dirty) {
+            continue;
+        }
+
+        StorageStatus status = entry.header.save();
+        if (status == STORAGE_BUSY) {
+            return STORAGE_BUSY;
+        }
+        if (!storage_at_data_success(status)) {
+            resStatus = status;
+            continue;
+        }
+
+        entry.dirty = false;
+    }
+    return resStatus;
+}
+
+void StorageHeaderCache::remove(uint32_t macroblockIndex)
+{
+    CacheEntry* entry = this->findEntry(macroblockIndex);
+    if (entry) {
+        m_entries.erase(m_entries.begin() + (entry - m_entries.data()));
+    }
+}
+
+void StorageHeaderCache::invalidate()
+{
+    m_entries.clear();
+}
+
+bool StorageHeaderCache::isDirty()
+{
+    for (CacheEntry& entry : m_entries) {
+        if (entry.dirty) {
+            return true;
+        }
+    }
+    return false;
+}
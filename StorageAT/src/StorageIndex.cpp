@@ -0,0 +1,230 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageIndex.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "StorageAT.h"
+#include "StoragePage.h"
+#include "StorageType.h"
+#include "StorageCheckpoint.h"
+#include "StorageMacroblock.h"
+
+
+StorageIndex::StorageIndex(): m_built(false) {}
+
+uint64_t StorageIndex::getKey(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE], uint32_t id)
+{
+    uint64_t key = 0;
+    for (unsigned i = 0; i < STORAGE_PAGE_PREFIX_SIZE; i++) {
+        key = (key << 8) | prefix[i];
+    }
+    return (key << 32) | id;
+}
+
+uint32_t StorageIndex::getPrefixKey(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE])
+{
+    return static_cast<uint32_t>(getKey(prefix, 0) >> 32);
+}
+
+bool StorageIndex::findId(
+    StorageFindMode              mode,
+    const std::vector<uint32_t>& ids,
+    const uint32_t               id,
+    uint32_t*                    result
+) {
+    if (ids.empty()) {
+        return false;
+    }
+
+    // The bounds are the same as the linear search start compare ids
+    switch (mode) {
+    case FIND_MODE_NEXT:
+    {
+        auto it = std::upper_bound(ids.begin(), ids.end(), id);
+        if (it == ids.end() || *it == StorageAT::MAX_ADDRESS) {
+            return false;
+        }
+        *result = *it;
+        return true;
+    }
+    case FIND_MODE_MIN:
+        if (ids.front() == StorageAT::MAX_ADDRESS) {
+            return false;
+        }
+        *result = ids.front();
+        return true;
+    case FIND_MODE_MAX:
+        if (ids.back() == 0) {
+            return false;
+        }
+        *result = ids.back();
+        return true;
+    default:
+        return false;
+    }
+}
+
+StorageStatus StorageIndex::build()
+{
+    this->invalidate();
+
+    StorageCheckpoint* checkpoint = StorageAT::checkpoint();
+    for (uint32_t macroblockIndex = 0; macroblockIndex < StorageMacroblock::getMacroblocksCount(); macroblockIndex++) {
+        Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+
+        StorageStatus status = StorageMacroblock::loadHeader(&header);
+        if (status == STORAGE_BUSY || status == STORAGE_OOM) {
+            this->invalidate();
+            return status;
+        }
+
+        Header::MetaUnit* metaUnitPtr = header.data->metaUnits;
+        for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++, metaUnitPtr++) {
+            if (!header.isPageStatus(pageIndex, Header::PAGE_OK)) {
+                continue;
+            }
+
+            uint64_t key = getKey((*metaUnitPtr).prefix, (*metaUnitPtr).id);
+            std::vector<uint32_t>& macroblocks = m_macroblocks[key];
+            if (macroblocks.empty() || macroblocks.back() != macroblockIndex) {
+                macroblocks.push_back(macroblockIndex);
+            }
+
+            if (m_addresses.find(key) != m_addresses.end()) {
+                continue;
+            }
+
+            // The checkpoint keeps the data start pages, so the pages are not loaded
+            bool start = false;
+            if (checkpoint && checkpoint->isStartPage(macroblockIndex, pageIndex, &start)) {
+                if (start) {
+                    this->insert((*metaUnitPtr).prefix, (*metaUnitPtr).id, StorageMacroblock::getPageAddressByIndex(macroblockIndex, pageIndex));
+                }
+                continue;
+            }
+
+            // Only the data start page is registrated, as the linear search does
+            Page page(StorageMacroblock::getPageAddressByIndex(macroblockIndex, pageIndex));
+            status = page.loadMeta(/*startPage=*/true);
+            if (status == STORAGE_BUSY) {
+                this->invalidate();
+                return status;
+            }
+            if (status != STORAGE_OK) {
+                continue;
+            }
+
+            this->insert((*metaUnitPtr).prefix, (*metaUnitPtr).id, page.getAddress());
+        }
+    }
+
+    m_built = true;
+
+    return STORAGE_OK;
+}
+
+void StorageIndex::invalidate()
+{
+    m_built = false;
+    m_addresses.clear();
+    m_ids.clear();
+    m_macroblocks.clear();
+}
+
+bool StorageIndex::isBuilt()
+{
+    return m_built;
+}
+
+StorageStatus StorageIndex::find(
+    StorageFindMode mode,
+    const uint8_t   prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t  id,
+    uint32_t*       address
+) {
+    uint32_t foundId = id;
+    if (mode != FIND_MODE_EQUAL) {
+        auto ids = m_ids.find(getPrefixKey(prefix));
+        if (ids == m_ids.end() || !findId(mode, ids->second, id, &foundId)) {
+            return STORAGE_NOT_FOUND;
+        }
+    }
+
+    auto it = m_addresses.find(getKey(prefix, foundId));
+    if (it == m_addresses.end()) {
+        return STORAGE_NOT_FOUND;
+    }
+    *address = it->second;
+    return STORAGE_OK;
+}
+
+void StorageIndex::insert(
+    const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t id,
+    const uint32_t address
+) {
+    auto res = m_addresses.insert({ getKey(prefix, id), address });
+    if (!res.second) {
+        res.first->second = address;
+        return;
+    }
+
+    std::vector<uint32_t>& ids = m_ids[getPrefixKey(prefix)];
+    ids.insert(std::upper_bound(ids.begin(), ids.end(), id), id);
+}
+
+void StorageIndex::remove(const uint8_t prefix[STORAGE_PAGE_PREFIX_SIZE], const uint32_t id)
+{
+    m_macroblocks.erase(getKey(prefix, id));
+    if (!m_addresses.erase(getKey(prefix, id))) {
+        return;
+    }
+
+    auto ids = m_ids.find(getPrefixKey(prefix));
+    if (ids == m_ids.end()) {
+        return;
+    }
+    auto it = std::lower_bound(ids->second.begin(), ids->second.end(), id);
+    if (it != ids->second.end() && *it == id) {
+        ids->second.erase(it);
+    }
+    if (ids->second.empty()) {
+        m_ids.erase(ids);
+    }
+}
+
+void StorageIndex::update(Header* header)
+{
+    if (!m_built) {
+        return;
+    }
+
+    uint32_t macroblockIndex = header->getMacroblockIndex();
+    Header::MetaUnit* metaUnitPtr = header->data->metaUnits;
+    for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++, metaUnitPtr++) {
+        if (!header->isPageStatus(pageIndex, Header::PAGE_OK)) {
+            continue;
+        }
+
+        std::vector<uint32_t>& macroblocks = m_macroblocks[getKey((*metaUnitPtr).prefix, (*metaUnitPtr).id)];
+        auto it = std::lower_bound(macroblocks.begin(), macroblocks.end(), macroblockIndex);
+        if (it == macroblocks.end() || *it != macroblockIndex) {
+            macroblocks.insert(it, macroblockIndex);
+        }
+    }
+}
+
+void StorageIndex::getMacroblocks(
+    const uint8_t          prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t         id,
+    std::vector<uint32_t>* macroblocks
+) {
+    macroblocks->clear();
+    auto it = m_macroblocks.find(getKey(prefix, id));
+    if (it != m_macroblocks.end()) {
+        *macroblocks = it->second;
+    }
+}
@@ -0,0 +1,293 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageJournal.h"
+
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+#include "StorageAT.h"
+#include "StorageType.h"
+
+
+StorageJournal::StorageJournal(IStorageDriver* driver):
+    m_driver(driver), m_position(0), m_busy(false), m_pending(false), m_pendingStale(false), m_pendingRequest()
+{}
+
+void StorageJournal::setDriver(IStorageDriver* driver)
+{
+    m_driver  = driver;
+    m_pending = false;
+    this->clear();
+}
+
+IStorageDriver* StorageJournal::getDriver()
+{
+    return m_driver;
+}
+
+void StorageJournal::rewind()
+{
+    m_position = 0;
+    m_busy     = false;
+}
+
+bool StorageJournal::isBusy()
+{
+    return m_busy;
+}
+
+void StorageJournal::clear()
+{
+    m_requests.clear();
+    m_data.clear();
+    m_position     = 0;
+    m_pendingStale = m_pending;
+}
+
+bool StorageJournal::isRead(RequestType type)
+{
+    return type == REQUEST_READ || type == REQUEST_READV;
+}
+
+bool StorageJournal::isSame(const Request& recorded, const Request& request, const uint8_t* data, const uint8_t* reqData)
+{
+    if (recorded.type != request.type ||
+        recorded.address != request.address ||
+        recorded.len != request.len ||
+        recorded.count != request.count
+    ) {
+        return false;
+    }
+    if (recorded.type == REQUEST_READV) {
+        return !memcmp(data, reqData, request.count * sizeof(Range));
+    }
+    return isRead(recorded.type) || !request.len || !memcmp(data, reqData, request.len);
+}
+
+void StorageJournal::record(const Request& request, const uint8_t* data)
+{
+    Request recorded = request;
+    recorded.offset  = static_cast<uint32_t>(m_data.size());
+    m_data.insert(m_data.end(), data, data + request.len);
+    m_requests.push_back(recorded);
+    m_position = static_cast<uint32_t>(m_requests.size());
+}
+
+StorageStatus StorageJournal::execute(Request request, uint8_t* data)
+{
+    // Not every caller passes STORAGE_BUSY up, so the rest of the step must not reach the driver
+    if (m_busy) {
+        return STORAGE_BUSY;
+    }
+
+    StorageStatus status = this->executeRequest(request, data);
+    if (status == STORAGE_BUSY) {
+        m_busy = true;
+    }
+    return status;
+}
+
+StorageStatus StorageJournal::executeRequest(Request request, uint8_t* data)
+{
+    // Replay: skipped reads are allowed because cached headers may be not read again
+    uint32_t position = m_position;
+    for (; position < m_requests.size(); position++) {
+        const Request& recorded = m_requests[position];
+        if (isSame(recorded, request, m_data.data() + recorded.offset, data)) {
+            break;
+        }
+        if (!isRead(recorded.type)) {
+            position = static_cast<uint32_t>(m_requests.size());
+        }
+    }
+    if (position < m_requests.size()) {
+        const Request& recorded = m_requests[position];
+        if (isRead(recorded.type)) {
+            memcpy(data, m_data.data() + recorded.offset, recorded.len);
+        }
+        m_position = position + 1;
+        return recorded.status;
+    }
+
+    // The step diverged from the journal, the rest of the journal is dropped
+    if (m_position < m_requests.size()) {
+        m_data.resize(m_requests[m_position].offset);
+        m_requests.resize(m_position);
+    }
+
+    // The finished request is recorded even if the step has already moved on
+    // (the step has ignored STORAGE_BUSY), the next replay requests it again
+    if (m_pending) {
+        StorageStatus status = m_driver->poll();
+        if (status == STORAGE_BUSY) {
+            return status;
+        }
+
+        m_pending = false;
+        m_pendingRequest.status = status;
+
+        // The request of the cleared journal is dropped, the step requests it again
+        if (!m_pendingStale) {
+            this->record(m_pendingRequest, m_pendingData.data());
+            if (isSame(m_pendingRequest, request, m_pendingData.data(), data)) {
+                if (isRead(request.type)) {
+                    memcpy(data, m_pendingData.data(), request.len);
+                }
+                return status;
+            }
+        }
+        m_pendingStale = false;
+    }
+
+    if (!(m_driver->capabilities() & STORAGE_DRIVER_CAP_ASYNC)) {
+        StorageStatus status = STORAGE_ERROR;
+        switch (request.type) {
+        case REQUEST_READ:
+            status = m_driver->read(request.address, data, request.len);
+            break;
+        case REQUEST_WRITE:
+            status = m_driver->write(request.address, data, request.len);
+            break;
+        case REQUEST_ERASE:
+            status = m_driver->erase(reinterpret_cast<uint32_t*>(data), request.len / sizeof(uint32_t));
+            break;
+        case REQUEST_READV:
+        case REQUEST_WRITEV:
+        {
+            std::vector<StorageIOVec> vec(request.count);
+            uint32_t offset = request.count * sizeof(Range);
+            for (uint32_t i = 0; i < request.count; i++) {
+                Range range = {};
+                memcpy(&range, data + i * sizeof(Range), sizeof(range));
+                vec[i] = { range.address, data + offset, range.len };
+                offset += range.len;
+            }
+            if (request.type == REQUEST_READV) {
+                status = m_driver->readv(vec.data(), request.count);
+            } else {
+                status = m_driver->writev(vec.data(), request.count);
+            }
+            break;
+        }
+        case REQUEST_ERASE_SECTOR:
+            status = m_driver->eraseSector(request.address);
+            break;
+        default:
+            break;
+        }
+        if (status != STORAGE_BUSY) {
+            request.status = status;
+            this->record(request, data);
+        }
+        return status;
+    }
+
+    // The request data is kept in the journal until the driver completes it
+    m_pendingRequest = request;
+    m_pendingData.assign(data, data + request.len);
+
+    StorageStatus status = STORAGE_ERROR;
+    switch (request.type) {
+    case REQUEST_READ:
+        status = m_driver->submitRead(request.address, m_pendingData.data(), request.len);
+        break;
+    case REQUEST_WRITE:
+        status = m_driver->submitWrite(request.address, m_pendingData.data(), request.len);
+        break;
+    case REQUEST_ERASE:
+        status = m_driver->submitErase(reinterpret_cast<uint32_t*>(m_pendingData.data()), request.len / sizeof(uint32_t));
+        break;
+    default:
+        break;
+    }
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    m_pending = true;
+
+    return STORAGE_BUSY;
+}
+
+StorageStatus StorageJournal::read(const uint32_t address, uint8_t* data, const uint32_t len)
+{
+    return this->execute({ REQUEST_READ, address, len, 0, 0, STORAGE_OK }, data);
+}
+
+StorageStatus StorageJournal::write(const uint32_t address, const uint8_t* data, const uint32_t len)
+{
+    return this->execute({ REQUEST_WRITE, address, len, 0, 0, STORAGE_OK }, const_cast<uint8_t*>(data));
+}
+
+StorageStatus StorageJournal::erase(const uint32_t* addresses, const uint32_t count)
+{
+    if (!addresses || !count) {
+        return STORAGE_ERROR;
+    }
+    return this->execute(
+        { REQUEST_ERASE, addresses[0], static_cast<uint32_t>(count * sizeof(uint32_t)), 0, 0, STORAGE_OK },
+        reinterpret_cast<uint8_t*>(const_cast<uint32_t*>(addresses))
+    );
+}
+
+StorageStatus StorageJournal::executeVectored(RequestType type, const StorageIOVec* vec, const uint32_t count)
+{
+    if (!vec || !count) {
+        return STORAGE_ERROR;
+    }
+
+    // The whole vectored request is one journal request, so the driver gets it as one request too
+    uint32_t len = count * sizeof(Range);
+    for (uint32_t i = 0; i < count; i++) {
+        len += vec[i].len;
+    }
+    std::vector<uint8_t> buffer(len);
+    uint32_t offset = count * sizeof(Range);
+    for (uint32_t i = 0; i < count; i++) {
+        Range range = { vec[i].address, vec[i].len };
+        memcpy(&buffer[i * sizeof(Range)], &range, sizeof(range));
+        if (type == REQUEST_WRITEV) {
+            memcpy(&buffer[offset], vec[i].data, vec[i].len);
+        }
+        offset += vec[i].len;
+    }
+
+    StorageStatus status = this->execute({ type, vec[0].address, len, count, 0, STORAGE_OK }, buffer.data());
+    if (type == REQUEST_READV && status == STORAGE_OK) {
+        offset = count * sizeof(Range);
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(vec[i].data, &buffer[offset], vec[i].len);
+            offset += vec[i].len;
+        }
+    }
+    return status;
+}
+
+StorageStatus StorageJournal::readv(const StorageIOVec* vec, const uint32_t count)
+{
+    return this->executeVectored(REQUEST_READV, vec, count);
+}
+
+StorageStatus StorageJournal::writev(const StorageIOVec* vec, const uint32_t count)
+{
+    return this->executeVectored(REQUEST_WRITEV, vec, count);
+}
+
+StorageStatus StorageJournal::eraseSector(const uint32_t address)
+{
+    return this->execute({ REQUEST_ERASE_SECTOR, address, 0, 0, 0, STORAGE_OK }, nullptr);
+}
+
+uint32_t StorageJournal::capabilities()
+{
+    if (!m_driver) {
+        return STORAGE_DRIVER_CAP_NONE;
+    }
+
+    uint32_t capabilities = m_driver->capabilities() & ~(STORAGE_DRIVER_CAP_ASYNC | STORAGE_DRIVER_CAP_PARALLEL);
+    if (m_driver->capabilities() & STORAGE_DRIVER_CAP_ASYNC) {
+        capabilities &= ~(STORAGE_DRIVER_CAP_READV | STORAGE_DRIVER_CAP_WRITEV | STORAGE_DRIVER_CAP_SECTOR_ERASE);
+    }
+    return capabilities;
+}
@@ -0,0 +1,171 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageLog.h"
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#include "StorageAT.h"
+#include "StoragePage.h"
+#include "StorageType.h"
+#include "StorageWear.h"
+#include "StorageAllocator.h"
+#include "StorageMacroblock.h"
+
+
+typedef StorageAT AT;
+
+
+StorageLog::StorageLog(): m_head(0), m_sectorIndex(0), m_opened(false) {}
+
+StorageStatus StorageLog::findSectorFree(uint32_t sectorIndex, uint32_t startAddress, uint32_t* address)
+{
+    uint32_t sectorAddress = sectorIndex * StorageWear::getSectorSize();
+    StorageStatus status = AT::allocator()->findFree(std::max(startAddress, sectorAddress), address);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+    if (StorageWear::getSectorIndex(*address) != sectorIndex) {
+        return STORAGE_NOT_FOUND;
+    }
+    return STORAGE_OK;
+}
+
+StorageStatus StorageLog::openSector(uint32_t sectorIndex)
+{
+    uint32_t sectorAddress = sectorIndex * StorageWear::getSectorSize();
+    uint32_t sectorEnd     = std::min(sectorAddress + StorageWear::getSectorSize(), AT::getStorageSize());
+
+    // The headers of the sector macroblocks (the read-only macroblocks are skipped)
+    std::vector<Header> headers;
+    for (uint32_t address = sectorAddress; address < sectorEnd; address += STORAGE_PAGE_SIZE) {
+        uint32_t macroblockIndex = StorageMacroblock::getMacroblockIndex(address);
+        if (macroblockIndex >= StorageMacroblock::getMacroblocksCount() ||
+            StorageMacroblock::isRebuildQueued(macroblockIndex) ||
+            (!headers.empty() && headers.back().getMacroblockIndex() == macroblockIndex)
+        ) {
+            continue;
+        }
+
+        Header header(address);
+        StorageStatus status = StorageMacroblock::loadHeader(&header);
+        if (status == STORAGE_BUSY || status == STORAGE_OOM) {
+            return status;
+        }
+        if (status == STORAGE_OK) {
+            headers.push_back(header);
+        }
+    }
+
+    std::vector<uint32_t> addresses;
+    for (Header& header : headers) {
+        for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++) {
+            uint32_t address = StorageMacroblock::getPageAddressByIndex(header.getMacroblockIndex(), pageIndex);
+            if (address < sectorAddress || address >= sectorEnd) {
+                continue;
+            }
+            if (header.isPageStatus(pageIndex, Header::PAGE_EMPTY) ||
+                header.isPageStatus(pageIndex, Header::PAGE_STALE)
+            ) {
+                addresses.push_back(address);
+            }
+        }
+    }
+    if (addresses.empty()) {
+        return STORAGE_OK;
+    }
+
+    StorageStatus status = AT::driverErase(addresses.data(), static_cast<uint32_t>(addresses.size()));
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    // The stale pages are empty after the erase
+    for (Header& header : headers) {
+        bool changed = false;
+        for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++) {
+            uint32_t address = StorageMacroblock::getPageAddressByIndex(header.getMacroblockIndex(), pageIndex);
+            if (address < sectorAddress || address >= sectorEnd || !header.isPageStatus(pageIndex, Header::PAGE_STALE)) {
+                continue;
+            }
+            header.setPageStatus(pageIndex, Header::PAGE_EMPTY);
+            changed = true;
+        }
+        if (!changed) {
+            continue;
+        }
+
+        status = StorageMacroblock::saveHeader(&header, /*writeBack=*/true);
+        if (!storage_at_data_success(status)) {
+            return status;
+        }
+    }
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageLog::reserve(uint32_t startSearchAddress, uint32_t dataAddress, uint32_t* address)
+{
+    uint32_t sectorsCount = StorageWear::getSectorsCount();
+    uint32_t sectorIndex  = StorageWear::getSectorIndex(startSearchAddress);
+    if (!sectorsCount) {
+        return STORAGE_OOM;
+    }
+
+    // The open sector pages are handed out in the address order
+    uint32_t firstIndex = sectorIndex % sectorsCount;
+    if (m_opened && sectorIndex == m_sectorIndex) {
+        if (this->findSectorFree(m_sectorIndex, startSearchAddress, address) == STORAGE_OK) {
+            m_head = *address + STORAGE_PAGE_SIZE;
+            return STORAGE_OK;
+        }
+        firstIndex = (m_sectorIndex + 1) % sectorsCount;
+    }
+
+    // The pages handed out to the data are not in the bitmap yet, so the search
+    // ends at the data start sector
+    uint32_t dataIndex = dataAddress == AT::MAX_ADDRESS ? sectorsCount : StorageWear::getSectorIndex(dataAddress);
+    StorageAllocator* allocator = AT::allocator();
+    for (uint32_t i = 0; i < sectorsCount; i++) {
+        uint32_t index = (firstIndex + i) % sectorsCount;
+        if (index == dataIndex) {
+            break;
+        }
+        if (!allocator->getSectorFreeCount(index) && !allocator->getSectorStaleCount(index)) {
+            continue;
+        }
+
+        m_opened = false;
+        StorageStatus status = this->openSector(index);
+        if (status != STORAGE_OK) {
+            return status;
+        }
+        m_sectorIndex = index;
+        m_opened      = true;
+
+        if (this->findSectorFree(index, /*startAddress=*/0, address) == STORAGE_OK) {
+            m_head = *address + STORAGE_PAGE_SIZE;
+            return STORAGE_OK;
+        }
+    }
+
+    return STORAGE_OOM;
+}
+
+void StorageLog::reset()
+{
+    m_opened = false;
+}
+
+void StorageLog::release(uint32_t address)
+{
+    if (m_opened && StorageWear::getSectorIndex(address) == m_sectorIndex && address >= m_head) {
+        m_opened = false;
+    }
+}
+
+uint32_t StorageLog::getHead()
+{
+    return m_head;
+}
@@ -2,6 +2,9 @@
 
 #include "StorageMacroblock.h"
 
+#include <memory>
+#include <vector>
+#include <algorithm>
 #include <string.h>
 #include <stdint.h>
 
@@ -9,24 +12,41 @@
 #include "StoragePage.h"
 #include "StorageType.h"
 #include "StorageSearch.h"
+#include "StorageAllocator.h"
+#include "StorageContext.h"
+#include "StorageCheckpoint.h"
+#include "StorageHeaderCache.h"
 
 
 typedef StorageAT AT;
 
 
+uint32_t StorageMacroblock::getGroupPagesCount()
+{
+    return std::max(AT::getMinEraseSize() / STORAGE_PAGE_SIZE, static_cast<uint32_t>(PAGES_COUNT));
+}
+
 uint32_t StorageMacroblock::getMacroblockAddress(uint32_t macroblockIndex)
 {
-    return macroblockIndex * STORAGE_PAGE_SIZE * StorageMacroblock::PAGES_COUNT;
+    uint32_t groupPagesCount = getGroupPagesCount();
+    uint32_t groupCount      = groupPagesCount / PAGES_COUNT;
+    return ((macroblockIndex / groupCount) * groupPagesCount + (macroblockIndex % groupCount) * PAGES_COUNT) * STORAGE_PAGE_SIZE;
 }
 
 uint32_t StorageMacroblock::getMacroblockIndex(uint32_t macroblockAddress)
 {
-    return macroblockAddress / STORAGE_PAGE_SIZE / StorageMacroblock::PAGES_COUNT;
+    uint32_t groupPagesCount = getGroupPagesCount();
+    uint32_t groupCount      = groupPagesCount / PAGES_COUNT;
+    uint32_t pageIndex       = macroblockAddress / STORAGE_PAGE_SIZE;
+    return (pageIndex / groupPagesCount) * groupCount + std::min((pageIndex % groupPagesCount) / PAGES_COUNT, groupCount);
 }
 
 uint32_t StorageMacroblock::getMacroblocksCount()
 {
-    return AT::getStoragePagesCount() / PAGES_COUNT;
+    uint32_t groupPagesCount = getGroupPagesCount();
+    uint32_t groupCount      = groupPagesCount / PAGES_COUNT;
+    uint32_t pagesCount      = AT::getStoragePagesCount();
+    return (pagesCount / groupPagesCount) * groupCount + std::min((pagesCount % groupPagesCount) / PAGES_COUNT, groupCount);
 }
 
 uint32_t StorageMacroblock::getPageAddressByIndex(uint32_t macroblockIndex, uint32_t pageIndex)
@@ -39,12 +59,15 @@ uint32_t StorageMacroblock::getPageIndexByAddress(uint32_t address)
     if (StorageMacroblock::isMacroblockAddress(address)) {
         return 0;
     }
-    return ((address / STORAGE_PAGE_SIZE) % (PAGES_COUNT)) - RESERVED_PAGES_COUNT;
+    return ((address / STORAGE_PAGE_SIZE) % getGroupPagesCount() % PAGES_COUNT) - RESERVED_PAGES_COUNT;
 }
 
 bool StorageMacroblock::isMacroblockAddress(uint32_t address)
 {
-    return ((address / STORAGE_PAGE_SIZE) % (PAGES_COUNT)) < RESERVED_PAGES_COUNT;
+    uint32_t groupPagesCount = getGroupPagesCount();
+    uint32_t pageIndex       = (address / STORAGE_PAGE_SIZE) % groupPagesCount;
+    return pageIndex % PAGES_COUNT < RESERVED_PAGES_COUNT ||
+           pageIndex >= groupPagesCount / PAGES_COUNT * PAGES_COUNT;
 }
 
 StorageStatus StorageMacroblock::formatMacroblock(uint32_t macroblockIndex)
@@ -55,22 +78,78 @@ StorageStatus StorageMacroblock::formatMacroblock(uint32_t macroblockIndex)
         return status;
     }
 
-    Header::MetaUnit* metaUnitPtr = header.data->metaUnits;
+    StorageMacroblock::cancelRebuild(&header);
+    StorageMacroblock::clearHeader(&header);
+
+    return StorageMacroblock::completeFormat(macroblockIndex, StorageMacroblock::saveHeader(&header));
+}
+
+StorageStatus StorageMacroblock::formatMacroblocks(uint32_t macroblockIndex, uint32_t count)
+{
+    std::vector<Header> headers;
+    headers.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex + i));
+        StorageStatus status = StorageMacroblock::loadHeader(&header);
+        if (status == STORAGE_BUSY) {
+            return status;
+        }
+        if (!storage_at_data_success(status)) {
+            continue;
+        }
+
+        StorageMacroblock::cancelRebuild(&header);
+        StorageMacroblock::clearHeader(&header);
+        headers.push_back(header);
+    }
+
+    std::vector<Header*> headerPtrs;
+    headerPtrs.reserve(headers.size());
+    for (Header& header : headers) {
+        headerPtrs.push_back(&header);
+    }
+
+    std::unique_ptr<StorageStatus[]> statuses = std::make_unique<StorageStatus[]>(headers.size());
+    StorageStatus status = StorageMacroblock::saveHeaders(headerPtrs.data(), static_cast<uint32_t>(headerPtrs.size()), statuses.get());
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    StorageStatus resStatus = STORAGE_OK;
+    for (uint32_t i = 0; i < headers.size(); i++) {
+        status = StorageMacroblock::completeFormat(headers[i].getMacroblockIndex(), statuses[i]);
+        if (status == STORAGE_BUSY) {
+            return status;
+        }
+        if (status != STORAGE_OK) {
+            resStatus = status;
+        }
+    }
+
+    return resStatus;
+}
+
+void StorageMacroblock::clearHeader(Header* header)
+{
+    Header::MetaUnit* metaUnitPtr = header->data->metaUnits;
     for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++, metaUnitPtr++) {
         memset((*metaUnitPtr).prefix, 0, STORAGE_PAGE_PREFIX_SIZE);
         (*metaUnitPtr).id = 0;
-        if (!header.isPageStatus(pageIndex, Header::PAGE_BLOCKED)) {
-            header.setPageStatus(pageIndex, Header::PAGE_EMPTY);
+        if (!header->isPageStatus(pageIndex, Header::PAGE_BLOCKED)) {
+            header->setPageStatus(pageIndex, Header::PAGE_EMPTY);
         }
     }
-    status = header.save();
+}
+
+StorageStatus StorageMacroblock::completeFormat(uint32_t macroblockIndex, StorageStatus status)
+{
     if (status == STORAGE_HEADER_ERROR) {
 		unsigned count = 0;
 		uint32_t addresess[Header::PAGES_COUNT] = {};
         for (uint32_t i = 0; i < Header::PAGES_COUNT; i++) {
             addresess[count++] = StorageMacroblock::getPageAddressByIndex(macroblockIndex, i);
         }
-		status = StorageAT::driverCallback()->erase(addresess, count);
+		status = StorageAT::driverErase(addresess, count);
 		if (storage_at_data_success(status)) {
 			status = STORAGE_OK;
 		}
@@ -87,13 +166,281 @@ StorageStatus StorageMacroblock::loadHeader(Header* header)
         return STORAGE_OOM;
     }
 
+    StorageHeaderCache* cache = AT::headerCache();
+    if (cache) {
+        StorageStateGuard state;
+        if (cache->get(header)) {
+            return STORAGE_OK;
+        }
+    }
+
+    // The checkpoint headers are not cached, the cache keeps only the headers read from memory
+    StorageCheckpoint* checkpoint = AT::checkpoint();
+    if (checkpoint) {
+        StorageStateGuard state;
+        if (checkpoint->get(header)) {
+            if (AT::allocator()) {
+                AT::allocator()->update(header);
+            }
+            if (AT::index()) {
+                AT::index()->update(header);
+            }
+            return STORAGE_OK;
+        }
+    }
+
+    StorageMacroblockGuard lock(header->getMacroblockIndex(), /*exclusive=*/false);
+    if (lock.status() != STORAGE_OK) {
+        return lock.status();
+    }
+
     StorageStatus status = header->load();
     if (status == STORAGE_BUSY || status == STORAGE_OOM) {
         return status;
     }
-    if (status == STORAGE_OK) {
+    StorageContext* context = StorageContext::current();
+    if (status != STORAGE_OK && context && context->lazyRebuild) {
+        // The data chains are validated later by rebuildHeaders, the macroblock is read-only until then
+        uint32_t dataPagesCount = 0;
+        status = header->scan(&dataPagesCount);
+        if (status == STORAGE_OK && dataPagesCount) {
+            StorageMacroblock::setReadOnly(header);
+        }
+        // The header without data pages has nothing to validate and is saved at once
+        if (status == STORAGE_OK && !dataPagesCount) {
+            status = lock.exclusive();
+        }
+        if (status == STORAGE_OK && !dataPagesCount) {
+            status = StorageMacroblock::rebuildHeader(header, /*scanned=*/true);
+        }
+    } else if (status != STORAGE_OK) {
+        // The rebuilt header is saved
+        status = lock.exclusive();
+        if (status == STORAGE_OK) {
+            status = StorageMacroblock::rebuildHeader(header, /*scanned=*/false);
+        }
+    }
+
+    // Parallel find and load requests share the headers cache and the free pages bitmap
+    StorageStateGuard state;
+    if (status == STORAGE_OK && AT::allocator()) {
+        AT::allocator()->update(header);
+    }
+    if (status == STORAGE_OK && AT::index()) {
+        AT::index()->update(header);
+    }
+    if (status == STORAGE_OK && cache) {
+        status = cache->put(header, /*dirty=*/false);
+    }
+
+    return status;
+}
+
+StorageStatus StorageMacroblock::saveHeader(Header* header, bool writeBack)
+{
+    // The read-only header is changed only in RAM, so the callers erase the removed data pages
+    if (StorageMacroblock::isRebuildQueued(header->getMacroblockIndex())) {
+        StorageMacroblock::setReadOnly(header);
+
+        StorageStateGuard state;
+        if (AT::allocator()) {
+            AT::allocator()->update(header);
+        }
+        StorageHeaderCache* cache = AT::headerCache();
+        if (cache && cache->put(header, /*dirty=*/false) == STORAGE_BUSY) {
+            return STORAGE_BUSY;
+        }
+        return STORAGE_HEADER_ERROR;
+    }
+
+    // The headers are written through under the macroblock lock, so the cache has no changes of other writers
+    StorageHeaderCache* cache = AT::headerCache();
+    if (cache && writeBack && !StorageAccessGuard::isMacroblockLocking()) {
+        StorageStateGuard state;
+        if (AT::allocator()) {
+            AT::allocator()->update(header);
+        }
+        if (AT::index()) {
+            AT::index()->update(header);
+        }
+        return cache->put(header, /*dirty=*/true);
+    }
+
+    return StorageMacroblock::updateSavedHeader(header, header->save());
+}
+
+StorageStatus StorageMacroblock::saveHeaders(Header* const* headers, uint32_t count, StorageStatus* statuses)
+{
+    std::vector<Page*> pages(headers, headers + count);
+    StorageStatus status = Page::saveBatch(pages.data(), count, statuses);
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        statuses[i] = StorageMacroblock::updateSavedHeader(headers[i], statuses[i]);
+        if (statuses[i] == STORAGE_BUSY) {
+            return STORAGE_BUSY;
+        }
+    }
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageMacroblock::updateSavedHeader(Header* header, StorageStatus status)
+{
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+
+    StorageStateGuard state;
+    StorageHeaderCache* cache = AT::headerCache();
+
+    // The header is not in memory: the next load reads (and rebuilds) the memory header
+    // and the bitmap and the index are built again from the memory headers
+    if (status != STORAGE_OK) {
+        if (cache) {
+            cache->remove(header->getMacroblockIndex());
+        }
+        if (AT::allocator()) {
+            AT::allocator()->invalidate();
+        }
+        if (AT::index()) {
+            AT::index()->invalidate();
+        }
+        return status;
+    }
+
+    if (AT::allocator()) {
+        AT::allocator()->update(header);
+    }
+    if (AT::index()) {
+        AT::index()->update(header);
+    }
+
+    if (cache) {
+        StorageStatus cacheStatus = cache->put(header, /*dirty=*/false);
+        if (cacheStatus == STORAGE_BUSY) {
+            return cacheStatus;
+        }
+    }
+
+    return status;
+}
+
+StorageStatus StorageMacroblock::rebuildHeader(Header* header, bool scanned)
+{
+    StorageCheckpoint* checkpoint = AT::checkpoint();
+    if (checkpoint) {
+        StorageStateGuard state;
+        StorageStatus status = checkpoint->invalidate();
+        if (status != STORAGE_OK) {
+            return status;
+        }
+    }
+
+    if (!scanned) {
+        return header->create();
+    }
+
+    StorageStatus status = header->save();
+    if (storage_at_data_success(status)) {
         return STORAGE_OK;
     }
+    return status;
+}
+
+void StorageMacroblock::setReadOnly(Header* header)
+{
+    for (uint32_t pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++) {
+        if (header->isPageStatus(pageIndex, Header::PAGE_EMPTY)) {
+            header->setPageStatus(pageIndex, Header::PAGE_BLOCKED);
+        }
+    }
+
+    StorageStateGuard state;
+    std::vector<uint32_t>& queue = StorageContext::current()->rebuildQueue;
+    if (std::find(queue.begin(), queue.end(), header->getMacroblockIndex()) == queue.end()) {
+        queue.push_back(header->getMacroblockIndex());
+    }
+}
+
+bool StorageMacroblock::isRebuildQueued(uint32_t macroblockIndex)
+{
+    StorageContext* context = StorageContext::current();
+    if (!context) {
+        return false;
+    }
+
+    StorageStateGuard state;
+    std::vector<uint32_t>& queue = context->rebuildQueue;
+    return std::find(queue.begin(), queue.end(), macroblockIndex) != queue.end();
+}
+
+StorageStatus StorageMacroblock::rebuildHeaders(uint32_t count)
+{
+    StorageContext* context = StorageContext::current();
+    if (!context) {
+        return STORAGE_ERROR;
+    }
+
+    std::vector<uint32_t>& queue = context->rebuildQueue;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t macroblockIndex = 0;
+        {
+            StorageStateGuard state;
+            if (queue.empty()) {
+                return STORAGE_OK;
+            }
+            macroblockIndex = queue.front();
+        }
+
+        StorageMacroblockGuard lock(macroblockIndex, /*exclusive=*/true);
+        if (lock.status() != STORAGE_OK) {
+            return lock.status();
+        }
+
+        Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+        StorageStatus status = header.load();
+        if (status == STORAGE_BUSY) {
+            return status;
+        }
+        if (status != STORAGE_OK) {
+            status = StorageMacroblock::rebuildHeader(&header, /*scanned=*/false);
+        }
+        if (status == STORAGE_BUSY) {
+            return status;
+        }
+
+        {
+            StorageStateGuard state;
+            queue.erase(std::find(queue.begin(), queue.end(), macroblockIndex));
+
+            // The read-only header kept the start pages of the broken data chains
+            if (AT::index() && AT::index()->isBuilt()) {
+                AT::index()->invalidate();
+            }
+        }
+
+        status = StorageMacroblock::updateSavedHeader(&header, status);
+        if (status != STORAGE_OK) {
+            return status;
+        }
+    }
+
+    return STORAGE_OK;
+}
+
+void StorageMacroblock::cancelRebuild(Header* header)
+{
+    if (!StorageMacroblock::isRebuildQueued(header->getMacroblockIndex())) {
+        return;
+    }
+
+    // The formatted header does not keep the blocked pages of the read-only header
+    *header = Header(StorageMacroblock::getMacroblockAddress(header->getMacroblockIndex()));
 
-    return header->create();
+    StorageStateGuard state;
+    std::vector<uint32_t>& queue = StorageContext::current()->rebuildQueue;
+    queue.erase(std::find(queue.begin(), queue.end(), header->getMacroblockIndex()));
 }
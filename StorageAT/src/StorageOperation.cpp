@@ -0,0 +1,446 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageOperation.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "StorageAT.h"
+#include "StorageData.h"
+#include "StoragePage.h"
+#include "StorageType.h"
+#include "StorageSearch.h"
+#include "StorageContext.h"
+#include "StorageJournal.h"
+#include "StorageMacroblock.h"
+
+
+StorageOperation::StorageOperation(StorageAT* storage):
+    m_storage(storage),
+    m_type(OPERATION_NONE),
+    m_phase(PHASE_START),
+    m_status(STORAGE_OK),
+    m_address(0),
+    m_resAddress(nullptr),
+    m_prefix(),
+    m_id(0),
+    m_data(nullptr),
+    m_len(0),
+    m_mode(FIND_MODE_EQUAL),
+    m_cursor(0),
+    m_readLen(0),
+    m_hasEnd(false),
+    m_page(0),
+    m_changesCount(0)
+{}
+
+void StorageOperation::start(OperationType type, const char* prefix, uint32_t id)
+{
+    m_type   = type;
+    m_phase  = PHASE_START;
+    m_status = STORAGE_BUSY;
+    m_id     = id;
+    m_cursor = 0;
+
+    memset(m_prefix, 0, sizeof(m_prefix));
+    if (prefix) {
+        memcpy(m_prefix, prefix, std::min(static_cast<size_t>(STORAGE_PAGE_PREFIX_SIZE), strlen(prefix)));
+    }
+
+    m_journal.setDriver(m_storage->m_context.driver);
+    m_changesCount = m_storage->m_context.changesCount;
+}
+
+void StorageOperation::finish(StorageStatus status)
+{
+    m_type   = OPERATION_NONE;
+    m_status = status;
+    m_targets.clear();
+    m_search.reset();
+}
+
+void StorageOperation::startLoad(uint32_t address, uint8_t* data, uint32_t len)
+{
+    this->start(OPERATION_LOAD, "", 0);
+    m_address = address;
+    m_data    = data;
+    m_len     = len;
+}
+
+void StorageOperation::startSave(uint32_t address, const char* prefix, uint32_t id, uint8_t* data, uint32_t len)
+{
+    this->start(OPERATION_SAVE, prefix, id);
+    m_address = address;
+    m_data    = data;
+    m_len     = len;
+}
+
+void StorageOperation::startFind(StorageFindMode mode, uint32_t* address, const char* prefix, uint32_t id)
+{
+    this->start(OPERATION_FIND, prefix, id);
+    m_mode       = mode;
+    m_resAddress = address;
+}
+
+void StorageOperation::startFormat()
+{
+    this->start(OPERATION_FORMAT, "", 0);
+}
+
+bool StorageOperation::isStepBusy(StorageStatus status)
+{
+    return status == STORAGE_BUSY || m_journal.isBusy();
+}
+
+void StorageOperation::copyPage()
+{
+    uint32_t neededLen = std::min(static_cast<uint32_t>(m_len - m_readLen), m_page.getPayloadSize());
+    memcpy(&m_data[m_readLen], m_page.getPayload(), neededLen);
+    m_readLen += neededLen;
+
+    if (m_readLen == m_len) {
+        this->finish(STORAGE_OK);
+    }
+}
+
+StorageStatus StorageOperation::step()
+{
+    switch (m_type) {
+    case OPERATION_LOAD:
+        return this->stepLoad();
+    case OPERATION_SAVE:
+        return this->stepSave();
+    case OPERATION_FIND:
+        return this->stepFind();
+    case OPERATION_FORMAT:
+        return this->stepFormat();
+    default:
+        this->finish(STORAGE_ERROR);
+        return STORAGE_ERROR;
+    }
+}
+
+StorageStatus StorageOperation::stepLoad()
+{
+    if (m_phase == PHASE_START) {
+        if (m_address % STORAGE_PAGE_SIZE > 0 || !m_data || !m_len || StorageMacroblock::isMacroblockAddress(m_address)) {
+            this->finish(STORAGE_ERROR);
+            return STORAGE_ERROR;
+        }
+        if (StorageAT::isOutOfMemory(m_address, m_len)) {
+            this->finish(STORAGE_OOM);
+            return STORAGE_OOM;
+        }
+
+        Page page(m_address);
+        StorageStatus status = page.load(/*startPage=*/true);
+        if (this->isStepBusy(status)) {
+            return STORAGE_BUSY;
+        }
+        if (status != STORAGE_OK) {
+            this->finish(status);
+            return status;
+        }
+
+        m_page    = page;
+        m_readLen = 0;
+        m_hasEnd  = false;
+        m_phase   = PHASE_NEXT;
+        this->copyPage();
+        return STORAGE_OK;
+    }
+
+    Page page(m_page);
+    StorageStatus status = page.loadNext();
+    if (this->isStepBusy(status)) {
+        return STORAGE_BUSY;
+    }
+    if (status == STORAGE_OK) {
+        m_page   = page;
+        m_hasEnd = page.isEnd();
+        this->copyPage();
+        return STORAGE_OK;
+    }
+    if (m_hasEnd) {
+        this->finish(STORAGE_NOT_FOUND);
+        return STORAGE_NOT_FOUND;
+    }
+
+    // The broken data is removed as by StorageAT::load (parallel readers do not remove it)
+    if (status == STORAGE_NOT_FOUND && !m_storage->m_context.locking) {
+        StorageData storageData(m_address);
+        StorageStatus deleteStatus = StorageAT::flushHeaders(storageData.deleteData(m_page.page.header.prefix, m_page.page.header.id));
+        if (this->isStepBusy(deleteStatus)) {
+            return STORAGE_BUSY;
+        }
+    }
+    this->finish(status);
+    return status;
+}
+
+StorageStatus StorageOperation::stepSave()
+{
+    uint8_t* prefix = reinterpret_cast<uint8_t*>(m_prefix);
+
+    if (m_phase == PHASE_START) {
+        if (m_address % STORAGE_PAGE_SIZE > 0 || !m_data) {
+            this->finish(STORAGE_ERROR);
+            return STORAGE_ERROR;
+        }
+        if (StorageAT::isOutOfMemory(m_address, m_len)) {
+            this->finish(STORAGE_OOM);
+            return STORAGE_OOM;
+        }
+
+        // The old data is removed and the data pages are planned and erased by one step
+        StorageStatus status = StorageAT::invalidateCheckpoint();
+        if (status == STORAGE_OK) {
+            StorageData storageData(m_address);
+            status = storageData.prepareSave(prefix, m_id, m_len, &m_targets);
+            if (status != STORAGE_OK && status != STORAGE_DATA_EXISTS && !this->isStepBusy(status)) {
+                storageData.deleteData(prefix, m_id);
+            }
+        }
+        status = StorageAT::flushHeaders(status);
+        if (this->isStepBusy(status)) {
+            return STORAGE_BUSY;
+        }
+        if (status != STORAGE_OK) {
+            this->finish(status);
+            return status;
+        }
+
+        m_cursor = 0;
+        m_phase  = PHASE_WRITE;
+        return STORAGE_OK;
+    }
+
+    if (m_phase == PHASE_WRITE) {
+        StorageStatus status = StorageData::writePlannedPage(prefix, m_id, m_data, m_len, m_targets, m_cursor);
+        if (this->isStepBusy(status)) {
+            return STORAGE_BUSY;
+        }
+        if (status != STORAGE_OK) {
+            // The page is not registrated yet, so only the page is blocked
+            StorageStatus blockStatus = StorageAT::flushHeaders(
+                StorageData::setPagesStatus({ m_targets[m_cursor] }, prefix, m_id, Header::PAGE_BLOCKED)
+            );
+            if (this->isStepBusy(blockStatus)) {
+                return STORAGE_BUSY;
+            }
+            this->finish(status);
+            return status;
+        }
+
+        if (++m_cursor < m_targets.size()) {
+            return STORAGE_OK;
+        }
+
+        // The pages are registrated macroblock by macroblock
+        std::sort(m_targets.begin(), m_targets.end());
+        m_cursor = 0;
+        m_phase  = PHASE_COMMIT;
+        return STORAGE_OK;
+    }
+
+    uint32_t macroblockIndex = StorageMacroblock::getMacroblockIndex(m_targets[m_cursor]);
+    uint32_t end = m_cursor;
+    while (end < m_targets.size() && StorageMacroblock::getMacroblockIndex(m_targets[end]) == macroblockIndex) {
+        end++;
+    }
+
+    StorageStatus status = StorageAT::flushHeaders(StorageData::setPagesStatus(
+        std::vector<uint32_t>(m_targets.begin() + m_cursor, m_targets.begin() + end),
+        prefix,
+        m_id,
+        Header::PAGE_OK
+    ));
+    if (status != STORAGE_OK && !this->isStepBusy(status)) {
+        StorageData(m_address).deleteData(prefix, m_id);
+        StorageAT::flushHeaders(STORAGE_OK);
+    }
+    if (this->isStepBusy(status)) {
+        return STORAGE_BUSY;
+    }
+    if (status != STORAGE_OK) {
+        this->finish(status);
+        return status;
+    }
+
+    m_cursor = end;
+    if (m_cursor < m_targets.size()) {
+        return STORAGE_OK;
+    }
+
+    if (StorageAT::index()) {
+        StorageStateGuard state;
+        StorageAT::index()->insert(prefix, m_id, m_address);
+    }
+    this->finish(STORAGE_OK);
+    return STORAGE_OK;
+}
+
+StorageStatus StorageOperation::stepFind()
+{
+    if (m_phase == PHASE_START) {
+        if (!m_resAddress) {
+            this->finish(STORAGE_ERROR);
+            return STORAGE_ERROR;
+        }
+
+        // The index and bitmap searches (and their lazy builds) are one step
+        StorageContext* context = &m_storage->m_context;
+        if ((m_mode != FIND_MODE_EMPTY && context->index && strlen(m_prefix)) ||
+            (m_mode == FIND_MODE_EMPTY && context->allocator)
+        ) {
+            StorageStatus status = m_storage->find(m_mode, m_resAddress, m_prefix, m_id);
+            if (this->isStepBusy(status)) {
+                return STORAGE_BUSY;
+            }
+            this->finish(status);
+            return status;
+        }
+
+        m_search = StorageSearchBase::create(m_mode, /*startSearchAddress=*/0);
+        if (!m_search) {
+            this->finish(STORAGE_ERROR);
+            return STORAGE_ERROR;
+        }
+        m_search->startSearch();
+
+        m_cursor = 0;
+        m_phase  = PHASE_NEXT;
+        return STORAGE_OK;
+    }
+
+    if (m_cursor >= StorageMacroblock::getMacroblocksCount()) {
+        StorageStatus status = m_search->getResult(m_resAddress);
+        this->finish(status);
+        return status;
+    }
+
+    // The macroblock result is dropped if the step is not finished
+    bool     foundOnce   = m_search->foundOnce;
+    uint32_t prevAddress = m_search->prevAddress;
+    uint32_t prevId      = m_search->prevId;
+
+    StorageStatus status = m_search->searchMacroblock(m_cursor, reinterpret_cast<uint8_t*>(m_prefix), m_id);
+    if (this->isStepBusy(status)) {
+        m_search->foundOnce   = foundOnce;
+        m_search->prevAddress = prevAddress;
+        m_search->prevId      = prevId;
+        return STORAGE_BUSY;
+    }
+    if (status == STORAGE_OOM) {
+        this->finish(status);
+        return status;
+    }
+    if (status == STORAGE_OK) {
+        status = m_search->getResult(m_resAddress);
+        this->finish(status);
+        return status;
+    }
+
+    m_cursor++;
+    return STORAGE_OK;
+}
+
+StorageStatus StorageOperation::stepFormat()
+{
+    StorageContext* context = &m_storage->m_context;
+
+    if (m_phase == PHASE_START) {
+        StorageStatus status = StorageAT::invalidateCheckpoint();
+        if (this->isStepBusy(status)) {
+            return STORAGE_BUSY;
+        }
+        if (status != STORAGE_OK) {
+            this->finish(status);
+            return status;
+        }
+
+        if (context->index) {
+            context->index->invalidate();
+        }
+        if (context->log) {
+            context->log->reset();
+        }
+        if (context->compactor) {
+            context->compactor->reset();
+        }
+
+        m_cursor = 0;
+        m_phase  = PHASE_NEXT;
+        return STORAGE_OK;
+    }
+
+    uint32_t macroblocksCount = StorageMacroblock::getMacroblocksCount();
+    if (m_cursor >= macroblocksCount) {
+        StorageStatus status = StorageAT::flushHeaders(STORAGE_OK);
+        if (this->isStepBusy(status)) {
+            return STORAGE_BUSY;
+        }
+        this->finish(status);
+        return status;
+    }
+
+    // Headers of several macroblocks are saved by one vectored request (as by StorageAT::format)
+    uint32_t count = 1;
+    if (StorageAT::driverHasCapability(STORAGE_DRIVER_CAP_WRITEV)) {
+        count = std::min(static_cast<uint32_t>(STORAGE_EXTENT_PAGES_COUNT), macroblocksCount - m_cursor);
+    }
+    StorageStatus status = count == 1 ?
+        StorageMacroblock::formatMacroblock(m_cursor) :
+        StorageMacroblock::formatMacroblocks(m_cursor, count);
+    if (this->isStepBusy(status)) {
+        return STORAGE_BUSY;
+    }
+
+    m_cursor += count;
+    return STORAGE_OK;
+}
+
+StorageStatus StorageOperation::process()
+{
+    if (m_type == OPERATION_NONE) {
+        return m_status;
+    }
+
+    StorageContext* context = &m_storage->m_context;
+    StorageContextGuard guard(context);
+    StorageAccessGuard access(context, /*exclusive=*/true);
+
+    // Another call has changed memory after the previous process() call: the recorded
+    // requests are stale and the steps that depend on the memory content start again
+    if (context->changesCount != m_changesCount) {
+        m_journal.clear();
+        if (m_type != OPERATION_FORMAT) {
+            m_phase = PHASE_START;
+        }
+    }
+
+    // All the driver requests of the steps go through the journal, the journal
+    // keeps the requests of the unfinished step only
+    IStorageDriver* driver = context->driver;
+    context->driver = &m_journal;
+
+    StorageStatus status = STORAGE_OK;
+    while (m_type != OPERATION_NONE && status != STORAGE_BUSY) {
+        m_journal.rewind();
+        status = this->step();
+        if (status != STORAGE_BUSY) {
+            m_journal.clear();
+        }
+    }
+
+    context->driver = driver;
+    m_changesCount  = context->changesCount;
+
+    return m_type == OPERATION_NONE ? m_status : STORAGE_BUSY;
+}
+
+bool StorageOperation::isDone()
+{
+    return m_type == OPERATION_NONE;
+}
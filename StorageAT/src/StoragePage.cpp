@@ -2,12 +2,16 @@
 
 #include "StoragePage.h"
 
+#include <memory>
+#include <vector>
 #include <string.h>
 #include <stdint.h>
 
 #include "StorageAT.h"
+#include "StorageCRC.h"
 #include "StorageData.h"
 #include "StoragePage.h"
+#include "StorageContext.h"
 #include "StorageMacroblock.h"
 
 
@@ -53,14 +57,14 @@ Page& Page::operator=(const Page& other)
     return *this;
 }
 
-StorageStatus Page::loadPrev()
+StorageStatus Page::loadPrev(bool metaOnly)
 {
     if (!this->validatePrevAddress()) {
         return STORAGE_NOT_FOUND;
     }
 
     Page tmpPage(this->page.header.prev_addr);
-    StorageStatus status = tmpPage.load();
+    StorageStatus status = metaOnly ? tmpPage.loadMeta() : tmpPage.load();
     if (status != STORAGE_OK) {
         return status;
     }
@@ -78,13 +82,13 @@ StorageStatus Page::loadPrev()
     return STORAGE_OK;
 }
 
-StorageStatus Page::loadNext() {
+StorageStatus Page::loadNext(bool metaOnly) {
     if (!this->validateNextAddress()) {
         return STORAGE_NOT_FOUND;
     }
 
     Page tmpPage(this->page.header.next_addr);
-    StorageStatus status = tmpPage.load();
+    StorageStatus status = metaOnly ? tmpPage.loadMeta() : tmpPage.load();
     if (status == STORAGE_BUSY) {
     	return status;
     }
@@ -111,13 +115,63 @@ StorageStatus Page::load(bool startPage)
         return STORAGE_OOM;
     }
 
-    Page tmpPage(this->address);
-    StorageStatus status = AT::driverCallback()->read(address, reinterpret_cast<uint8_t*>(&tmpPage.page), sizeof(tmpPage.page));
+    // The page is not read while another writer changes the macroblock
+    StorageMacroblockGuard lock(StorageMacroblock::getMacroblockIndex(address), /*exclusive=*/false);
+    if (lock.status() != STORAGE_OK) {
+        return lock.status();
+    }
+
+    PageStruct tmpStruct;
+    StorageStatus status = AT::driverCallback()->read(address, reinterpret_cast<uint8_t*>(&tmpStruct), sizeof(tmpStruct));
     if (status != STORAGE_OK) {
         return status;
     }
 
-    if (!tmpPage.validate()) {
+    return this->parse(&tmpStruct, startPage);
+}
+
+StorageStatus Page::loadMeta(bool startPage)
+{
+#ifdef STORAGE_PAGE_META_CRC
+    if (this->address + sizeof(page) > StorageAT::getStorageSize()) {
+        return STORAGE_OOM;
+    }
+
+    PageMeta meta = {};
+    StorageStatus status = STORAGE_OK;
+    {
+        StorageMacroblockGuard lock(StorageMacroblock::getMacroblockIndex(address), /*exclusive=*/false);
+        if (lock.status() != STORAGE_OK) {
+            return lock.status();
+        }
+        status = AT::driverCallback()->read(address, reinterpret_cast<uint8_t*>(&meta), sizeof(meta));
+    }
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    if (meta.magic == STORAGE_MAGIC &&
+        meta.version == STORAGE_VERSION &&
+        meta.crc == Page::getMetaCRC(&meta)
+    ) {
+        if (startPage && meta.prev_addr != this->address) {
+            return STORAGE_ERROR;
+        }
+        memcpy(reinterpret_cast<void*>(&this->page.header), reinterpret_cast<void*>(&meta), sizeof(meta));
+        return STORAGE_OK;
+    }
+#endif
+
+    // The pages of the previous versions and the pages with the broken meta are validated by the page checksum
+    return this->load(startPage);
+}
+
+StorageStatus Page::parse(const PageStruct* raw, bool startPage)
+{
+    Page tmpPage(this->address);
+    memcpy(reinterpret_cast<void*>(&tmpPage.page), reinterpret_cast<const void*>(raw), sizeof(tmpPage.page));
+
+    if (!tmpPage.validate() || tmpPage.page.header.version != STORAGE_VERSION) {
         tmpPage.repair();
     }
     if (!tmpPage.validate()) {
@@ -134,28 +188,58 @@ StorageStatus Page::load(bool startPage)
 }
 
 StorageStatus Page::save()
+{
+    return this->write(/*emptyPage=*/false);
+}
+
+StorageStatus Page::saveEmpty()
+{
+    return this->write(/*emptyPage=*/true);
+}
+
+StorageStatus Page::write(bool emptyPage)
 {
     if (this->address + sizeof(page) > StorageAT::getStorageSize()) {
         return STORAGE_OOM;
     }
-    page.header.magic = STORAGE_MAGIC;
-    page.header.version = STORAGE_VERSION;
-    page.crc = this->getCRC16(reinterpret_cast<uint8_t*>(&page), sizeof(page) - sizeof(page.crc));
+    this->prepare();
+
+    StorageVerifyPolicy policy = AT::getVerifyPolicy();
 
     Page checkPage(this->address);
-    StorageStatus status = checkPage.load();
+    StorageStatus status = STORAGE_OK;
     bool sameDataExists = false;
-    if (status == STORAGE_OK && !memcmp(reinterpret_cast<void*>(&(this->page)), reinterpret_cast<void*>(&(checkPage.page)), sizeof(this->page))) {
-        sameDataExists = true;
+    if (policy == STORAGE_VERIFY_FULL || (policy == STORAGE_VERIFY_SKIP_EMPTY && !emptyPage)) {
+        status = checkPage.load();
+        if (status == STORAGE_OK && !memcmp(reinterpret_cast<void*>(&(this->page)), reinterpret_cast<void*>(&(checkPage.page)), sizeof(this->page))) {
+            sameDataExists = true;
+        }
     }
 
     if (!sameDataExists) {
-        status = AT::driverCallback()->write(address, reinterpret_cast<uint8_t*>(&page), sizeof(page));
+        status = AT::driverWrite(address, reinterpret_cast<uint8_t*>(&page), sizeof(page));
     }
     if (!sameDataExists && status != STORAGE_OK) {
         return status;
     }
 
+    if (policy == STORAGE_VERIFY_NONE) {
+        return STORAGE_OK;
+    }
+
+    if (policy == STORAGE_VERIFY_CRC) {
+        StoragePageCRC crc = 0;
+        status = AT::driverCallback()->read(
+            address + static_cast<uint32_t>(sizeof(page) - sizeof(crc)),
+            reinterpret_cast<uint8_t*>(&crc),
+            sizeof(crc)
+        );
+        if (status != STORAGE_OK) {
+            return status;
+        }
+        return crc == page.crc ? STORAGE_OK : STORAGE_ERROR;
+    }
+
     status = checkPage.load();
     if (status == STORAGE_OK) {
         memcpy(reinterpret_cast<void*>(&(this->page)), reinterpret_cast<void*>(&(checkPage.page)), sizeof(this->page));
@@ -164,34 +248,134 @@ StorageStatus Page::save()
     return status;
 }
 
+StorageStatus Page::saveBatch(Page* const* pages, uint32_t count, StorageStatus* statuses)
+{
+    if (!count) {
+        return STORAGE_OK;
+    }
+
+    std::unique_ptr<StorageIOVec[]> vec = std::make_unique<StorageIOVec[]>(count);
+    std::unique_ptr<PageStruct[]> checkPages = std::make_unique<PageStruct[]>(count);
+    uint32_t vecCount = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        statuses[i] = STORAGE_ERROR;
+        if (pages[i]->address + sizeof(pages[i]->page) > StorageAT::getStorageSize()) {
+            statuses[i] = STORAGE_OOM;
+            continue;
+        }
+        pages[i]->prepare();
+        vec[vecCount++] = { pages[i]->address, reinterpret_cast<uint8_t*>(&(pages[i]->page)), sizeof(pages[i]->page) };
+    }
+
+    StorageStatus status = AT::driverWritev(vec.get(), vecCount);
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+    if (status == STORAGE_OK && AT::getVerifyPolicy() == STORAGE_VERIFY_NONE) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (statuses[i] != STORAGE_OOM) {
+                statuses[i] = STORAGE_OK;
+            }
+        }
+        return STORAGE_OK;
+    }
+    if (status == STORAGE_OK) {
+        for (uint32_t i = 0; i < vecCount; i++) {
+            vec[i].data = reinterpret_cast<uint8_t*>(&checkPages[i]);
+        }
+        status = AT::driverReadv(vec.get(), vecCount);
+    }
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+
+    for (uint32_t i = 0, vecIndex = 0; i < count; i++) {
+        if (statuses[i] == STORAGE_OOM) {
+            continue;
+        }
+
+        PageStruct* checkStruct = &checkPages[vecIndex++];
+        Page checkPage(pages[i]->address);
+        if (status == STORAGE_OK &&
+            checkPage.parse(checkStruct) == STORAGE_OK &&
+            !memcmp(reinterpret_cast<void*>(&(pages[i]->page)), reinterpret_cast<void*>(&(checkPage.page)), sizeof(checkPage.page))
+        ) {
+            statuses[i] = STORAGE_OK;
+            continue;
+        }
+
+        statuses[i] = pages[i]->save();
+        if (statuses[i] == STORAGE_BUSY) {
+            return STORAGE_BUSY;
+        }
+    }
+
+    return STORAGE_OK;
+}
+
+void Page::prepare()
+{
+    page.header.magic = STORAGE_MAGIC;
+    page.header.version = STORAGE_VERSION;
+#ifdef STORAGE_PAGE_META_CRC
+    page.header.crc = Page::getMetaCRC(&page.header);
+#endif
+    page.crc = this->getPageCRC();
+}
+
 bool Page::validate()
 {
     if (page.header.magic != STORAGE_MAGIC) {
         return false;
     }
 
+#if STORAGE_VERSION != STORAGE_VERSION_V6
+    // v6 data pages can not be migrated in place (v7 and v8 payload is 2 bytes shorter), they are read as is until rewrite
+    if (page.header.version == STORAGE_VERSION_V6) {
+        return this->validateCRC16();
+    }
+#endif
+
     if (page.header.version != STORAGE_VERSION) {
         return false;
     }
 
-    uint16_t crc = this->getCRC16(reinterpret_cast<uint8_t*>(&page), sizeof(page) - sizeof(page.crc));
-    if (crc != page.crc) {
+    if (this->getPageCRC() != page.crc) {
         return false;
     }
 
+#ifdef STORAGE_PAGE_META_CRC
+    if (Page::getMetaCRC(&page.header) != page.header.crc) {
+        return false;
+    }
+#endif
+
     return true;
 }
 
 uint16_t Page::getCRC16(uint8_t* buf, uint16_t len) {
+    return storage_at_crc16(buf, len);
+}
+
+StoragePageCRC Page::getPageCRC()
+{
+#ifdef STORAGE_PAGE_CRC32C
+    return storage_at_crc32c(reinterpret_cast<uint8_t*>(&page), sizeof(page) - sizeof(page.crc));
+#else
+    return this->getCRC16(reinterpret_cast<uint8_t*>(&page), sizeof(page) - sizeof(page.crc));
+#endif
+}
+
+uint16_t Page::getMetaCRC(const PageMeta* meta)
+{
+    return storage_at_crc16(reinterpret_cast<const uint8_t*>(meta), STORAGE_PAGE_META_SIZE_V6);
+}
+
+bool Page::validateCRC16()
+{
     uint16_t crc = 0;
-    for (uint16_t i = 1; i < len; i++) {
-        crc  = static_cast<uint16_t>((crc >> 8) | (crc << 8));
-        crc ^= static_cast<uint16_t>(buf[i]);
-        crc ^= static_cast<uint16_t>((crc & 0xFF) >> 4);
-        crc ^= static_cast<uint16_t>((crc << 8) << 4);
-        crc ^= static_cast<uint16_t>(((crc & 0xff) << 4) << 1);
-    }
-    return crc;
+    memcpy(&crc, reinterpret_cast<uint8_t*>(&page) + sizeof(page) - sizeof(crc), sizeof(crc));
+    return crc == this->getCRC16(reinterpret_cast<uint8_t*>(&page), sizeof(page) - sizeof(crc));
 }
 
 bool Page::isStart()
@@ -224,6 +408,26 @@ uint32_t Page::getAddress()
     return this->address;
 }
 
+uint32_t Page::getPayloadSize()
+{
+#if STORAGE_VERSION != STORAGE_VERSION_V6
+    if (page.header.version == STORAGE_VERSION_V6) {
+        return STORAGE_PAGE_PAYLOAD_SIZE_V6;
+    }
+#endif
+    return STORAGE_PAGE_PAYLOAD_SIZE;
+}
+
+uint8_t* Page::getPayload()
+{
+#ifdef STORAGE_PAGE_META_CRC
+    if (page.header.version == STORAGE_VERSION_V6) {
+        return reinterpret_cast<uint8_t*>(&page) + STORAGE_PAGE_META_SIZE_V6;
+    }
+#endif
+    return page.payload;
+}
+
 void Page::setPrevAddress(uint32_t prevAddress)
 {
     this->page.header.prev_addr = prevAddress;
@@ -240,17 +444,30 @@ void Page::repair()
         return;
     }
 
-    uint16_t crc = this->getCRC16(reinterpret_cast<uint8_t*>(&page), sizeof(page) - sizeof(page.crc));
-    if (crc != page.crc) {
+    if (!this->validateCRC16()) {
         return;
     }
 
     if (page.header.version == STORAGE_VERSION_V5) {
     	page.header.version = STORAGE_VERSION_V6;
-        page.crc = this->getCRC16(reinterpret_cast<uint8_t*>(&page), sizeof(page) - sizeof(page.crc));
-        AT::driverCallback()->write(address, reinterpret_cast<uint8_t*>(&page), sizeof(page));
+        uint16_t crc = this->getCRC16(reinterpret_cast<uint8_t*>(&page), sizeof(page) - sizeof(crc));
+        memcpy(reinterpret_cast<uint8_t*>(&page) + sizeof(page) - sizeof(crc), &crc, sizeof(crc));
+        AT::driverWrite(address, reinterpret_cast<uint8_t*>(&page), sizeof(page));
         AT::driverCallback()->read(address, reinterpret_cast<uint8_t*>(&page), sizeof(page));
     }
+
+#if STORAGE_VERSION != STORAGE_VERSION_V6
+    // Header data does not use the last 2 bytes of v6 payload, so header pages are migrated in place
+    if (page.header.version == STORAGE_VERSION_V6 && StorageMacroblock::isMacroblockAddress(address)) {
+#ifdef STORAGE_PAGE_META_CRC
+        // v8 header data follows the page meta CRC16
+        memmove(page.payload, reinterpret_cast<uint8_t*>(&page) + STORAGE_PAGE_META_SIZE_V6, sizeof(Header::HeaderMeta));
+#endif
+        this->prepare();
+        AT::driverWrite(address, reinterpret_cast<uint8_t*>(&page), sizeof(page));
+        AT::driverCallback()->read(address, reinterpret_cast<uint8_t*>(&page), sizeof(page));
+    }
+#endif
 }
 
 Header::Header(uint32_t address): Page(address)
@@ -349,17 +566,45 @@ bool Header::isSameMeta(uint32_t pageIndex, const uint8_t* prefix, uint32_t id)
 
 uint32_t Header::getMacroblockStartAddress(uint32_t address)
 {
-    return (address / (StorageMacroblock::PAGES_COUNT * STORAGE_PAGE_SIZE)) * (StorageMacroblock::PAGES_COUNT * STORAGE_PAGE_SIZE);
+    return StorageMacroblock::getMacroblockAddress(StorageMacroblock::getMacroblockIndex(address));
 }
 
-StorageStatus Header::create()
+StorageStatus Header::scan(uint32_t* dataPagesCount, PageMeta* metas)
 {
     StorageStatus status = STORAGE_OK;
+
+    // The macroblock pages are read by a single vectored request if the driver supports it
+    std::unique_ptr<PageStruct[]> pages;
+    uint32_t pagesCount = 0;
+    if (AT::driverHasCapability(STORAGE_DRIVER_CAP_READV)) {
+        uint32_t firstAddress = StorageMacroblock::getPageAddressByIndex(this->m_macroblockIndex, 0);
+        while (pagesCount < Header::PAGES_COUNT &&
+               firstAddress + (pagesCount + 1) * STORAGE_PAGE_SIZE <= AT::getStorageSize()
+        ) {
+            pagesCount++;
+        }
+
+        pages = std::make_unique<PageStruct[]>(Header::PAGES_COUNT);
+        StorageIOVec vec = { firstAddress, reinterpret_cast<uint8_t*>(pages.get()), pagesCount * STORAGE_PAGE_SIZE };
+        status = pagesCount ? AT::driverReadv(&vec, 1) : STORAGE_OK;
+        if (status == STORAGE_BUSY) {
+            return STORAGE_BUSY;
+        }
+        if (status != STORAGE_OK) {
+            pagesCount = 0;
+        }
+    }
+
+    *dataPagesCount = 0;
     MetaUnit* metaUnitPtr = this->data->metaUnits;
     for (unsigned  i = 0; i < Header::PAGES_COUNT; i++, metaUnitPtr++) {
         Page tmpPage(StorageMacroblock::getPageAddressByIndex(this->m_macroblockIndex, i));
 
-        status = tmpPage.load();
+        if (i < pagesCount) {
+            status = tmpPage.parse(&pages[i]);
+        } else {
+            status = tmpPage.load();
+        }
         if (status == STORAGE_BUSY) {
             return STORAGE_BUSY;
         }
@@ -375,26 +620,137 @@ StorageStatus Header::create()
             continue;
         }
 
-        uint32_t tmpAddress = tmpPage.getAddress();
-        status = StorageData::findStartAddress(&tmpAddress);
-        if (status == STORAGE_BUSY) {
-            return STORAGE_BUSY;
+        memcpy((*metaUnitPtr).prefix, tmpPage.page.header.prefix, sizeof(tmpPage.page.header.prefix));
+        (*metaUnitPtr).id = tmpPage.page.header.id;
+        this->setPageStatus(i, Header::PAGE_OK);
+        (*dataPagesCount)++;
+
+        if (metas) {
+            memcpy(reinterpret_cast<void*>(&metas[i]), reinterpret_cast<void*>(&tmpPage.page.header), sizeof(metas[i]));
         }
-        if (status != STORAGE_OK) {
-            continue;
+    }
+
+    return STORAGE_OK;
+}
+
+StorageStatus Header::loadChainLink(
+    std::unordered_map<uint32_t, ChainLink>* links,
+    uint32_t                                 address,
+    ChainLink**                              link
+) {
+    auto it = links->find(address);
+    if (it != links->end()) {
+        *link = &it->second;
+        return STORAGE_OK;
+    }
+
+    // The pages of the neighbour macroblocks are loaded once on the first link to them
+    Page page(address);
+    StorageStatus status = page.loadMeta();
+    if (status == STORAGE_BUSY) {
+        return STORAGE_BUSY;
+    }
+
+    ChainLink tmpLink = {};
+    tmpLink.valid = status == STORAGE_OK;
+    memcpy(reinterpret_cast<void*>(&tmpLink.meta), reinterpret_cast<void*>(&page.page.header), sizeof(tmpLink.meta));
+    *link = &links->insert({ address, tmpLink }).first->second;
+
+    return STORAGE_OK;
+}
+
+StorageStatus Header::walkChain(
+    std::unordered_map<uint32_t, ChainLink>* links,
+    uint32_t                                 address,
+    bool                                     next
+) {
+    std::vector<ChainLink*> path;
+    uint8_t result = CHAIN_BROKEN;
+
+    ChainLink* link = nullptr;
+    StorageStatus status = loadChainLink(links, address, &link);
+    while (status == STORAGE_OK && link->valid) {
+        uint8_t state = next ? link->end : link->start;
+        if (state != CHAIN_UNKNOWN) {
+            // The page was walked before or the links make a loop
+            result = state == CHAIN_WALK ? static_cast<uint8_t>(CHAIN_BROKEN) : state;
+            break;
         }
-        status = StorageData::findEndAddress(&tmpAddress);
-        if (status == STORAGE_BUSY) {
-            return STORAGE_BUSY;
+        (next ? link->end : link->start) = CHAIN_WALK;
+        path.push_back(link);
+
+        uint32_t linkAddress = next ? link->meta.next_addr : link->meta.prev_addr;
+        if (linkAddress == address) {
+            result = CHAIN_VALID;
+            break;
         }
-        if (status != STORAGE_OK) {
+
+        ChainLink* nextLink = nullptr;
+        status = loadChainLink(links, linkAddress, &nextLink);
+        if (status != STORAGE_OK || !nextLink->valid) {
+            break;
+        }
+        if (memcmp(nextLink->meta.prefix, link->meta.prefix, sizeof(link->meta.prefix)) ||
+            nextLink->meta.id != link->meta.id
+        ) {
+            break;
+        }
+
+        address = linkAddress;
+        link    = nextLink;
+    }
+    if (status == STORAGE_BUSY) {
+        for (ChainLink* pathLink : path) {
+            (next ? pathLink->end : pathLink->start) = CHAIN_UNKNOWN;
+        }
+        return STORAGE_BUSY;
+    }
+
+    // Every page of the walk leads to the same chain bound
+    for (ChainLink* pathLink : path) {
+        (next ? pathLink->end : pathLink->start) = result;
+    }
+
+    return result == CHAIN_VALID ? STORAGE_OK : STORAGE_NOT_FOUND;
+}
+
+StorageStatus Header::create()
+{
+    uint32_t dataPagesCount = 0;
+    std::unique_ptr<PageMeta[]> metas = std::make_unique<PageMeta[]>(Header::PAGES_COUNT);
+    StorageStatus status = this->scan(&dataPagesCount, metas.get());
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    // The link graph is built from the scanned pages, so each page is read once per rebuild
+    std::unordered_map<uint32_t, ChainLink> links;
+    for (unsigned  i = 0; i < Header::PAGES_COUNT && dataPagesCount; i++) {
+        ChainLink link = {};
+        link.valid = this->isPageStatus(i, Header::PAGE_OK);
+        memcpy(reinterpret_cast<void*>(&link.meta), reinterpret_cast<void*>(&metas[i]), sizeof(link.meta));
+        links.insert({ StorageMacroblock::getPageAddressByIndex(this->m_macroblockIndex, i), link });
+    }
+
+    // Only the pages of the whole data chains stay in the header
+    MetaUnit* metaUnitPtr = this->data->metaUnits;
+    for (unsigned  i = 0; i < Header::PAGES_COUNT && dataPagesCount; i++, metaUnitPtr++) {
+        if (!this->isPageStatus(i, Header::PAGE_OK)) {
             continue;
         }
 
+        uint32_t pageAddress = StorageMacroblock::getPageAddressByIndex(this->m_macroblockIndex, i);
+        status = walkChain(&links, pageAddress, /*next=*/false);
         if (status == STORAGE_OK) {
-            memcpy((*metaUnitPtr).prefix, tmpPage.page.header.prefix, sizeof(tmpPage.page.header.prefix));
-            (*metaUnitPtr).id = tmpPage.page.header.id;
-            this->setPageStatus(i, Header::PAGE_OK);
+            status = walkChain(&links, pageAddress, /*next=*/true);
+        }
+        if (status == STORAGE_BUSY) {
+            return STORAGE_BUSY;
+        }
+        if (status != STORAGE_OK) {
+            memset((*metaUnitPtr).prefix, 0, sizeof((*metaUnitPtr).prefix));
+            (*metaUnitPtr).id = 0;
+            this->setPageStatus(i, Header::PAGE_EMPTY);
         }
     }
 
@@ -464,19 +820,6 @@ StorageStatus Header::save()
 
 bool Header::validate()
 {
-    if (!Page::validate()) {
-        return false;
-    }
-
-    MetaStatus* statusPtr = data->metaStatuses;
-    MetaStatus* statusEndPtr = &(this->data->metaStatuses[Header::STATUSES_COUNT-1]);
-    for (; statusPtr < statusEndPtr; statusPtr++) {
-        for (unsigned pageIndex = 0; pageIndex < Header::PAGES_COUNT; pageIndex++) {
-            if (!(*statusPtr).getStatus(pageIndex)) {
-                return false;
-            }
-        }
-    }
-
-    return true;
+    // All the status values are valid (PAGE_STALE is the zero status)
+    return Page::validate();
 }
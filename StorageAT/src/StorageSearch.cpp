@@ -1,11 +1,15 @@
 #include "StorageSearch.h"
 
+#include <atomic>
+#include <vector>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "StoragePage.h"
+#include "StorageContext.h"
 #include "StorageMacroblock.h"
+#include "StorageThreadPool.h"
 
 
 StorageStatus StorageSearchBase::searchPageAddress(
@@ -14,25 +18,139 @@ StorageStatus StorageSearchBase::searchPageAddress(
     uint32_t*      resAddress
 ) {
     uint32_t macroblockIndex = StorageMacroblock::getMacroblockIndex(this->startSearchAddress);
-    this->prevId = getStartCmpId();
-    this->foundOnce = false;
+    this->startSearch();
 
-    for (; macroblockIndex < StorageMacroblock::getMacroblocksCount(); macroblockIndex++) {
-        Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+    // The pool threads can not wait for the macroblocks locked by the current call
+    StorageContext* context = StorageContext::current();
+    StorageThreadPool* pool = context ? context->threadPool.get() : nullptr;
+    if (pool && StorageAT::driverHasCapability(STORAGE_DRIVER_CAP_PARALLEL) && macroblockIndex + 1 < StorageMacroblock::getMacroblocksCount() && !StorageAccessGuard::isHoldingMacroblocks()) {
+        return this->searchPageAddressParallel(pool, macroblockIndex, prefix, id, resAddress);
+    }
 
-        StorageStatus status = StorageMacroblock::loadHeader(&header);
+    for (; macroblockIndex < StorageMacroblock::getMacroblocksCount(); macroblockIndex++) {
+        StorageStatus status = this->searchMacroblock(macroblockIndex, prefix, id);
         if (status == STORAGE_BUSY || status == STORAGE_OOM) {
             return status;
         }
+        if (status == STORAGE_OK) {
+            break;
+        }
+    }
 
-        status = this->searchPageAddressInMacroblock(&header, prefix, id);
-        if (status == STORAGE_BUSY) {
-            return STORAGE_BUSY;
+    return this->getResult(resAddress);
+}
+
+std::unique_ptr<StorageSearchBase> StorageSearchBase::create(StorageFindMode mode, uint32_t startSearchAddress)
+{
+    switch (mode) {
+    case FIND_MODE_EQUAL:
+        return std::make_unique<StorageSearchEqual>(startSearchAddress);
+    case FIND_MODE_NEXT:
+        return std::make_unique<StorageSearchNext>(startSearchAddress);
+    case FIND_MODE_MIN:
+        return std::make_unique<StorageSearchMin>(startSearchAddress);
+    case FIND_MODE_MAX:
+        return std::make_unique<StorageSearchMax>(startSearchAddress);
+    case FIND_MODE_EMPTY:
+        return std::make_unique<StorageSearchEmpty>(startSearchAddress);
+    default:
+        return nullptr;
+    }
+}
+
+void StorageSearchBase::startSearch()
+{
+    this->prevId      = getStartCmpId();
+    this->prevAddress = 0;
+    this->foundOnce   = false;
+}
+
+StorageStatus StorageSearchBase::searchMacroblock(
+    uint32_t       macroblockIndex,
+    const uint8_t  prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t id
+) {
+    Header header(StorageMacroblock::getMacroblockAddress(macroblockIndex));
+
+    StorageStatus status = StorageMacroblock::loadHeader(&header);
+    if (status == STORAGE_BUSY || status == STORAGE_OOM) {
+        return status;
+    }
+
+    status = this->searchPageAddressInMacroblock(&header, prefix, id);
+    if (status == STORAGE_BUSY) {
+        return STORAGE_BUSY;
+    }
+    if (status == STORAGE_OK && isNeededFirstResult()) {
+        return STORAGE_OK;
+    }
+    return STORAGE_NOT_FOUND;
+}
+
+StorageStatus StorageSearchBase::getResult(uint32_t* resAddress)
+{
+    if (this->foundOnce) {
+        *resAddress = this->prevAddress;
+        return STORAGE_OK;
+    }
+
+    return STORAGE_NOT_FOUND;
+}
+
+StorageStatus StorageSearchBase::searchPageAddressParallel(
+    StorageThreadPool* pool,
+    uint32_t           startMacroblockIndex,
+    const uint8_t      prefix[STORAGE_PAGE_PREFIX_SIZE],
+    const uint32_t     id,
+    uint32_t*          resAddress
+) {
+    uint32_t macroblocksCount = StorageMacroblock::getMacroblocksCount() - startMacroblockIndex;
+    std::vector<MacroblockResult> results(macroblocksCount, { STORAGE_NOT_FOUND, 0, 0 });
+    StorageContext* context = StorageContext::current();
+    StorageAccessGuard* parent = StorageAccessGuard::current();
+
+    // Results after the stop macroblock are not used by the reduction
+    std::atomic<uint32_t> stopIndex(macroblocksCount);
+
+    pool->run(macroblocksCount, [&](uint32_t i) {
+        if (i > stopIndex) {
+            return;
         }
-        if (status != STORAGE_OK) {
+
+        StorageContextGuard guard(context);
+        StorageAccessGuard access(context, parent);
+
+        std::unique_ptr<StorageSearchBase> search = this->clone();
+        search->prevId    = search->getStartCmpId();
+        search->foundOnce = false;
+
+        Header header(StorageMacroblock::getMacroblockAddress(startMacroblockIndex + i));
+        StorageStatus status = StorageMacroblock::loadHeader(&header);
+        if (status != STORAGE_BUSY && status != STORAGE_OOM) {
+            status = search->searchPageAddressInMacroblock(&header, prefix, id);
+        }
+        results[i] = { status, search->prevAddress, search->prevId };
+
+        if (status == STORAGE_BUSY || status == STORAGE_OOM || (status == STORAGE_OK && isNeededFirstResult())) {
+            uint32_t stop = stopIndex;
+            while (i < stop && !stopIndex.compare_exchange_weak(stop, i));
+        }
+    });
+
+    for (const MacroblockResult& result : results) {
+        if (result.status == STORAGE_BUSY || result.status == STORAGE_OOM) {
+            return result.status;
+        }
+        if (result.status != STORAGE_OK) {
             continue;
         }
 
+        if (!this->foundOnce || isIdFound(result.id, id)) {
+            this->foundOnce   = true;
+            this->prevId      = result.id;
+            this->prevAddress = result.address;
+        }
+
         if (isNeededFirstResult()) {
             break;
         }
@@ -76,7 +194,7 @@ StorageStatus StorageSearchBase::searchPageAddressInMacroblock(
         }
 
         Page page(StorageMacroblock::getPageAddressByIndex(header->getMacroblockIndex(), pageIndex));
-        StorageStatus status = page.load(/*startPage=*/true);
+        StorageStatus status = page.loadMeta(/*startPage=*/true);
         if (status != STORAGE_OK) {
             continue;
         }
@@ -0,0 +1,110 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageThreadPool.h"
+
+#include <stdint.h>
+
+
+StorageThreadPool::StorageThreadPool(uint32_t threadsCount):
+    m_threadsCount(threadsCount ? threadsCount : 1), m_task(nullptr), m_tasksCount(0), m_nextTask(0)
+#ifndef STORAGE_NO_THREADS
+    , m_generation(0), m_activeWorkers(0), m_stop(false)
+#endif
+{
+#ifndef STORAGE_NO_THREADS
+    m_threads.reserve(m_threadsCount - 1);
+    for (uint32_t i = 1; i < m_threadsCount; i++) {
+        m_threads.emplace_back(&StorageThreadPool::work, this);
+    }
+#else
+    m_threadsCount = 1;
+#endif
+}
+
+StorageThreadPool::~StorageThreadPool()
+{
+#ifndef STORAGE_NO_THREADS
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+#endif
+}
+
+uint32_t StorageThreadPool::getThreadsCount()
+{
+    return m_threadsCount;
+}
+
+void StorageThreadPool::run(uint32_t tasksCount, const std::function<void(uint32_t)>& task)
+{
+#ifndef STORAGE_NO_THREADS
+    std::unique_lock<std::mutex> owner(m_runMutex, std::try_to_lock);
+    if (!owner.owns_lock() || m_threads.empty() || tasksCount < 2) {
+        for (uint32_t i = 0; i < tasksCount; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task       = &task;
+        m_tasksCount = tasksCount;
+        m_nextTask   = 0;
+        m_generation++;
+    }
+    m_wakeup.notify_all();
+
+    runTasks(task, tasksCount);
+
+    // The workers that have not taken the job yet do not take it after the end
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_activeWorkers == 0; });
+    m_task       = nullptr;
+    m_tasksCount = 0;
+#else
+    for (uint32_t i = 0; i < tasksCount; i++) {
+        task(i);
+    }
+#endif
+}
+
+void StorageThreadPool::runTasks(const std::function<void(uint32_t)>& task, uint32_t tasksCount)
+{
+    for (uint32_t i = m_nextTask++; i < tasksCount; i = m_nextTask++) {
+        task(i);
+    }
+}
+
+#ifndef STORAGE_NO_THREADS
+void StorageThreadPool::work()
+{
+    uint32_t generation = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wakeup.wait(lock, [&]() { return m_stop || (m_task && m_generation != generation); });
+        if (m_stop) {
+            return;
+        }
+
+        generation = m_generation;
+        const std::function<void(uint32_t)>* task = m_task;
+        uint32_t tasksCount = m_tasksCount;
+        m_activeWorkers++;
+        lock.unlock();
+
+        runTasks(*task, tasksCount);
+
+        lock.lock();
+        m_activeWorkers--;
+        if (!m_activeWorkers) {
+            m_done.notify_all();
+        }
+    }
+}
+#endif
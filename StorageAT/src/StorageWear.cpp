@@ -0,0 +1,147 @@
+/* Copyright © 2026 Georgy E. All rights reserved. */
+
+#include "StorageWear.h"
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "StorageAT.h"
+#include "StorageCRC.h"
+#include "StorageType.h"
+
+
+typedef StorageAT AT;
+
+
+StorageWear::StorageWear(uint32_t address): m_address(address), m_counters(getSectorsCount(), 0) {}
+
+uint32_t StorageWear::getSectorSize()
+{
+    return std::max(AT::getMinEraseSize(), static_cast<uint32_t>(STORAGE_PAGE_SIZE));
+}
+
+uint32_t StorageWear::getSectorsCount()
+{
+    uint32_t size = AT::getStorageSize();
+    return size / getSectorSize() + (size % getSectorSize() ? 1 : 0);
+}
+
+uint32_t StorageWear::getSectorIndex(uint32_t address)
+{
+    return address / getSectorSize();
+}
+
+uint32_t StorageWear::getCountersSize()
+{
+    uint32_t size = getSectorsCount() * static_cast<uint32_t>(sizeof(uint32_t));
+    return (size / STORAGE_PAGE_SIZE + (size % STORAGE_PAGE_SIZE ? 1 : 0)) * STORAGE_PAGE_SIZE;
+}
+
+uint32_t StorageWear::getSize()
+{
+    return STORAGE_PAGE_SIZE + getCountersSize();
+}
+
+uint32_t StorageWear::getAddress()
+{
+    return m_address;
+}
+
+StorageStatus StorageWear::load()
+{
+    m_counters.assign(getSectorsCount(), 0);
+
+    uint8_t buffer[STORAGE_PAGE_SIZE] = {};
+    StorageStatus status = AT::driverCallback()->read(m_address, buffer, sizeof(buffer));
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+    if (status != STORAGE_OK) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    Superblock* superblock = reinterpret_cast<Superblock*>(buffer);
+    if (superblock->magic != MAGIC ||
+        superblock->version != VERSION ||
+        superblock->crc != storage_at_crc32c(buffer, offsetof(Superblock, crc)) ||
+        superblock->sectorSize != getSectorSize() ||
+        superblock->sectorsCount != m_counters.size()
+    ) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    // The counters are read sequentially by one request
+    uint32_t len = static_cast<uint32_t>(m_counters.size() * sizeof(uint32_t));
+    std::unique_ptr<uint8_t[]> counters = std::make_unique<uint8_t[]>(getCountersSize());
+    StorageIOVec vec = { m_address + STORAGE_PAGE_SIZE, counters.get(), getCountersSize() };
+    status = len ? AT::driverReadv(&vec, 1) : STORAGE_OK;
+    if (status == STORAGE_BUSY) {
+        return status;
+    }
+    if (status != STORAGE_OK || storage_at_crc32c(counters.get(), len) != superblock->countersCRC) {
+        return STORAGE_NOT_FOUND;
+    }
+
+    memcpy(reinterpret_cast<void*>(m_counters.data()), counters.get(), len);
+
+    return STORAGE_OK;
+}
+
+StorageStatus StorageWear::save()
+{
+    m_counters.resize(getSectorsCount(), 0);
+
+    uint32_t len = static_cast<uint32_t>(m_counters.size() * sizeof(uint32_t));
+    std::unique_ptr<uint8_t[]> counters = std::make_unique<uint8_t[]>(getCountersSize());
+    memset(counters.get(), 0, getCountersSize());
+    memcpy(counters.get(), reinterpret_cast<void*>(m_counters.data()), len);
+
+    // The counters pages are written by one vectored request if the driver supports it
+    uint32_t pagesCount = getCountersSize() / STORAGE_PAGE_SIZE;
+    std::vector<StorageIOVec> vec(pagesCount);
+    for (uint32_t i = 0; i < pagesCount; i++) {
+        vec[i] = { m_address + (i + 1) * STORAGE_PAGE_SIZE, counters.get() + i * STORAGE_PAGE_SIZE, STORAGE_PAGE_SIZE };
+    }
+    StorageStatus status = pagesCount ? AT::driverWritev(vec.data(), pagesCount) : STORAGE_OK;
+    if (status != STORAGE_OK) {
+        return status;
+    }
+
+    uint8_t buffer[STORAGE_PAGE_SIZE] = {};
+    Superblock* superblock = reinterpret_cast<Superblock*>(buffer);
+    superblock->magic        = MAGIC;
+    superblock->version      = VERSION;
+    superblock->sectorSize   = getSectorSize();
+    superblock->sectorsCount = static_cast<uint32_t>(m_counters.size());
+    superblock->countersCRC  = storage_at_crc32c(counters.get(), len);
+    superblock->crc          = storage_at_crc32c(buffer, offsetof(Superblock, crc));
+
+    return AT::driverWrite(m_address, buffer, sizeof(buffer));
+}
+
+void StorageWear::registrate(const uint32_t* addresses, const uint32_t count)
+{
+    // The erased pages of one sector may be listed in any order
+    std::vector<uint32_t> sectors(count);
+    for (uint32_t i = 0; i < count; i++) {
+        sectors[i] = getSectorIndex(addresses[i]);
+    }
+    std::sort(sectors.begin(), sectors.end());
+    sectors.erase(std::unique(sectors.begin(), sectors.end()), sectors.end());
+
+    for (uint32_t sectorIndex : sectors) {
+        if (sectorIndex >= m_counters.size()) {
+            m_counters.resize(sectorIndex + 1, 0);
+        }
+        m_counters[sectorIndex]++;
+    }
+}
+
+uint32_t StorageWear::getEraseCount(uint32_t sectorIndex)
+{
+    return sectorIndex < m_counters.size() ? m_counters[sectorIndex] : 0;
+}
@@ -3,12 +3,17 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
 #include "StorageAT.h"
+#include "StorageCRC.h"
 #include "StorageEmulator.h"
+#include "StorageOperation.h"
 
 
 const int SECTORS_COUNT = 20;
@@ -138,10 +143,95 @@ TEST(StorageTypeSuite, Pack)
 
 TEST(PageSuite, Struct)
 {
-    ASSERT_EQ(sizeof(struct _PageMeta), 20);
+    ASSERT_EQ(STORAGE_PAGE_META_SIZE_V6, 20);
+#ifdef STORAGE_PAGE_META_CRC
+    ASSERT_EQ(sizeof(struct _PageMeta), STORAGE_PAGE_META_SIZE_V6 + sizeof(uint16_t));
+#else
+    ASSERT_EQ(sizeof(struct _PageMeta), STORAGE_PAGE_META_SIZE_V6);
+#endif
     ASSERT_EQ(sizeof(struct _PageStruct), PAGE_LEN);
 }
 
+uint16_t referenceCRC16(const uint8_t* buf, uint16_t len)
+{
+    uint16_t crc = 0;
+    for (uint16_t i = 1; i < len; i++) {
+        crc  = static_cast<uint16_t>((crc >> 8) | (crc << 8));
+        crc ^= static_cast<uint16_t>(buf[i]);
+        crc ^= static_cast<uint16_t>((crc & 0xFF) >> 4);
+        crc ^= static_cast<uint16_t>((crc << 8) << 4);
+        crc ^= static_cast<uint16_t>(((crc & 0xff) << 4) << 1);
+    }
+    return crc;
+}
+
+TEST(PageSuite, CRC16)
+{
+    uint8_t buf[STORAGE_PAGE_SIZE] = {};
+    const char check[] = "_123456789";
+
+    ASSERT_EQ(storage_at_crc16(reinterpret_cast<const uint8_t*>(check), sizeof(check) - 1), 0x31C3);
+    ASSERT_EQ(storage_at_crc16(buf, 0), 0);
+    ASSERT_EQ(storage_at_crc16(buf, 1), 0);
+
+    srand(1);
+    for (unsigned i = 0; i < 1000; i++) {
+        for (unsigned j = 0; j < sizeof(buf); j++) {
+            buf[j] = static_cast<uint8_t>(rand());
+        }
+        uint16_t len = static_cast<uint16_t>(rand() % (sizeof(buf) + 1));
+        ASSERT_EQ(storage_at_crc16(buf, len), referenceCRC16(buf, len));
+    }
+
+    const unsigned iterations = 20000;
+    volatile uint16_t result = 0;
+    std::chrono::nanoseconds time[2] = {};
+    for (bool table : { false, true }) {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; i++) {
+            buf[i % sizeof(buf)] = static_cast<uint8_t>(i);
+            result = table ? storage_at_crc16(buf, sizeof(buf) - sizeof(uint16_t)) :
+                             referenceCRC16(buf, sizeof(buf) - sizeof(uint16_t));
+        }
+        time[table] = std::chrono::steady_clock::now() - start;
+    }
+    (void)result;
+
+    std::cout << "CRC16 page checksum: bitwise " << time[false].count() / iterations << "ns, "
+              << "storage_at_crc16 " << time[true].count() / iterations << "ns" << std::endl;
+}
+
+uint32_t referenceCRC32C(const uint8_t* buf, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (unsigned bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+TEST(PageSuite, CRC32C)
+{
+    uint8_t buf[STORAGE_PAGE_SIZE + 7] = {};
+    const char check[] = "123456789";
+
+    ASSERT_EQ(storage_at_crc32c(reinterpret_cast<const uint8_t*>(check), sizeof(check) - 1), 0xE3069283);
+    ASSERT_EQ(storage_at_crc32c(buf, 0), 0);
+
+    srand(2);
+    for (unsigned i = 0; i < 1000; i++) {
+        for (unsigned j = 0; j < sizeof(buf); j++) {
+            buf[j] = static_cast<uint8_t>(rand());
+        }
+        uint32_t offset = static_cast<uint32_t>(rand() % 8);
+        uint32_t len = static_cast<uint32_t>(rand() % (STORAGE_PAGE_SIZE + 1));
+        ASSERT_EQ(storage_at_crc32c(buf + offset, len), referenceCRC32C(buf + offset, len));
+    }
+}
+
 TEST(HeaderSuite, Struct)
 {
     ASSERT_EQ(sizeof(struct Header::_MetaUnit), 7);
@@ -1135,6 +1225,17 @@ TEST_F(StorageFixture, ChangePagesCount)
     address += STORAGE_PAGE_SIZE;
     ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata, sizeof(wdata)), STORAGE_OOM);
     ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OOM);
+
+    // The pages count of the instance is changed, not the pages count of the bound instance
+    StorageAT other(storage.getPagesCount(), &driver, minMemoryEraseSize);
+    other.bind();
+    storage.clear();
+    sat->setPagesCount(storage.getPagesCount());
+    ASSERT_EQ(sat->save(address, shortPrefix, 2, wdata, sizeof(wdata)), STORAGE_OK);
+    other.setPagesCount(0);
+    ASSERT_EQ(StorageAT::getStoragePagesCount(), 0);
+    ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, sizeof(wdata)));
 }
 
 TEST_F(StorageFixture, DeleteExistingData) {
@@ -1333,6 +1434,2210 @@ TEST_F(StorageFixture, FillMemoryWithLongDataBreakFirstPayloadAndDeleteSaveNew)
     delete[] longData;
 }
 
+TEST_F(StorageFixture, IndexFindEqual)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE * 2] = { 1, 2, 3, 4, 5 };
+    uint32_t savedAddress[4] = {};
+
+    for (unsigned i = 0; i < 4; i++) {
+        ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &savedAddress[i]), STORAGE_OK);
+        ASSERT_EQ(sat->save(savedAddress[i], shortPrefix, i + 1, wdata, sizeof(wdata)), STORAGE_OK);
+    }
+
+    ASSERT_EQ(sat->enableIndex(), STORAGE_OK);
+
+    // Index requests do not touch the memory
+    storage.setBusy(true);
+    for (unsigned i = 0; i < 4; i++) {
+        ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, i + 1), STORAGE_OK);
+        ASSERT_EQ(address, savedAddress[i]);
+    }
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 5), STORAGE_NOT_FOUND);
+    storage.setBusy(false);
+
+    sat->disableIndex();
+    for (unsigned i = 0; i < 4; i++) {
+        ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, i + 1), STORAGE_OK);
+        ASSERT_EQ(address, savedAddress[i]);
+    }
+}
+
+TEST_F(StorageFixture, IndexUpdate)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    uint8_t rdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 0 };
+    uint32_t emptyAddress = 0;
+
+    ASSERT_EQ(sat->enableIndex(), STORAGE_OK);
+
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &emptyAddress), STORAGE_OK);
+    ASSERT_EQ(sat->save(emptyAddress, shortPrefix, 1, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(address, emptyAddress);
+
+    ASSERT_EQ(sat->rewrite(emptyAddress, shortPrefix, 2, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_OK);
+    ASSERT_EQ(address, emptyAddress);
+    ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, sizeof(wdata)));
+
+    ASSERT_EQ(sat->deleteData(shortPrefix, 2), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_NOT_FOUND);
+
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &emptyAddress), STORAGE_OK);
+    ASSERT_EQ(sat->save(emptyAddress, shortPrefix, 3, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(sat->clearAddress(emptyAddress), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 3), STORAGE_NOT_FOUND);
+
+    ASSERT_EQ(sat->save(emptyAddress, shortPrefix, 4, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 4), STORAGE_NOT_FOUND);
+}
+
+TEST_F(StorageFixture, IndexSkipsBlockedStartPage)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE * 2] = { 1, 2, 3, 4, 5 };
+    address = StorageMacroblock::RESERVED_PAGES_COUNT * STORAGE_PAGE_SIZE;
+    uint32_t tmpAddress = 0;
+
+    ASSERT_EQ(sat->enableIndex(), STORAGE_OK);
+
+    storage.setBlocked(address, true);
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &tmpAddress, shortPrefix, 1), STORAGE_OK);
+    ASSERT_NE(address, tmpAddress);
+
+    sat->disableIndex();
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(address, tmpAddress);
+}
+
+TEST_F(StorageFixture, IndexFindOrdered)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    const uint32_t ids[] = { 40, 7, 1000, 15, 3, 999 };
+    const StorageFindMode modes[] = { FIND_MODE_NEXT, FIND_MODE_MIN, FIND_MODE_MAX };
+    const uint32_t targetIds[] = { 0, 3, 7, 16, 999, 1000, 2000 };
+
+    for (uint32_t id : ids) {
+        ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+        ASSERT_EQ(sat->save(address, shortPrefix, id, wdata, sizeof(wdata)), STORAGE_OK);
+    }
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, "abc", 5000, wdata, sizeof(wdata)), STORAGE_OK);
+
+    for (StorageFindMode mode : modes) {
+        for (uint32_t targetId : targetIds) {
+            uint32_t scanAddress = 0;
+            uint32_t indexAddress = 0;
+
+            sat->disableIndex();
+            StorageStatus scanStatus = sat->find(mode, &scanAddress, shortPrefix, targetId);
+            ASSERT_EQ(sat->enableIndex(), STORAGE_OK);
+            storage.setBusy(true);
+            StorageStatus indexStatus = sat->find(mode, &indexAddress, shortPrefix, targetId);
+            storage.setBusy(false);
+
+            ASSERT_EQ(scanStatus, indexStatus);
+            if (scanStatus == STORAGE_OK) {
+                ASSERT_EQ(scanAddress, indexAddress);
+            }
+        }
+    }
+
+    uint32_t maxAddress = 0;
+    ASSERT_EQ(sat->deleteData(shortPrefix, 1000), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_MAX, &maxAddress, shortPrefix), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 999), STORAGE_OK);
+    ASSERT_EQ(maxAddress, address);
+    ASSERT_EQ(sat->find(FIND_MODE_NEXT, &address, shortPrefix, 999), STORAGE_NOT_FOUND);
+}
+
+unsigned getHeaderReadsCount()
+{
+    unsigned count = 0;
+    for (unsigned i = 0; i < storage.getPagesCount(); i++) {
+        if (i % StorageMacroblock::PAGES_COUNT < StorageMacroblock::RESERVED_PAGES_COUNT) {
+            count += storage.requestsCount[i].read;
+        }
+    }
+    return count;
+}
+
+TEST_F(StorageFixture, IndexTargetedDelete)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * (Header::PAGES_COUNT + 4);
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+    memset(wdata.get(), 0x3C, dataLen);
+
+    // The data takes two macroblocks
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+
+    unsigned startReads = getHeaderReadsCount();
+    ASSERT_EQ(sat->rewrite(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+    unsigned fullReads = getHeaderReadsCount() - startReads;
+
+    ASSERT_EQ(sat->enableIndex(), STORAGE_OK);
+    startReads = getHeaderReadsCount();
+    ASSERT_EQ(sat->rewrite(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+    unsigned targetedReads = getHeaderReadsCount() - startReads;
+
+    ASSERT_LT(targetedReads, fullReads);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(sat->load(address, rdata.get(), dataLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+
+    // No header keeps the removed data pages
+    ASSERT_EQ(sat->deleteData(shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_NOT_FOUND);
+    sat->disableIndex();
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_NOT_FOUND);
+    for (uint32_t i = 0; i < StorageMacroblock::getMacroblocksCount(); i++) {
+        Header header(StorageMacroblock::getMacroblockAddress(i));
+        ASSERT_EQ(header.load(), STORAGE_OK);
+        for (uint32_t j = 0; j < Header::PAGES_COUNT; j++) {
+            ASSERT_FALSE(header.isSameMeta(j, reinterpret_cast<const uint8_t*>(shortPrefix), 1));
+        }
+    }
+}
+
+TEST_F(StorageFixture, HeaderCacheReducesHeaderReads)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * (Header::PAGES_COUNT + 4);
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+    memset(wdata.get(), 0x5A, dataLen);
+
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    unsigned startReads = getHeaderReadsCount();
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+    unsigned uncachedReads = getHeaderReadsCount() - startReads;
+
+    storage.clear();
+    ASSERT_EQ(sat->setHeaderCacheSize(StorageMacroblock::getMacroblocksCount()), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    startReads = getHeaderReadsCount();
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+    unsigned cachedReads = getHeaderReadsCount() - startReads;
+
+    ASSERT_LT(cachedReads, uncachedReads);
+    ASSERT_EQ(sat->load(address, rdata.get(), dataLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+
+    // Changed headers are saved at the end of the operation
+    Header header(address);
+    ASSERT_EQ(header.load(), STORAGE_OK);
+    ASSERT_TRUE(header.isSameMeta(StorageMacroblock::getPageIndexByAddress(address), reinterpret_cast<const uint8_t*>(shortPrefix), 1));
+
+    ASSERT_EQ(sat->setHeaderCacheSize(0), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(sat->load(address, rdata.get(), dataLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+}
+
+TEST_F(StorageFixture, HeaderCacheEviction)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    uint8_t rdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 0 };
+
+    ASSERT_EQ(sat->setHeaderCacheSize(1), STORAGE_OK);
+    for (uint32_t i = 0; i < 3; i++) {
+        address = StorageMacroblock::getPageAddressByIndex(i, 0);
+        ASSERT_EQ(sat->save(address, shortPrefix, i + 1, wdata, sizeof(wdata)), STORAGE_OK);
+    }
+    for (uint32_t i = 0; i < 3; i++) {
+        ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, i + 1), STORAGE_OK);
+        ASSERT_EQ(address, StorageMacroblock::getPageAddressByIndex(i, 0));
+        ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+        ASSERT_FALSE(memcmp(wdata, rdata, sizeof(wdata)));
+    }
+    ASSERT_EQ(sat->deleteData(shortPrefix, 2), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_NOT_FOUND);
+
+    ASSERT_EQ(sat->setHeaderCacheSize(0), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_NOT_FOUND);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 3), STORAGE_OK);
+}
+
+TEST_F(StorageFixture, HeaderCacheSkipsFailedHeaderSave)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    const uint8_t* prefix = reinterpret_cast<const uint8_t*>(shortPrefix);
+
+    ASSERT_EQ(sat->setHeaderCacheSize(StorageMacroblock::getMacroblocksCount()), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata, sizeof(wdata)), STORAGE_OK);
+    uint32_t pageIndex = StorageMacroblock::getPageIndexByAddress(address);
+
+    // The formatted header is not written, so the memory header is not replaced in the cache
+    for (unsigned i = 0; i < StorageMacroblock::RESERVED_PAGES_COUNT * STORAGE_PAGE_SIZE; i++) {
+        storage.setBlocked(i, true);
+    }
+    sat->format();
+
+    Header memoryHeader(address);
+    Header cachedHeader(address);
+    ASSERT_EQ(memoryHeader.load(), STORAGE_OK);
+    ASSERT_EQ(StorageMacroblock::loadHeader(&cachedHeader), STORAGE_OK);
+    ASSERT_TRUE(memoryHeader.isSameMeta(pageIndex, prefix, 1));
+    ASSERT_TRUE(cachedHeader.isSameMeta(pageIndex, prefix, 1));
+
+    ASSERT_EQ(sat->setHeaderCacheSize(0), STORAGE_OK);
+}
+
+TEST_F(StorageFixture, AllocatorFindEmpty)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    const uint32_t pagesCount = StorageMacroblock::getMacroblocksCount() * Header::PAGES_COUNT;
+
+    ASSERT_EQ(sat->enableAllocator(), STORAGE_OK);
+    ASSERT_EQ(sat->allocator()->getFreePagesCount(), pagesCount);
+
+    for (uint32_t i = 0; i < pagesCount; i++) {
+        uint32_t scanAddress = 0;
+        uint32_t allocatorAddress = 0;
+
+        sat->disableAllocator();
+        ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &scanAddress), STORAGE_OK);
+        ASSERT_EQ(sat->enableAllocator(), STORAGE_OK);
+        storage.setBusy(true);
+        ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &allocatorAddress), STORAGE_OK);
+        storage.setBusy(false);
+        ASSERT_EQ(scanAddress, allocatorAddress);
+
+        ASSERT_EQ(sat->save(allocatorAddress, shortPrefix, i + 1, wdata, sizeof(wdata)), STORAGE_OK);
+        ASSERT_EQ(sat->allocator()->getFreePagesCount(), pagesCount - i - 1);
+    }
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_NOT_FOUND);
+
+    ASSERT_EQ(sat->deleteData(shortPrefix, 2), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(address, StorageMacroblock::getPageAddressByIndex(0, 1));
+}
+
+TEST_F(StorageFixture, AllocatorReducesHeaderReads)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * (Header::PAGES_COUNT + 4);
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+    memset(wdata.get(), 0x3C, dataLen);
+
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    unsigned startReads = getHeaderReadsCount();
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+    unsigned scanReads = getHeaderReadsCount() - startReads;
+
+    storage.clear();
+    ASSERT_EQ(sat->enableAllocator(), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    startReads = getHeaderReadsCount();
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+    unsigned allocatorReads = getHeaderReadsCount() - startReads;
+
+    EXPECT_LT(allocatorReads, scanReads);
+
+    ASSERT_EQ(sat->load(address, rdata.get(), dataLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+}
+
+TEST_F(StorageFixture, AllocatorFindFreeRun)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    StorageAllocator allocator;
+
+    ASSERT_EQ(sat->save(StorageMacroblock::getPageAddressByIndex(0, 2), shortPrefix, 1, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(sat->save(StorageMacroblock::getPageAddressByIndex(0, 6), shortPrefix, 2, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(allocator.build(), STORAGE_OK);
+
+    ASSERT_EQ(allocator.findFreeRun(0, 0, &address), STORAGE_NOT_FOUND);
+    ASSERT_EQ(allocator.findFreeRun(0, Header::PAGES_COUNT + 1, &address), STORAGE_NOT_FOUND);
+
+    ASSERT_EQ(allocator.findFreeRun(0, 2, &address), STORAGE_OK);
+    ASSERT_EQ(address, StorageMacroblock::getPageAddressByIndex(0, 0));
+    ASSERT_EQ(allocator.findFreeRun(0, 3, &address), STORAGE_OK);
+    ASSERT_EQ(address, StorageMacroblock::getPageAddressByIndex(0, 3));
+    ASSERT_EQ(allocator.findFreeRun(0, Header::PAGES_COUNT - 7, &address), STORAGE_OK);
+    ASSERT_EQ(address, StorageMacroblock::getPageAddressByIndex(0, 7));
+    ASSERT_EQ(allocator.findFreeRun(0, Header::PAGES_COUNT - 6, &address), STORAGE_OK);
+    ASSERT_EQ(address, StorageMacroblock::getPageAddressByIndex(1, 0));
+}
+
+class VectoredStorageDriver: public StorageDriver
+{
+public:
+    unsigned requestsCount = 0;
+
+    StorageStatus read(const uint32_t address, uint8_t* data, const uint32_t len) override
+    {
+        requestsCount++;
+        return StorageDriver::read(address, data, len);
+    }
+    StorageStatus write(const uint32_t address, const uint8_t* data, const uint32_t len) override
+    {
+        requestsCount++;
+        return StorageDriver::write(address, data, len);
+    }
+    StorageStatus erase(const uint32_t* addresses, const uint32_t count) override
+    {
+        requestsCount++;
+        return StorageDriver::erase(addresses, count);
+    }
+    // The emulator memory is accessed by pages in one driver request
+    StorageStatus readv(const StorageIOVec* vec, const uint32_t count) override
+    {
+        requestsCount++;
+        for (uint32_t i = 0; i < count; i++) {
+            for (uint32_t offset = 0; offset < vec[i].len; offset += STORAGE_PAGE_SIZE) {
+                uint32_t len = std::min(vec[i].len - offset, static_cast<uint32_t>(STORAGE_PAGE_SIZE));
+                StorageStatus status = StorageDriver::read(vec[i].address + offset, vec[i].data + offset, len);
+                if (status != STORAGE_OK) {
+                    return status;
+                }
+            }
+        }
+        return STORAGE_OK;
+    }
+    StorageStatus writev(const StorageIOVec* vec, const uint32_t count) override
+    {
+        requestsCount++;
+        for (uint32_t i = 0; i < count; i++) {
+            for (uint32_t offset = 0; offset < vec[i].len; offset += STORAGE_PAGE_SIZE) {
+                uint32_t len = std::min(vec[i].len - offset, static_cast<uint32_t>(STORAGE_PAGE_SIZE));
+                StorageStatus status = StorageDriver::write(vec[i].address + offset, vec[i].data + offset, len);
+                if (status != STORAGE_OK) {
+                    return status;
+                }
+            }
+        }
+        return STORAGE_OK;
+    }
+    uint32_t capabilities() override
+    {
+        return vectored ? STORAGE_DRIVER_CAP_READV | STORAGE_DRIVER_CAP_WRITEV : STORAGE_DRIVER_CAP_NONE;
+    }
+
+    bool vectored = true;
+};
+
+TEST_F(StorageFixture, AllocatorContiguousExtents)
+{
+    const uint32_t dataPagesCount = 5;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * dataPagesCount;
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    std::unique_ptr<uint8_t[]> wlongData = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rlongData = std::make_unique<uint8_t[]>(dataLen);
+    const uint32_t scatteredPages[] = { 0, 2, 4, 6, 8 };
+    const uint32_t contiguousPages[] = { 0, 8, 9, 10, 11 };
+    VectoredStorageDriver vectoredDriver;
+    unsigned readsCount[2][2] = {};
+
+    for (uint32_t i = 0; i < dataLen; i++) {
+        wlongData[i] = static_cast<uint8_t>(i);
+    }
+
+    // The driver without readv gets the contiguous data page by page
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &vectoredDriver, minMemoryEraseSize);
+    sat->bind();
+    for (bool vectored : { false, true }) {
+        for (bool contiguous : { false, true }) {
+            storage.clear();
+            vectoredDriver.vectored = vectored;
+            ASSERT_EQ(sat->enableAllocator(contiguous), STORAGE_OK);
+            ASSERT_EQ(sat->allocator()->isContiguous(), contiguous);
+            for (uint32_t pageIndex = 1; pageIndex < 8; pageIndex += 2) {
+                address = StorageMacroblock::getPageAddressByIndex(0, pageIndex);
+                ASSERT_EQ(sat->save(address, shortPrefix, pageIndex, wdata, sizeof(wdata)), STORAGE_OK);
+            }
+
+            ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+            ASSERT_EQ(address, StorageMacroblock::getPageAddressByIndex(0, 0));
+            ASSERT_EQ(sat->save(address, "abc", 1, wlongData.get(), dataLen), STORAGE_OK);
+
+            const uint32_t* expectedPages = contiguous ? contiguousPages : scatteredPages;
+            Page page(address);
+            ASSERT_EQ(page.load(/*startPage=*/true), STORAGE_OK);
+            for (uint32_t i = 0; i < dataPagesCount; i++) {
+                ASSERT_EQ(page.getAddress(), StorageMacroblock::getPageAddressByIndex(0, expectedPages[i]));
+                if (i + 1 < dataPagesCount) {
+                    ASSERT_EQ(page.loadNext(), STORAGE_OK);
+                }
+            }
+            ASSERT_TRUE(page.isEnd());
+
+            vectoredDriver.requestsCount = 0;
+            memset(rlongData.get(), 0, dataLen);
+            ASSERT_EQ(sat->load(address, rlongData.get(), dataLen), STORAGE_OK);
+            ASSERT_FALSE(memcmp(wlongData.get(), rlongData.get(), dataLen));
+            readsCount[vectored][contiguous] = vectoredDriver.requestsCount;
+        }
+    }
+
+    EXPECT_EQ(readsCount[true][true], 2);
+    EXPECT_LT(readsCount[true][true], readsCount[true][false]);
+    EXPECT_LT(readsCount[true][true], readsCount[false][true]);
+}
+
+TEST_F(StorageFixture, VectoredDriverSaveLoad)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * (Header::PAGES_COUNT + 4);
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+    VectoredStorageDriver vectoredDriver;
+    unsigned requestsCount[2] = {};
+
+    for (uint32_t i = 0; i < dataLen; i++) {
+        wdata[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &vectoredDriver, minMemoryEraseSize);
+    sat->bind();
+    for (bool vectored : { false, true }) {
+        storage.clear();
+        vectoredDriver.vectored = vectored;
+        vectoredDriver.requestsCount = 0;
+
+        ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+        ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+        memset(rdata.get(), 0, dataLen);
+        ASSERT_EQ(sat->load(address, rdata.get(), dataLen), STORAGE_OK);
+        ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+
+        requestsCount[vectored] = vectoredDriver.requestsCount;
+    }
+
+    EXPECT_LT(requestsCount[true] * 2, requestsCount[false]);
+}
+
+TEST_F(StorageFixture, VectoredDriverFormat)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    VectoredStorageDriver vectoredDriver;
+
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &vectoredDriver, minMemoryEraseSize);
+    sat->bind();
+    for (uint32_t i = 0; i < StorageMacroblock::getMacroblocksCount(); i++) {
+        address = StorageMacroblock::getPageAddressByIndex(i, i % Header::PAGES_COUNT);
+        ASSERT_EQ(sat->save(address, shortPrefix, i + 1, wdata, sizeof(wdata)), STORAGE_OK);
+    }
+
+    vectoredDriver.requestsCount = 0;
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+    EXPECT_LT(vectoredDriver.requestsCount, StorageMacroblock::getMacroblocksCount() * 2);
+
+    for (uint32_t i = 0; i < StorageMacroblock::getMacroblocksCount(); i++) {
+        ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, i + 1), STORAGE_NOT_FOUND);
+    }
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(address, StorageMacroblock::getPageAddressByIndex(0, 0));
+}
+
+#if STORAGE_VERSION != STORAGE_VERSION_V6
+void writeV6Page(uint32_t address, PageMeta meta, const uint8_t* payload)
+{
+    uint8_t raw[STORAGE_PAGE_SIZE] = {};
+    uint16_t crc = 0;
+
+    meta.magic   = STORAGE_MAGIC;
+    meta.version = STORAGE_VERSION_V6;
+    memcpy(raw, &meta, STORAGE_PAGE_META_SIZE_V6);
+    memcpy(raw + STORAGE_PAGE_META_SIZE_V6, payload, STORAGE_PAGE_PAYLOAD_SIZE_V6);
+    crc = storage_at_crc16(raw, sizeof(raw) - sizeof(crc));
+    memcpy(raw + sizeof(raw) - sizeof(crc), &crc, sizeof(crc));
+
+    storage.writePage(address, raw, sizeof(raw));
+}
+
+uint8_t readPageVersion(uint32_t address)
+{
+    PageStruct raw = {};
+    storage.readPage(address, reinterpret_cast<uint8_t*>(&raw), sizeof(raw));
+    return raw.header.version;
+}
+
+TEST_F(StorageFixture, MigrateV6Pages)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE_V6 * 2;
+    uint8_t wdata[dataLen] = {};
+    uint8_t rdata[dataLen] = {};
+    uint8_t payload[STORAGE_PAGE_PAYLOAD_SIZE_V6] = {};
+    uint32_t headerAddress = StorageMacroblock::getMacroblockAddress(0);
+    uint32_t dataAddress[2] = {
+        StorageMacroblock::getPageAddressByIndex(0, 0),
+        StorageMacroblock::getPageAddressByIndex(0, 1),
+    };
+
+    for (uint32_t i = 0; i < dataLen; i++) {
+        wdata[i] = static_cast<uint8_t>(i * 3);
+    }
+
+    Header header(headerAddress);
+    for (uint32_t i = 0; i < Header::PAGES_COUNT; i++) {
+        header.setPageStatus(i, i < 2 ? Header::PAGE_OK : Header::PAGE_EMPTY);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        memcpy(header.data->metaUnits[i].prefix, shortPrefix, STORAGE_PAGE_PREFIX_SIZE);
+        header.data->metaUnits[i].id = 1;
+    }
+    memcpy(payload, header.page.payload, sizeof(header.page.payload));
+    writeV6Page(headerAddress, header.page.header, payload);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        PageMeta meta = {};
+        memcpy(meta.prefix, shortPrefix, STORAGE_PAGE_PREFIX_SIZE);
+        meta.id        = 1;
+        meta.prev_addr = dataAddress[0];
+        meta.next_addr = dataAddress[1];
+        writeV6Page(dataAddress[i], meta, wdata + i * STORAGE_PAGE_PAYLOAD_SIZE_V6);
+    }
+
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &driver, minMemoryEraseSize);
+    sat->bind();
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(address, dataAddress[0]);
+    ASSERT_EQ(sat->load(address, rdata, dataLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, dataLen));
+
+    EXPECT_EQ(readPageVersion(headerAddress), STORAGE_VERSION);
+    EXPECT_EQ(readPageVersion(dataAddress[0]), STORAGE_VERSION_V6);
+
+    ASSERT_EQ(sat->rewrite(address, shortPrefix, 1, wdata, dataLen), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    EXPECT_EQ(readPageVersion(address), STORAGE_VERSION);
+    memset(rdata, 0, dataLen);
+    ASSERT_EQ(sat->load(address, rdata, dataLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, dataLen));
+}
+#endif
+
+class CountingStorageDriver: public StorageDriver
+{
+public:
+    uint32_t readBytes = 0;
+    bool     dropWrites = false;
+
+    StorageStatus read(const uint32_t address, uint8_t* data, const uint32_t len) override
+    {
+        readBytes += len;
+        return StorageDriver::read(address, data, len);
+    }
+    StorageStatus write(const uint32_t address, const uint8_t* data, const uint32_t len) override
+    {
+        if (dropWrites) {
+            return STORAGE_OK;
+        }
+        return StorageDriver::write(address, data, len);
+    }
+};
+
+TEST_F(StorageFixture, VerifyPolicyBenchmark)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 8;
+    const uint32_t dataCount = 8;
+    const StorageVerifyPolicy policies[] = {
+        STORAGE_VERIFY_FULL,
+        STORAGE_VERIFY_SKIP_EMPTY,
+        STORAGE_VERIFY_CRC,
+        STORAGE_VERIFY_NONE,
+    };
+    const char* names[] = { "full", "skip empty", "crc", "none" };
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+    CountingStorageDriver countingDriver;
+    uint32_t readBytes[4] = {};
+
+    for (uint32_t i = 0; i < dataLen; i++) {
+        wdata[i] = static_cast<uint8_t>(i * 11);
+    }
+
+    for (unsigned i = 0; i < 4; i++) {
+        storage.clear();
+        sat = std::make_unique<StorageAT>(storage.getPagesCount(), &countingDriver, minMemoryEraseSize);
+        sat->bind();
+        sat->setVerifyPolicy(policies[i]);
+        countingDriver.readBytes = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t id = 1; id <= dataCount; id++) {
+            ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+            ASSERT_EQ(sat->save(address, shortPrefix, id, wdata.get(), dataLen), STORAGE_OK);
+        }
+        auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        readBytes[i] = countingDriver.readBytes;
+
+        std::cout << "Verify policy " << names[i] << ": " << time.count() << "us, "
+                  << readBytes[i] << " bytes read for " << dataLen * dataCount << " bytes saved" << std::endl;
+
+        for (uint32_t id = 1; id <= dataCount; id++) {
+            memset(rdata.get(), 0, dataLen);
+            ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, id), STORAGE_OK);
+            ASSERT_EQ(sat->load(address, rdata.get(), dataLen), STORAGE_OK);
+            ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+        }
+    }
+
+    EXPECT_LT(readBytes[1], readBytes[0]);
+    EXPECT_LT(readBytes[2], readBytes[1]);
+    EXPECT_LT(readBytes[3], readBytes[2]);
+}
+
+TEST_F(StorageFixture, VerifyPolicyLostWrite)
+{
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = { 1, 2, 3, 4, 5 };
+    CountingStorageDriver countingDriver;
+    Page page(StorageMacroblock::getPageAddressByIndex(0, 0));
+
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &countingDriver, minMemoryEraseSize);
+    sat->bind();
+    memcpy(page.page.payload, wdata, sizeof(wdata));
+    countingDriver.dropWrites = true;
+
+    for (StorageVerifyPolicy policy : { STORAGE_VERIFY_FULL, STORAGE_VERIFY_SKIP_EMPTY, STORAGE_VERIFY_CRC }) {
+        sat->setVerifyPolicy(policy);
+        ASSERT_EQ(page.save(), STORAGE_ERROR);
+        ASSERT_EQ(page.saveEmpty(), STORAGE_ERROR);
+    }
+
+    sat->setVerifyPolicy(STORAGE_VERIFY_NONE);
+    ASSERT_EQ(page.save(), STORAGE_OK);
+    ASSERT_EQ(page.load(), STORAGE_ERROR);
+}
+
+class DeviceStorageDriver: public IStorageDriver
+{
+public:
+    StorageEmulator device;
+
+    DeviceStorageDriver(uint32_t pagesCount): device(pagesCount) {}
+
+    StorageStatus read(const uint32_t address, uint8_t* data, const uint32_t len) override
+    {
+        return device.readPage(address, data, len) == EMULATOR_OK ? STORAGE_OK : STORAGE_ERROR;
+    }
+    StorageStatus write(const uint32_t address, const uint8_t* data, const uint32_t len) override
+    {
+        return device.writePage(address, data, len) == EMULATOR_OK ? STORAGE_OK : STORAGE_ERROR;
+    }
+    StorageStatus erase(const uint32_t* addresses, const uint32_t count) override
+    {
+        return device.erase(addresses, count) == EMULATOR_OK ? STORAGE_OK : STORAGE_ERROR;
+    }
+};
+
+#ifndef STORAGE_NO_THREADS
+TEST_F(StorageFixture, MultipleInstances)
+{
+    const unsigned devicesCount = 4;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 3;
+    std::vector<std::unique_ptr<DeviceStorageDriver>> drivers;
+    std::vector<std::unique_ptr<StorageAT>> instances;
+    StorageStatus results[devicesCount] = {};
+
+    for (unsigned i = 0; i < devicesCount; i++) {
+        drivers.push_back(std::make_unique<DeviceStorageDriver>(StorageMacroblock::PAGES_COUNT * (i + 2)));
+        instances.push_back(std::make_unique<StorageAT>(drivers[i]->device.getPagesCount(), drivers[i].get(), minMemoryEraseSize));
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < devicesCount; i++) {
+        threads.emplace_back([&, i]() {
+            uint8_t wdata[dataLen] = {};
+            uint8_t rdata[dataLen] = {};
+            uint32_t address = 0;
+
+            results[i] = STORAGE_OK;
+            for (uint32_t id = 1; id <= 20 && results[i] == STORAGE_OK; id++) {
+                memset(wdata, static_cast<int>(i * 32 + id), sizeof(wdata));
+                results[i] = instances[i]->find(FIND_MODE_EMPTY, &address);
+                if (results[i] == STORAGE_OK) {
+                    results[i] = instances[i]->save(address, shortPrefix, id, wdata, sizeof(wdata));
+                }
+                if (results[i] == STORAGE_OK) {
+                    results[i] = instances[i]->find(FIND_MODE_EQUAL, &address, shortPrefix, id);
+                }
+                if (results[i] == STORAGE_OK) {
+                    results[i] = instances[i]->load(address, rdata, sizeof(rdata));
+                }
+                if (results[i] == STORAGE_OK && memcmp(wdata, rdata, sizeof(rdata))) {
+                    results[i] = STORAGE_ERROR;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (unsigned i = 0; i < devicesCount; i++) {
+        ASSERT_EQ(results[i], STORAGE_OK);
+
+        uint8_t rdata[dataLen] = {};
+        uint8_t wdata[dataLen] = {};
+        memset(wdata, static_cast<int>(i * 32 + 1), sizeof(wdata));
+        ASSERT_EQ(instances[i]->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+        ASSERT_EQ(instances[i]->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+        ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+        ASSERT_EQ(instances[i]->find(FIND_MODE_EQUAL, &address, shortPrefix, 21), STORAGE_NOT_FOUND);
+    }
+
+    // The calls outside of StorageAT use the bound instance only
+    instances[1]->bind();
+    ASSERT_EQ(StorageAT::getStoragePagesCount(), drivers[1]->device.getPagesCount());
+    instances[1].reset();
+    ASSERT_EQ(StorageAT::getStoragePagesCount(), 0);
+
+    // The other threads unbind the instance (or exit) before the instance destruction
+    std::thread([&]() {
+        instances[2]->bind();
+        results[2] = StorageAT::getStoragePagesCount() == drivers[2]->device.getPagesCount() ? STORAGE_OK : STORAGE_ERROR;
+        instances[2]->unbind();
+        results[3] = StorageAT::getStoragePagesCount() == 0 ? STORAGE_OK : STORAGE_ERROR;
+        instances[3]->bind();
+    }).join();
+    ASSERT_EQ(results[2], STORAGE_OK);
+    ASSERT_EQ(results[3], STORAGE_OK);
+    instances[2].reset();
+    instances[3].reset();
+}
+#endif
+
+unsigned getDeviceReadsCount(StorageEmulator& device)
+{
+    unsigned count = 0;
+    for (unsigned i = 0; i < device.getPagesCount(); i++) {
+        count += device.requestsCount[i].read;
+    }
+    return count;
+}
+
+TEST_F(StorageFixture, CheckpointFastMount)
+{
+    const uint32_t macroblocksCount = 8;
+    const uint32_t tablePagesCount = StorageMacroblock::PAGES_COUNT * macroblocksCount;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 3;
+    uint8_t wdata[dataLen] = {};
+    uint8_t rdata[dataLen] = {};
+
+    // The checkpoint region follows the allocation table
+    DeviceStorageDriver device(tablePagesCount + macroblocksCount + 1);
+    const uint32_t checkpointAddress = tablePagesCount * STORAGE_PAGE_SIZE;
+
+    std::unique_ptr<StorageAT> writer = std::make_unique<StorageAT>(tablePagesCount, &device, minMemoryEraseSize);
+    writer->bind();
+    ASSERT_LE(checkpointAddress + StorageAT::getCheckpointSize(), device.device.getSize());
+    ASSERT_EQ(writer->enableCheckpoint(checkpointAddress - STORAGE_PAGE_SIZE), STORAGE_ERROR);
+    ASSERT_EQ(writer->format(), STORAGE_OK);
+    ASSERT_EQ(writer->enableCheckpoint(checkpointAddress), STORAGE_NOT_FOUND);
+    for (uint32_t id = 1; id <= 10; id++) {
+        memset(wdata, static_cast<int>(id), sizeof(wdata));
+        ASSERT_EQ(writer->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+        ASSERT_EQ(writer->save(address, shortPrefix, id, wdata, sizeof(wdata)), STORAGE_OK);
+    }
+    ASSERT_EQ(writer->saveCheckpoint(), STORAGE_OK);
+
+    unsigned startReads = getDeviceReadsCount(device.device);
+    std::unique_ptr<StorageAT> cold = std::make_unique<StorageAT>(tablePagesCount, &device, minMemoryEraseSize);
+    ASSERT_EQ(cold->enableIndex(), STORAGE_OK);
+    ASSERT_EQ(cold->enableAllocator(), STORAGE_OK);
+    unsigned coldReads = getDeviceReadsCount(device.device) - startReads;
+
+    startReads = getDeviceReadsCount(device.device);
+    std::unique_ptr<StorageAT> warm = std::make_unique<StorageAT>(tablePagesCount, &device, minMemoryEraseSize);
+    ASSERT_EQ(warm->enableCheckpoint(checkpointAddress), STORAGE_OK);
+    ASSERT_EQ(warm->enableIndex(), STORAGE_OK);
+    ASSERT_EQ(warm->enableAllocator(), STORAGE_OK);
+    unsigned warmReads = getDeviceReadsCount(device.device) - startReads;
+
+    // Superblock, summary pages and header checksums
+    ASSERT_EQ(warmReads, StorageAT::getCheckpointSize() / STORAGE_PAGE_SIZE + macroblocksCount);
+    ASSERT_LT(warmReads, coldReads);
+    for (uint32_t id = 1; id <= 10; id++) {
+        memset(wdata, static_cast<int>(id), sizeof(wdata));
+        ASSERT_EQ(warm->find(FIND_MODE_EQUAL, &address, shortPrefix, id), STORAGE_OK);
+        ASSERT_EQ(warm->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+        ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+    }
+    uint32_t coldAddress = 0;
+    ASSERT_EQ(warm->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(cold->find(FIND_MODE_EMPTY, &coldAddress), STORAGE_OK);
+    ASSERT_EQ(address, coldAddress);
+
+    // The first change marks the checkpoint as stale until it is saved again
+    memset(wdata, 11, sizeof(wdata));
+    ASSERT_EQ(warm->save(address, shortPrefix, 11, wdata, sizeof(wdata)), STORAGE_OK);
+    std::unique_ptr<StorageAT> mount = std::make_unique<StorageAT>(tablePagesCount, &device, minMemoryEraseSize);
+    ASSERT_EQ(mount->enableCheckpoint(checkpointAddress), STORAGE_NOT_FOUND);
+    ASSERT_EQ(warm->saveCheckpoint(), STORAGE_OK);
+    ASSERT_EQ(mount->enableCheckpoint(checkpointAddress), STORAGE_OK);
+    ASSERT_EQ(mount->find(FIND_MODE_MAX, &address, shortPrefix), STORAGE_OK);
+    ASSERT_EQ(mount->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+
+    // The header checksums find the changes of an instance without the checkpoint
+    ASSERT_EQ(cold->deleteData(shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(mount->enableCheckpoint(checkpointAddress), STORAGE_NOT_FOUND);
+    ASSERT_EQ(mount->find(FIND_MODE_MIN, &address, shortPrefix), STORAGE_OK);
+    ASSERT_EQ(mount->find(FIND_MODE_EQUAL, &coldAddress, shortPrefix, 2), STORAGE_OK);
+    ASSERT_EQ(address, coldAddress);
+}
+
+TEST_F(StorageFixture, LazyHeaderRebuild)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE;
+    const uint32_t headerAddress = StorageMacroblock::getMacroblockAddress(0);
+    uint8_t wdata[dataLen] = {};
+    uint8_t rdata[dataLen] = {};
+    memset(wdata, 0x6B, sizeof(wdata));
+
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata, sizeof(wdata)), STORAGE_OK);
+    const uint32_t dataAddress = address;
+
+    // The broken header is served from the pages meta without the data chains walks
+    Header header(headerAddress);
+    storage.setByte(headerAddress, 0x00);
+    ASSERT_NE(header.load(), STORAGE_OK);
+    sat->enableLazyRebuild();
+    unsigned startReads = getDeviceReadsCount(storage);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    unsigned lazyReads = getDeviceReadsCount(storage) - startReads;
+    ASSERT_EQ(address, dataAddress);
+    ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+    ASSERT_EQ(sat->getRebuildQueueSize(), 1);
+    ASSERT_NE(header.load(), STORAGE_OK);
+
+    // The macroblock is read-only until the rebuild
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_NE(StorageMacroblock::getMacroblockIndex(address), 0);
+    ASSERT_EQ(sat->save(address, shortPrefix, 2, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(sat->rewrite(dataAddress, shortPrefix, 1, wdata, sizeof(wdata)), STORAGE_BUSY);
+
+    // The busy save to the read-only macroblock keeps the old data
+    uint8_t odata[dataLen] = {};
+    memset(odata, 0x1C, sizeof(odata));
+    ASSERT_EQ(sat->save(dataAddress, shortPrefix, 1, odata, sizeof(odata)), STORAGE_BUSY);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(address, dataAddress);
+    ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+
+    ASSERT_EQ(sat->rebuildHeaders(), STORAGE_OK);
+    ASSERT_EQ(sat->getRebuildQueueSize(), 0);
+    ASSERT_EQ(header.load(), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(StorageMacroblock::getMacroblockIndex(address), 0);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+
+    // The synchronous rebuild walks the data chains inside the search
+    sat->disableLazyRebuild();
+    storage.setByte(headerAddress, 0x00);
+    startReads = getDeviceReadsCount(storage);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    unsigned syncReads = getDeviceReadsCount(storage) - startReads;
+    ASSERT_LT(lazyReads, syncReads);
+
+    // The data of the read-only macroblock is removed without the header change
+    sat->enableLazyRebuild();
+    storage.setByte(headerAddress, 0x00);
+    ASSERT_EQ(sat->deleteData(shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_NOT_FOUND);
+    ASSERT_EQ(sat->rebuildHeaders(), STORAGE_OK);
+    ASSERT_EQ(sat->getRebuildQueueSize(), 0);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_NOT_FOUND);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_OK);
+}
+
+TEST_F(StorageFixture, HeaderRebuildChains)
+{
+    const uint32_t longLen = STORAGE_PAGE_PAYLOAD_SIZE * 20;
+    const uint32_t shortLen = STORAGE_PAGE_PAYLOAD_SIZE * 3;
+    const uint32_t headerAddress = StorageMacroblock::getMacroblockAddress(0);
+    uint8_t wdata[longLen] = {};
+    uint8_t rdata[longLen] = {};
+    memset(wdata, 0x3C, sizeof(wdata));
+
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata, longLen), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, shortPrefix, 2, wdata, shortLen), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, shortPrefix, 3, wdata, shortLen), STORAGE_OK);
+    ASSERT_EQ(StorageMacroblock::getMacroblockIndex(address), 0);
+
+    // Broken middle page of the last data and broken header
+    storage.setByte(address + STORAGE_PAGE_SIZE + STORAGE_PAGE_SIZE / 2, 0x00);
+    storage.setByte(headerAddress, 0x00);
+
+    // Every page is read once by the rebuild
+    unsigned startReads = getDeviceReadsCount(storage);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_LT(getDeviceReadsCount(storage) - startReads, 2 * StorageMacroblock::PAGES_COUNT);
+
+    ASSERT_EQ(sat->load(address, rdata, longLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, longLen));
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_OK);
+    ASSERT_EQ(sat->load(address, rdata, shortLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata, rdata, shortLen));
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 3), STORAGE_NOT_FOUND);
+
+    Header header(headerAddress);
+    ASSERT_EQ(header.load(), STORAGE_OK);
+    uint32_t okPagesCount = 0;
+    for (uint32_t i = 0; i < Header::PAGES_COUNT; i++) {
+        okPagesCount += header.isPageStatus(i, Header::PAGE_OK) ? 1 : 0;
+    }
+    ASSERT_EQ(okPagesCount, 23);
+}
+
+TEST_F(StorageFixture, MetaOnlyPageReads)
+{
+    const uint32_t pagesCount = 8;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * pagesCount;
+    uint8_t wdata[dataLen] = {};
+    CountingStorageDriver countingDriver;
+#ifdef STORAGE_PAGE_META_CRC
+    const uint32_t metaReadSize = sizeof(PageMeta);
+#else
+    const uint32_t metaReadSize = STORAGE_PAGE_SIZE;
+#endif
+
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &countingDriver, minMemoryEraseSize);
+    sat->bind();
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata, sizeof(wdata)), STORAGE_OK);
+
+    // The end page is found by the page meta only reads
+    Page page(address);
+    countingDriver.readBytes = 0;
+    ASSERT_EQ(page.loadMeta(/*startPage=*/true), STORAGE_OK);
+    while (!page.isEnd()) {
+        ASSERT_EQ(page.loadNext(/*metaOnly=*/true), STORAGE_OK);
+    }
+    EXPECT_EQ(countingDriver.readBytes, pagesCount * metaReadSize);
+    ASSERT_EQ(page.page.header.id, 1);
+    ASSERT_EQ(page.loadMeta(/*startPage=*/true), STORAGE_ERROR);
+
+    // The broken page meta is not loaded
+    uint32_t endAddress = page.getAddress();
+    storage.setByte(endAddress + offsetof(PageMeta, id), 0xFF);
+    ASSERT_NE(page.loadMeta(), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(sat->load(address, wdata, sizeof(wdata)), STORAGE_NOT_FOUND);
+}
+
+class WearStorageDriver: public DeviceStorageDriver
+{
+public:
+    std::vector<uint32_t> sectorErases;
+
+    WearStorageDriver(uint32_t pagesCount, uint32_t sectorsCount):
+        DeviceStorageDriver(pagesCount), sectorErases(sectorsCount, 0) {}
+
+    StorageStatus erase(const uint32_t* addresses, const uint32_t count) override
+    {
+        std::vector<bool> erased(sectorErases.size(), false);
+        for (uint32_t i = 0; i < count; i++) {
+            erased[addresses[i] / STORAGE_DEFAULT_MIN_ERASE_SIZE] = true;
+        }
+        for (uint32_t i = 0; i < erased.size(); i++) {
+            sectorErases[i] += erased[i] ? 1 : 0;
+        }
+        return DeviceStorageDriver::erase(addresses, count);
+    }
+};
+
+TEST_F(StorageFixture, WearLevelingSimulation)
+{
+    const uint32_t tablePagesCount = StorageMacroblock::PAGES_COUNT * 4;
+    const uint32_t sectorsCount = tablePagesCount * STORAGE_PAGE_SIZE / STORAGE_DEFAULT_MIN_ERASE_SIZE;
+    const uint32_t wearAddress = tablePagesCount * STORAGE_PAGE_SIZE;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 3;
+    const uint32_t coldCount = 20;
+    const uint32_t hotCount = 4;
+    const uint32_t cyclesCount = 400;
+    const char* names[] = { "off", "on" };
+    uint8_t wdata[dataLen] = {};
+    uint8_t rdata[dataLen] = {};
+    uint32_t maxCounts[2] = {};
+
+    for (unsigned leveling = 0; leveling < 2; leveling++) {
+        WearStorageDriver device(tablePagesCount + 2, sectorsCount);
+        sat = std::make_unique<StorageAT>(tablePagesCount, &device, STORAGE_DEFAULT_MIN_ERASE_SIZE);
+        sat->bind();
+        ASSERT_LE(wearAddress + StorageAT::getWearCountersSize(), device.device.getSize());
+        ASSERT_EQ(sat->format(), STORAGE_OK);
+        ASSERT_EQ(sat->enableAllocator(), STORAGE_OK);
+        if (leveling) {
+            ASSERT_EQ(sat->enableWearLeveling(wearAddress - STORAGE_PAGE_SIZE), STORAGE_ERROR);
+            ASSERT_EQ(sat->enableWearLeveling(wearAddress), STORAGE_NOT_FOUND);
+        }
+        std::fill(device.sectorErases.begin(), device.sectorErases.end(), 0);
+
+        // The cold data stays, the hot data is rewritten to the new place
+        for (uint32_t id = 1; id <= coldCount; id++) {
+            memset(wdata, static_cast<int>(id), sizeof(wdata));
+            ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+            ASSERT_EQ(sat->save(address, shortPrefix, id, wdata, sizeof(wdata)), STORAGE_OK);
+        }
+        for (uint32_t cycle = 0; cycle < cyclesCount; cycle++) {
+            uint32_t id = coldCount + 1 + cycle % hotCount;
+            memset(wdata, static_cast<int>(cycle), sizeof(wdata));
+            StorageStatus status = sat->deleteData(shortPrefix, id);
+            ASSERT_TRUE(status == STORAGE_OK || status == STORAGE_NOT_FOUND);
+            ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+            ASSERT_EQ(sat->save(address, shortPrefix, id, wdata, sizeof(wdata)), STORAGE_OK);
+        }
+
+        for (uint32_t id = 1; id <= coldCount + hotCount; id++) {
+            uint8_t value = static_cast<uint8_t>(id <= coldCount ? id : cyclesCount - hotCount + (id - coldCount - 1));
+            memset(wdata, value, sizeof(wdata));
+            ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, id), STORAGE_OK);
+            ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+            ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+        }
+
+        uint32_t totalCount = 0;
+        for (uint32_t sectorIndex = 0; sectorIndex < sectorsCount; sectorIndex++) {
+            maxCounts[leveling] = std::max(maxCounts[leveling], device.sectorErases[sectorIndex]);
+            totalCount += device.sectorErases[sectorIndex];
+            if (leveling) {
+                ASSERT_EQ(sat->getEraseCount(sectorIndex * STORAGE_DEFAULT_MIN_ERASE_SIZE), device.sectorErases[sectorIndex]);
+            }
+        }
+        std::cout << "Wear leveling " << names[leveling] << ": max " << maxCounts[leveling]
+                  << ", mean " << static_cast<double>(totalCount) / sectorsCount
+                  << " erases per sector" << std::endl;
+
+        // The counters are kept in memory between mounts
+        if (leveling) {
+            ASSERT_EQ(sat->saveWearCounters(), STORAGE_OK);
+            std::unique_ptr<StorageAT> mount = std::make_unique<StorageAT>(tablePagesCount, &device, STORAGE_DEFAULT_MIN_ERASE_SIZE);
+            ASSERT_EQ(mount->enableWearLeveling(wearAddress), STORAGE_OK);
+            for (uint32_t sectorIndex = 0; sectorIndex < sectorsCount; sectorIndex++) {
+                ASSERT_EQ(mount->getEraseCount(sectorIndex * STORAGE_DEFAULT_MIN_ERASE_SIZE), device.sectorErases[sectorIndex]);
+            }
+        }
+        sat.reset();
+    }
+
+    EXPECT_LT(maxCounts[1], maxCounts[0]);
+}
+
+TEST_F(StorageFixture, LogStructuredAppend)
+{
+    const uint32_t tablePagesCount = StorageMacroblock::PAGES_COUNT * 4;
+    const uint32_t sectorsCount = tablePagesCount * STORAGE_PAGE_SIZE / STORAGE_DEFAULT_MIN_ERASE_SIZE;
+    const uint32_t coldLen = STORAGE_PAGE_PAYLOAD_SIZE * 3;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 2;
+    const uint32_t versionsCount = 300;
+    const char* names[] = { "rewrite", "append" };
+    uint8_t cold[coldLen] = {};
+    uint8_t wdata[dataLen] = {};
+    uint8_t rdata[dataLen] = {};
+    uint32_t erasesCount[2] = {};
+
+    for (unsigned log = 0; log < 2; log++) {
+        WearStorageDriver device(tablePagesCount, sectorsCount);
+        sat = std::make_unique<StorageAT>(tablePagesCount, &device, STORAGE_DEFAULT_MIN_ERASE_SIZE);
+        sat->bind();
+        ASSERT_EQ(sat->format(), STORAGE_OK);
+        ASSERT_EQ(sat->enableIndex(), STORAGE_OK);
+        ASSERT_EQ(sat->append(shortPrefix, 2, wdata, dataLen), STORAGE_ERROR);
+        ASSERT_EQ(log ? sat->enableLogMode() : sat->enableAllocator(), STORAGE_OK);
+
+        memset(cold, 0xC0, sizeof(cold));
+        ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+        ASSERT_EQ(sat->save(address, shortPrefix, 1, cold, sizeof(cold)), STORAGE_OK);
+        std::fill(device.sectorErases.begin(), device.sectorErases.end(), 0);
+
+        // The head goes over the memory several times and reuses the stale pages
+        uint32_t prevAddress = 0;
+        for (uint32_t version = 0; version < versionsCount; version++) {
+            memset(wdata, static_cast<int>(version), sizeof(wdata));
+            if (log) {
+                ASSERT_EQ(sat->append(shortPrefix, 2, wdata, sizeof(wdata), &address), STORAGE_OK);
+            } else if (sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 2) == STORAGE_OK) {
+                ASSERT_EQ(sat->rewrite(address, shortPrefix, 2, wdata, sizeof(wdata)), STORAGE_OK);
+            } else {
+                ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+                ASSERT_EQ(sat->save(address, shortPrefix, 2, wdata, sizeof(wdata)), STORAGE_OK);
+            }
+
+            uint32_t foundAddress = 0;
+            ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &foundAddress, shortPrefix, 2), STORAGE_OK);
+            ASSERT_EQ(foundAddress, address);
+            ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+            ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+
+            // The previous version stays in memory until the head erases its sector
+            if (log && version) {
+                Header header(prevAddress);
+                ASSERT_EQ(StorageMacroblock::loadHeader(&header), STORAGE_OK);
+                ASSERT_TRUE(header.isPageStatus(StorageMacroblock::getPageIndexByAddress(prevAddress), Header::PAGE_STALE));
+                if (sat->find(FIND_MODE_EMPTY, &foundAddress) == STORAGE_OK) {
+                    ASSERT_NE(foundAddress, prevAddress);
+                }
+            }
+            prevAddress = address;
+        }
+        for (uint32_t sectorIndex = 0; sectorIndex < sectorsCount; sectorIndex++) {
+            erasesCount[log] += device.sectorErases[sectorIndex];
+        }
+        std::cout << "Overwrites by " << names[log] << ": " << erasesCount[log]
+                  << " sector erases for " << versionsCount << " versions" << std::endl;
+
+        memset(rdata, 0, sizeof(rdata));
+        ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+        ASSERT_EQ(sat->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+        ASSERT_FALSE(memcmp(cold, rdata, sizeof(rdata)));
+
+        // Only append makes the pages stale, the deleted pages are empty
+        if (log) {
+            uint32_t coldAddress = address;
+            ASSERT_EQ(sat->deleteData(shortPrefix, 1), STORAGE_OK);
+            Header header(coldAddress);
+            ASSERT_EQ(StorageMacroblock::loadHeader(&header), STORAGE_OK);
+            ASSERT_TRUE(header.isPageStatus(StorageMacroblock::getPageIndexByAddress(coldAddress), Header::PAGE_EMPTY));
+        }
+
+        // The stale pages are not found after the mount
+        if (log) {
+            std::unique_ptr<StorageAT> mount = std::make_unique<StorageAT>(tablePagesCount, &device, STORAGE_DEFAULT_MIN_ERASE_SIZE);
+            ASSERT_EQ(mount->find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_OK);
+            ASSERT_EQ(address, prevAddress);
+            ASSERT_EQ(mount->enableLogMode(), STORAGE_OK);
+            memset(wdata, 0x5A, sizeof(wdata));
+            ASSERT_EQ(mount->append(shortPrefix, 2, wdata, sizeof(wdata), &address), STORAGE_OK);
+            ASSERT_EQ(mount->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+            ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+        }
+        sat.reset();
+    }
+
+    EXPECT_LT(erasesCount[1] * 4, erasesCount[0]);
+}
+
+TEST_F(StorageFixture, CompactStalePages)
+{
+    const uint32_t tablePagesCount = StorageMacroblock::PAGES_COUNT * 4;
+    const uint32_t sectorsCount = tablePagesCount * STORAGE_PAGE_SIZE / STORAGE_DEFAULT_MIN_ERASE_SIZE;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 2;
+    const uint32_t idsCount = 12;
+    uint8_t wdata[dataLen] = {};
+    uint8_t rdata[dataLen] = {};
+    uint8_t versions[idsCount + 1] = {};
+
+    WearStorageDriver device(tablePagesCount, sectorsCount);
+    sat = std::make_unique<StorageAT>(tablePagesCount, &device, STORAGE_DEFAULT_MIN_ERASE_SIZE);
+    sat->bind();
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+    ASSERT_EQ(sat->enableIndex(), STORAGE_OK);
+    ASSERT_EQ(sat->compact(), STORAGE_ERROR);
+    ASSERT_EQ(sat->enableLogMode(), STORAGE_OK);
+    ASSERT_EQ(sat->compact(), STORAGE_NOT_FOUND);
+
+    auto getStaleCount = [&]() {
+        uint32_t count = 0;
+        for (uint32_t sectorIndex = 0; sectorIndex < sectorsCount; sectorIndex++) {
+            count += StorageAT::allocator()->getSectorStaleCount(sectorIndex);
+        }
+        return count;
+    };
+
+    // The even ids are superseded several times, so the sectors keep the live and stale pages
+    for (uint32_t round = 0; round < 4; round++) {
+        for (uint32_t id = 1; id <= idsCount; id++) {
+            if (round && id % 2) {
+                continue;
+            }
+            versions[id] = static_cast<uint8_t>(round * idsCount + id);
+            memset(wdata, versions[id], sizeof(wdata));
+            ASSERT_EQ(sat->append(shortPrefix, id, wdata, sizeof(wdata)), STORAGE_OK);
+        }
+    }
+    ASSERT_GT(getStaleCount(), 0);
+
+    // Every step moves one data at most
+    uint32_t stepsCount = 0;
+    StorageStatus status = STORAGE_OK;
+    for (; stepsCount < 1000; stepsCount++) {
+        status = sat->compact(/*pagesCount=*/1);
+        if (status != STORAGE_OK) {
+            break;
+        }
+    }
+    ASSERT_EQ(status, STORAGE_NOT_FOUND);
+    EXPECT_GT(stepsCount, 1);
+    EXPECT_EQ(getStaleCount(), 0);
+
+    auto checkData = [&](StorageAT* storage) {
+        for (uint32_t id = 1; id <= idsCount; id++) {
+            memset(wdata, versions[id], sizeof(wdata));
+            memset(rdata, 0, sizeof(rdata));
+            ASSERT_EQ(storage->find(FIND_MODE_EQUAL, &address, shortPrefix, id), STORAGE_OK);
+            ASSERT_EQ(storage->load(address, rdata, sizeof(rdata)), STORAGE_OK);
+            ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+        }
+    };
+    checkData(sat.get());
+
+    // The log write head goes on over the compacted sectors
+    versions[2] = 0xA5;
+    memset(wdata, versions[2], sizeof(wdata));
+    ASSERT_EQ(sat->append(shortPrefix, 2, wdata, sizeof(wdata)), STORAGE_OK);
+    checkData(sat.get());
+
+    std::unique_ptr<StorageAT> mount = std::make_unique<StorageAT>(tablePagesCount, &device, STORAGE_DEFAULT_MIN_ERASE_SIZE);
+    checkData(mount.get());
+    mount.reset();
+    sat.reset();
+}
+
+class SectorEraseStorageDriver: public DeviceStorageDriver
+{
+public:
+    unsigned dataErasesCount = 0;
+    unsigned sectorErasesCount = 0;
+    bool native = true;
+    uint32_t eraseSize;
+
+    SectorEraseStorageDriver(uint32_t pagesCount, uint32_t eraseSize = STORAGE_DEFAULT_MIN_ERASE_SIZE):
+        DeviceStorageDriver(pagesCount), eraseSize(eraseSize) {}
+
+    StorageStatus erase(const uint32_t* addresses, const uint32_t count) override
+    {
+        // The header saves erase the header pages only
+        for (uint32_t i = 0; i < count; i++) {
+            if (!StorageMacroblock::isMacroblockAddress(addresses[i])) {
+                dataErasesCount++;
+                break;
+            }
+        }
+        return DeviceStorageDriver::erase(addresses, count);
+    }
+    StorageStatus eraseSector(const uint32_t address) override
+    {
+        std::vector<uint32_t> addresses;
+        for (uint32_t i = 0; i < eraseSize / STORAGE_PAGE_SIZE; i++) {
+            addresses.push_back(address + i * STORAGE_PAGE_SIZE);
+        }
+        dataErasesCount++;
+        sectorErasesCount++;
+        return DeviceStorageDriver::erase(addresses.data(), static_cast<uint32_t>(addresses.size()));
+    }
+    uint32_t capabilities() override
+    {
+        return native ? STORAGE_DRIVER_CAP_SECTOR_ERASE : STORAGE_DRIVER_CAP_NONE;
+    }
+};
+
+TEST_F(StorageFixture, RewriteErasesPerSector)
+{
+    const uint32_t tablePagesCount = StorageMacroblock::PAGES_COUNT * 4;
+    const uint32_t dataPagesCount = Header::PAGES_COUNT * 2 + 10;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * dataPagesCount;
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+
+    for (uint32_t i = 0; i < dataLen; i++) {
+        wdata[i] = static_cast<uint8_t>(i * 13);
+    }
+
+    for (bool native : { false, true }) {
+        SectorEraseStorageDriver device(tablePagesCount);
+        device.native = native;
+        sat = std::make_unique<StorageAT>(tablePagesCount, &device, STORAGE_DEFAULT_MIN_ERASE_SIZE);
+        sat->bind();
+        ASSERT_EQ(sat->format(), STORAGE_OK);
+        device.dataErasesCount = 0;
+
+        ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+        ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+        memset(rdata.get(), 0, dataLen);
+        ASSERT_EQ(sat->load(address, rdata.get(), dataLen), STORAGE_OK);
+        ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+
+        // The data covers the erase sectors from the memory start
+        uint32_t dataEnd = StorageMacroblock::getPageAddressByIndex(2, dataPagesCount - Header::PAGES_COUNT * 2 - 1);
+        uint32_t sectorsCount = dataEnd / STORAGE_DEFAULT_MIN_ERASE_SIZE + 1;
+        EXPECT_EQ(device.dataErasesCount, sectorsCount);
+
+        // The header free sectors are erased natively (the last one is partially written)
+        uint32_t freeSectorsCount = 0;
+        for (uint32_t sectorIndex = 0; sectorIndex < sectorsCount; sectorIndex++) {
+            bool hasHeader = false;
+            for (uint32_t i = 0; i < STORAGE_DEFAULT_MIN_ERASE_SIZE; i += STORAGE_PAGE_SIZE) {
+                hasHeader |= StorageMacroblock::isMacroblockAddress(sectorIndex * STORAGE_DEFAULT_MIN_ERASE_SIZE + i);
+            }
+            freeSectorsCount += hasHeader ? 0 : 1;
+        }
+        EXPECT_EQ(device.sectorErasesCount, native ? freeSectorsCount : 0);
+
+        sat.reset();
+    }
+}
+
+TEST_F(StorageFixture, LargeEraseBlocks)
+{
+    const uint32_t eraseSize = 64 * 1024;
+    const uint32_t erasePagesCount = eraseSize / STORAGE_PAGE_SIZE;
+    const uint32_t groupCount = erasePagesCount / StorageMacroblock::PAGES_COUNT;
+    const uint32_t tablePagesCount = erasePagesCount * 3 + StorageMacroblock::PAGES_COUNT * 2 + 10;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * (Header::PAGES_COUNT * groupCount + 10);
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+
+    for (uint32_t i = 0; i < dataLen; i++) {
+        wdata[i] = static_cast<uint8_t>(i * 11);
+    }
+
+    DeviceStorageDriver device(tablePagesCount);
+    sat = std::make_unique<StorageAT>(tablePagesCount, &device, eraseSize);
+    sat->bind();
+    ASSERT_EQ(StorageMacroblock::getMacroblocksCount(), groupCount * 3 + 2);
+    ASSERT_EQ(sat->getPayloadSize(), StorageMacroblock::getMacroblocksCount() * Header::PAGES_COUNT * STORAGE_PAGE_PAYLOAD_SIZE + 6 * STORAGE_PAGE_PAYLOAD_SIZE);
+
+    // Every macroblock lies in one erase block, every group starts at the erase block start
+    for (uint32_t i = 0; i < StorageMacroblock::getMacroblocksCount(); i++) {
+        uint32_t macroblockAddress = StorageMacroblock::getMacroblockAddress(i);
+        uint32_t macroblockEnd = macroblockAddress + StorageMacroblock::PAGES_COUNT * STORAGE_PAGE_SIZE - 1;
+        ASSERT_EQ(macroblockAddress / eraseSize, macroblockEnd / eraseSize);
+        ASSERT_EQ(StorageMacroblock::getMacroblockIndex(macroblockEnd), i);
+        if (i % groupCount == 0) {
+            ASSERT_EQ(macroblockAddress % eraseSize, 0);
+        }
+    }
+
+    // The pages after the last group macroblock are not used
+    address = eraseSize - STORAGE_PAGE_SIZE;
+    ASSERT_TRUE(StorageMacroblock::isMacroblockAddress(address));
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), STORAGE_PAGE_PAYLOAD_SIZE), STORAGE_ERROR);
+
+    // The data goes over the unused pages to the next erase block
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+    ASSERT_EQ(sat->load(address, rdata.get(), dataLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+
+    std::unique_ptr<StorageAT> mount = std::make_unique<StorageAT>(tablePagesCount, &device, eraseSize);
+    memset(rdata.get(), 0, dataLen);
+    ASSERT_EQ(mount->find(FIND_MODE_EQUAL, &address, shortPrefix, 1), STORAGE_OK);
+    ASSERT_EQ(mount->load(address, rdata.get(), dataLen), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+    mount.reset();
+    sat.reset();
+}
+
+TEST_F(StorageFixture, LargeEraseBlocksSectorErase)
+{
+    const uint32_t eraseSize = 16 * 1024;
+    const uint32_t erasePagesCount = eraseSize / STORAGE_PAGE_SIZE;
+    const uint32_t groupCount = erasePagesCount / StorageMacroblock::PAGES_COUNT;
+    const uint32_t tablePagesCount = erasePagesCount * 3;
+    const uint32_t groupDataLen = STORAGE_PAGE_PAYLOAD_SIZE * Header::PAGES_COUNT * groupCount;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 10;
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(groupDataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(groupDataLen);
+
+    for (uint32_t i = 0; i < groupDataLen; i++) {
+        wdata[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    SectorEraseStorageDriver device(tablePagesCount, eraseSize);
+    sat = std::make_unique<StorageAT>(tablePagesCount, &device, eraseSize);
+    sat->bind();
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+
+    // The data fills the first group, its headers and tail pages are erased with the sector
+    uint32_t groupAddress = 0;
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &groupAddress), STORAGE_OK);
+    ASSERT_EQ(sat->save(groupAddress, shortPrefix, 1, wdata.get(), groupDataLen), STORAGE_OK);
+    EXPECT_EQ(device.sectorErasesCount, 1);
+
+    // The data in the empty second group is erased with the sector too
+    uint32_t firstAddress = 0;
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &firstAddress), STORAGE_OK);
+    ASSERT_EQ(firstAddress / eraseSize, 1);
+    ASSERT_EQ(sat->save(firstAddress, shortPrefix, 2, wdata.get(), dataLen), STORAGE_OK);
+    EXPECT_EQ(device.sectorErasesCount, 2);
+
+    // The sector with other data keeps the page erase
+    uint32_t secondAddress = 0;
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &secondAddress), STORAGE_OK);
+    ASSERT_EQ(secondAddress / eraseSize, 1);
+    ASSERT_EQ(sat->save(secondAddress, shortPrefix, 3, wdata.get(), dataLen), STORAGE_OK);
+    EXPECT_EQ(device.sectorErasesCount, 2);
+
+    std::unique_ptr<StorageAT> mount = std::make_unique<StorageAT>(tablePagesCount, &device, eraseSize);
+    for (auto [id, len] : { std::pair<uint32_t, uint32_t>{ 1, groupDataLen }, { 2, dataLen }, { 3, dataLen } }) {
+        memset(rdata.get(), 0, groupDataLen);
+        ASSERT_EQ(mount->find(FIND_MODE_EQUAL, &address, shortPrefix, id), STORAGE_OK);
+        ASSERT_EQ(mount->load(address, rdata.get(), len), STORAGE_OK);
+        ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), len));
+    }
+    mount.reset();
+    sat.reset();
+}
+
+#ifndef STORAGE_NO_THREADS
+class LatencyStorageDriver: public DeviceStorageDriver
+{
+public:
+    std::mutex deviceMutex;
+    std::chrono::microseconds latency;
+
+    LatencyStorageDriver(uint32_t pagesCount, std::chrono::microseconds latency):
+        DeviceStorageDriver(pagesCount), latency(latency) {}
+
+    StorageStatus read(const uint32_t address, uint8_t* data, const uint32_t len) override
+    {
+        std::this_thread::sleep_for(latency);
+        std::lock_guard<std::mutex> lock(deviceMutex);
+        return DeviceStorageDriver::read(address, data, len);
+    }
+    StorageStatus write(const uint32_t address, const uint8_t* data, const uint32_t len) override
+    {
+        std::this_thread::sleep_for(latency);
+        std::lock_guard<std::mutex> lock(deviceMutex);
+        return DeviceStorageDriver::write(address, data, len);
+    }
+    StorageStatus erase(const uint32_t* addresses, const uint32_t count) override
+    {
+        std::this_thread::sleep_for(latency);
+        std::lock_guard<std::mutex> lock(deviceMutex);
+        return DeviceStorageDriver::erase(addresses, count);
+    }
+    uint32_t capabilities() override
+    {
+        return STORAGE_DRIVER_CAP_PARALLEL;
+    }
+};
+
+/*
+ * Runs readers that load the data while the writer rewrites it
+ *
+ * @param sat          Target allocation table (the data has to be saved with id 1)
+ * @param readersCount Reader threads count
+ * @param dataLen      Data length
+ * @param serialize    Flag that serializes all requests with one mutex (baseline)
+ * @return             Returns loads count or 0 if any reader has got broken data
+ */
+static unsigned runReadersAgainstWriter(StorageAT* sat, unsigned readersCount, uint32_t dataLen, bool serialize)
+{
+    const std::chrono::milliseconds duration(200);
+    std::atomic<bool> stop(false);
+    std::atomic<bool> broken(false);
+    std::atomic<unsigned> loadsCount(0);
+    std::mutex serialMutex;
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < readersCount; i++) {
+        threads.emplace_back([&]() {
+            std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+            while (!stop) {
+                std::unique_lock<std::mutex> lock(serialMutex, std::defer_lock);
+                if (serialize) {
+                    lock.lock();
+                }
+                uint32_t address = 0;
+                if (sat->find(FIND_MODE_EQUAL, &address, "tst", 1) != STORAGE_OK ||
+                    sat->load(address, rdata.get(), dataLen) != STORAGE_OK
+                ) {
+                    broken = true;
+                    continue;
+                }
+                for (uint32_t j = 1; j < dataLen; j++) {
+                    if (rdata[j] != rdata[0]) {
+                        broken = true;
+                    }
+                }
+                loadsCount++;
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+        for (uint8_t version = 1; !stop; version++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            std::unique_lock<std::mutex> lock(serialMutex, std::defer_lock);
+            if (serialize) {
+                lock.lock();
+            }
+            uint32_t address = 0;
+            memset(wdata.get(), version, dataLen);
+            if (sat->find(FIND_MODE_EQUAL, &address, "tst", 1) != STORAGE_OK ||
+                sat->rewrite(address, "tst", 1, wdata.get(), dataLen) != STORAGE_OK
+            ) {
+                broken = true;
+            }
+        }
+    });
+
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    return broken ? 0 : loadsCount.load();
+}
+
+TEST_F(StorageFixture, LockingReadersAgainstWriter)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 2;
+    LatencyStorageDriver latencyDriver(StorageMacroblock::PAGES_COUNT * 4, std::chrono::microseconds(20));
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    StorageAT lockedSat(latencyDriver.device.getPagesCount(), &latencyDriver, minMemoryEraseSize);
+    lockedSat.bind();
+
+    ASSERT_EQ(lockedSat.enableIndex(), STORAGE_OK);
+    ASSERT_EQ(lockedSat.setHeaderCacheSize(4), STORAGE_OK);
+    memset(wdata.get(), 0, dataLen);
+    ASSERT_EQ(lockedSat.find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    ASSERT_EQ(lockedSat.save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_OK);
+    lockedSat.enableLocking();
+
+    unsigned serialLoads = runReadersAgainstWriter(&lockedSat, 4, dataLen, /*serialize=*/true);
+    std::cout << "Serialized: 4 readers, " << serialLoads << " loads" << std::endl;
+    ASSERT_GT(serialLoads, 0);
+
+    unsigned sharedLoads[4] = {};
+    for (unsigned i = 0; i < 4; i++) {
+        unsigned readersCount = 1u << i;
+        sharedLoads[i] = runReadersAgainstWriter(&lockedSat, readersCount, dataLen, /*serialize=*/false);
+        std::cout << "Shared lock: " << readersCount << " reader(s), " << sharedLoads[i] << " loads" << std::endl;
+        ASSERT_GT(sharedLoads[i], 0);
+    }
+    // The loads count depends on the machine load, so it is printed only
+}
+
+TEST_F(StorageFixture, MacroblockLockingWriters)
+{
+    const unsigned writersCount = 8;
+    const uint32_t recordsCount = 6;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 2;
+    LatencyStorageDriver latencyDriver(StorageMacroblock::PAGES_COUNT * 4, std::chrono::microseconds(5));
+    StorageAT lockedSat(latencyDriver.device.getPagesCount(), &latencyDriver, minMemoryEraseSize);
+    lockedSat.bind();
+    StorageStatus results[writersCount] = {};
+
+    ASSERT_EQ(lockedSat.enableLocking(/*macroblockLocks=*/true), STORAGE_OK);
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < writersCount; i++) {
+        threads.emplace_back([&, i]() {
+            char prefix[STORAGE_PAGE_PREFIX_SIZE + 1] = {};
+            uint8_t wdata[dataLen] = {};
+            snprintf(prefix, sizeof(prefix), "w%02u", i);
+
+            results[i] = STORAGE_OK;
+            for (uint32_t id = 1; id <= recordsCount && results[i] == STORAGE_OK; id++) {
+                memset(wdata, static_cast<int>(i * 16 + id), sizeof(wdata));
+                // Parallel writers may get the same empty address
+                do {
+                    uint32_t address = 0;
+                    results[i] = lockedSat.find(FIND_MODE_EMPTY, &address);
+                    if (results[i] == STORAGE_OK) {
+                        results[i] = lockedSat.save(address, prefix, id, wdata, sizeof(wdata));
+                    }
+                } while (results[i] == STORAGE_DATA_EXISTS);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (unsigned i = 0; i < writersCount; i++) {
+        ASSERT_EQ(results[i], STORAGE_OK);
+
+        char prefix[STORAGE_PAGE_PREFIX_SIZE + 1] = {};
+        snprintf(prefix, sizeof(prefix), "w%02u", i);
+        for (uint32_t id = 1; id <= recordsCount; id++) {
+            uint8_t wdata[dataLen] = {};
+            uint8_t rdata[dataLen] = {};
+            memset(wdata, static_cast<int>(i * 16 + id), sizeof(wdata));
+            ASSERT_EQ(lockedSat.find(FIND_MODE_EQUAL, &address, prefix, id), STORAGE_OK);
+            ASSERT_EQ(lockedSat.load(address, rdata, sizeof(rdata)), STORAGE_OK);
+            ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+        }
+    }
+}
+
+TEST_F(StorageFixture, MacroblockLockingKeepsOldData)
+{
+    const unsigned writersCount = 8;
+    const uint32_t versionsCount = 8;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 2;
+    LatencyStorageDriver latencyDriver(StorageMacroblock::PAGES_COUNT * 4, std::chrono::microseconds(5));
+    StorageAT lockedSat(latencyDriver.device.getPagesCount(), &latencyDriver, minMemoryEraseSize);
+    lockedSat.bind();
+    StorageStatus results[writersCount] = {};
+
+    ASSERT_EQ(lockedSat.enableLocking(/*macroblockLocks=*/true), STORAGE_OK);
+
+    // The save that loses the address to another writer keeps the previous version
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < writersCount; i++) {
+        threads.emplace_back([&, i]() {
+            char prefix[STORAGE_PAGE_PREFIX_SIZE + 1] = {};
+            uint8_t wdata[dataLen] = {};
+            uint8_t rdata[dataLen] = {};
+            snprintf(prefix, sizeof(prefix), "k%02u", i);
+
+            results[i] = STORAGE_OK;
+            for (uint32_t version = 1; version <= versionsCount && results[i] == STORAGE_OK; version++) {
+                do {
+                    uint32_t address = 0;
+                    results[i] = lockedSat.find(FIND_MODE_EMPTY, &address);
+                    if (results[i] == STORAGE_OK) {
+                        memset(wdata, static_cast<int>(i * 16 + version), sizeof(wdata));
+                        results[i] = lockedSat.save(address, prefix, 1, wdata, sizeof(wdata));
+                    }
+                    if (results[i] != STORAGE_DATA_EXISTS || version == 1) {
+                        continue;
+                    }
+
+                    memset(wdata, static_cast<int>(i * 16 + version - 1), sizeof(wdata));
+                    if (lockedSat.find(FIND_MODE_EQUAL, &address, prefix, 1) != STORAGE_OK ||
+                        lockedSat.load(address, rdata, sizeof(rdata)) != STORAGE_OK ||
+                        memcmp(wdata, rdata, sizeof(rdata))
+                    ) {
+                        results[i] = STORAGE_NOT_FOUND;
+                    }
+                } while (results[i] == STORAGE_DATA_EXISTS);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (unsigned i = 0; i < writersCount; i++) {
+        ASSERT_EQ(results[i], STORAGE_OK);
+
+        char prefix[STORAGE_PAGE_PREFIX_SIZE + 1] = {};
+        uint8_t wdata[dataLen] = {};
+        uint8_t rdata[dataLen] = {};
+        snprintf(prefix, sizeof(prefix), "k%02u", i);
+        memset(wdata, static_cast<int>(i * 16 + versionsCount), sizeof(wdata));
+        ASSERT_EQ(lockedSat.find(FIND_MODE_EQUAL, &address, prefix, 1), STORAGE_OK);
+        ASSERT_EQ(lockedSat.load(address, rdata, sizeof(rdata)), STORAGE_OK);
+        ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+    }
+}
+
+/*
+ * Runs writers that rewrite their own data in their own macroblocks
+ *
+ * @param sat          Target allocation table
+ * @param writersCount Writer threads count
+ * @return             Returns rewrites count or 0 if any rewrite has failed
+ */
+static unsigned runMacroblockWriters(StorageAT* sat, unsigned writersCount)
+{
+    const std::chrono::milliseconds duration(200);
+    std::atomic<bool> stop(false);
+    std::atomic<bool> failed(false);
+    std::atomic<unsigned> rewritesCount(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < writersCount; i++) {
+        threads.emplace_back([&, i]() {
+            char prefix[STORAGE_PAGE_PREFIX_SIZE + 1] = {};
+            uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = {};
+            sat->bind();
+            uint32_t address = StorageMacroblock::getPageAddressByIndex(i, 0);
+            snprintf(prefix, sizeof(prefix), "w%02u", i);
+
+            for (uint8_t version = 1; !stop; version++) {
+                memset(wdata, version, sizeof(wdata));
+                if (sat->rewrite(address, prefix, 1, wdata, sizeof(wdata)) != STORAGE_OK) {
+                    failed = true;
+                    return;
+                }
+                rewritesCount++;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    return failed ? 0 : rewritesCount.load();
+}
+
+TEST_F(StorageFixture, MacroblockLockingBenchmark)
+{
+    const unsigned maxWritersCount = 16;
+    LatencyStorageDriver latencyDriver(StorageMacroblock::PAGES_COUNT * (maxWritersCount + 1), std::chrono::microseconds(20));
+    StorageAT lockedSat(latencyDriver.device.getPagesCount(), &latencyDriver, minMemoryEraseSize);
+    lockedSat.bind();
+    unsigned instanceRewrites[5] = {};
+    unsigned macroblockRewrites[5] = {};
+
+    for (unsigned i = 0; (1u << i) <= maxWritersCount; i++) {
+        unsigned writersCount = 1u << i;
+
+        ASSERT_EQ(lockedSat.enableLocking(), STORAGE_OK);
+        instanceRewrites[i] = runMacroblockWriters(&lockedSat, writersCount);
+        ASSERT_GT(instanceRewrites[i], 0);
+
+        ASSERT_EQ(lockedSat.enableLocking(/*macroblockLocks=*/true), STORAGE_OK);
+        macroblockRewrites[i] = runMacroblockWriters(&lockedSat, writersCount);
+        ASSERT_GT(macroblockRewrites[i], 0);
+
+        std::cout << writersCount << " writer(s): " << instanceRewrites[i] << " rewrites with instance lock, "
+                  << macroblockRewrites[i] << " rewrites with macroblock locks" << std::endl;
+    }
+    // The rewrites count depends on the machine load, so it is printed only
+}
+
+TEST_F(StorageFixture, ParallelSearch)
+{
+    const uint32_t macroblocksCount = 8;
+    const StorageFindMode modes[] = { FIND_MODE_EQUAL, FIND_MODE_NEXT, FIND_MODE_MIN, FIND_MODE_MAX, FIND_MODE_EMPTY };
+    const uint32_t ids[] = { 10, 35, 0, 0, 0 };
+    LatencyStorageDriver latencyDriver(StorageMacroblock::PAGES_COUNT * macroblocksCount, std::chrono::microseconds(50));
+    StorageAT searchSat(latencyDriver.device.getPagesCount(), &latencyDriver, minMemoryEraseSize);
+    searchSat.bind();
+    uint32_t serialAddresses[5] = {};
+    uint8_t wdata[STORAGE_PAGE_PAYLOAD_SIZE] = {};
+
+    // The ids decrease with the macroblock index, other pages are filled with another prefix
+    for (uint32_t i = 0; i < macroblocksCount; i++) {
+        for (uint32_t j = 0; j < Header::PAGES_COUNT; j++) {
+            uint32_t pageAddress = StorageMacroblock::getPageAddressByIndex(i, j);
+            uint32_t id = j ? i * Header::PAGES_COUNT + j : 10 * (macroblocksCount - i);
+            if (i == macroblocksCount - 1 && j == Header::PAGES_COUNT - 1) {
+                continue;
+            }
+            ASSERT_EQ(searchSat.save(pageAddress, j ? "pad" : shortPrefix, id, wdata, sizeof(wdata)), STORAGE_OK);
+        }
+    }
+
+    for (unsigned i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        ASSERT_EQ(searchSat.find(modes[i], &serialAddresses[i], shortPrefix, ids[i]), STORAGE_OK);
+    }
+    ASSERT_EQ(serialAddresses[0], StorageMacroblock::getPageAddressByIndex(macroblocksCount - 1, 0));
+    ASSERT_EQ(serialAddresses[1], StorageMacroblock::getPageAddressByIndex(macroblocksCount - 4, 0));
+    ASSERT_EQ(serialAddresses[2], StorageMacroblock::getPageAddressByIndex(macroblocksCount - 1, 0));
+    ASSERT_EQ(serialAddresses[3], StorageMacroblock::getPageAddressByIndex(0, 0));
+    ASSERT_EQ(serialAddresses[4], StorageMacroblock::getPageAddressByIndex(macroblocksCount - 1, Header::PAGES_COUNT - 1));
+    ASSERT_EQ(searchSat.find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_NOT_FOUND);
+
+    unsigned startReads = getDeviceReadsCount(latencyDriver.device);
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(searchSat.find(FIND_MODE_MIN, &address, shortPrefix), STORAGE_OK);
+    auto serialTime = std::chrono::steady_clock::now() - start;
+    unsigned serialReads = getDeviceReadsCount(latencyDriver.device) - startReads;
+
+    searchSat.setThreadsCount(4);
+
+    for (unsigned i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        address = 0;
+        ASSERT_EQ(searchSat.find(modes[i], &address, shortPrefix, ids[i]), STORAGE_OK);
+        ASSERT_EQ(address, serialAddresses[i]);
+    }
+    ASSERT_EQ(searchSat.find(FIND_MODE_EQUAL, &address, shortPrefix, 2), STORAGE_NOT_FOUND);
+
+    // Every macroblock is read once by one of the threads (the timing is printed only)
+    startReads = getDeviceReadsCount(latencyDriver.device);
+    start = std::chrono::steady_clock::now();
+    ASSERT_EQ(searchSat.find(FIND_MODE_MIN, &address, shortPrefix), STORAGE_OK);
+    auto parallelTime = std::chrono::steady_clock::now() - start;
+    ASSERT_EQ(getDeviceReadsCount(latencyDriver.device) - startReads, serialReads);
+
+    std::cout << "Full search: " << std::chrono::duration_cast<std::chrono::microseconds>(serialTime).count() << "us serial, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(parallelTime).count() << "us with 4 threads" << std::endl;
+
+    // The parallel search shares the macroblocks with the writers of the other threads
+    ASSERT_EQ(searchSat.enableLocking(/*macroblockLocks=*/true), STORAGE_OK);
+    ASSERT_EQ(searchSat.rewrite(serialAddresses[3], shortPrefix, 80, wdata, sizeof(wdata)), STORAGE_OK);
+    ASSERT_EQ(searchSat.find(FIND_MODE_MAX, &address, shortPrefix), STORAGE_OK);
+    ASSERT_EQ(address, serialAddresses[3]);
+}
+
+/* Format progress of the FormatParallel test */
+typedef struct _FormatProgress {
+    uint32_t calls; // Progress calls count
+    uint32_t done;  // Last formatted macroblocks count
+    uint32_t total; // Total macroblocks count
+    bool     order; // Flag that indicates that the formatted count has never decreased
+} FormatProgress;
+
+static void formatProgressCallback(uint32_t done, uint32_t total, void* arg)
+{
+    FormatProgress* formatProgress = reinterpret_cast<FormatProgress*>(arg);
+    formatProgress->order  = formatProgress->order && done > formatProgress->done;
+    formatProgress->done   = done;
+    formatProgress->total  = total;
+    formatProgress->calls++;
+}
+
+TEST_F(StorageFixture, FormatParallel)
+{
+    const uint32_t macroblocksCount = 16;
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 2;
+    std::chrono::steady_clock::duration formatTimes[2] = {};
+    unsigned formatReads[2] = {};
+
+    for (unsigned i = 0; i < 2; i++) {
+        // The headers of the new device are broken, so every macroblock header is rebuilt
+        LatencyStorageDriver latencyDriver(StorageMacroblock::PAGES_COUNT * macroblocksCount, std::chrono::microseconds(20));
+        StorageAT formatSat(latencyDriver.device.getPagesCount(), &latencyDriver, minMemoryEraseSize);
+        formatSat.bind();
+        FormatProgress formatProgress = { 0, 0, 0, true };
+        uint8_t wdata[dataLen] = {};
+        uint8_t rdata[dataLen] = {};
+
+        formatSat.setThreadsCount(i ? 4 : 0);
+
+        unsigned startReads = getDeviceReadsCount(latencyDriver.device);
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_EQ(formatSat.format(formatProgressCallback, &formatProgress), STORAGE_OK);
+        formatTimes[i] = std::chrono::steady_clock::now() - start;
+        formatReads[i] = getDeviceReadsCount(latencyDriver.device) - startReads;
+
+        EXPECT_EQ(formatProgress.calls, macroblocksCount);
+        EXPECT_EQ(formatProgress.done, macroblocksCount);
+        EXPECT_EQ(formatProgress.total, macroblocksCount);
+        EXPECT_TRUE(formatProgress.order);
+
+        for (uint32_t j = 0; j < macroblocksCount; j++) {
+            memset(wdata, static_cast<int>(j + 1), sizeof(wdata));
+            ASSERT_EQ(formatSat.save(StorageMacroblock::getPageAddressByIndex(j, 0), shortPrefix, j + 1, wdata, sizeof(wdata)), STORAGE_OK);
+            ASSERT_EQ(formatSat.find(FIND_MODE_EQUAL, &address, shortPrefix, j + 1), STORAGE_OK);
+            ASSERT_EQ(formatSat.load(address, rdata, sizeof(rdata)), STORAGE_OK);
+            ASSERT_FALSE(memcmp(wdata, rdata, sizeof(rdata)));
+        }
+    }
+
+    std::cout << "Format of " << macroblocksCount << " macroblocks: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(formatTimes[0]).count() << "us serial, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(formatTimes[1]).count() << "us with 4 threads" << std::endl;
+    // The threads split the same work (the timing is printed only)
+    EXPECT_EQ(formatReads[1], formatReads[0]);
+}
+#endif
+
+class AsyncStorageDriver: public StorageDriver
+{
+private:
+    typedef enum _RequestType {
+        REQUEST_NONE,
+        REQUEST_READ,
+        REQUEST_WRITE,
+        REQUEST_ERASE,
+    } RequestType;
+
+    RequestType     type = REQUEST_NONE;
+    uint32_t        address = 0;
+    uint8_t*        data = nullptr;
+    const uint32_t* addresses = nullptr;
+    uint32_t        len = 0;
+    unsigned        remaining = 0;
+    bool            finished = false;
+    StorageStatus   finishedStatus = STORAGE_OK;
+
+public:
+    unsigned latency = 3;
+    unsigned submitsCount = 0;
+
+    StorageStatus submitRead(const uint32_t address, uint8_t* data, const uint32_t len) override
+    {
+        return submit(REQUEST_READ, address, data, nullptr, len);
+    }
+    StorageStatus submitWrite(const uint32_t address, const uint8_t* data, const uint32_t len) override
+    {
+        return submit(REQUEST_WRITE, address, const_cast<uint8_t*>(data), nullptr, len);
+    }
+    StorageStatus submitErase(const uint32_t* addresses, const uint32_t count) override
+    {
+        return submit(REQUEST_ERASE, 0, nullptr, addresses, count);
+    }
+    StorageStatus poll() override
+    {
+        if (finished) {
+            finished = false;
+            return finishedStatus;
+        }
+        if (type == REQUEST_NONE) {
+            return STORAGE_ERROR;
+        }
+        if (remaining) {
+            remaining--;
+            return STORAGE_BUSY;
+        }
+        return complete();
+    }
+    // The device executes one request at a time: the synchronous requests wait for the submitted one
+    StorageStatus read(const uint32_t address, uint8_t* data, const uint32_t len) override
+    {
+        wait();
+        return StorageDriver::read(address, data, len);
+    }
+    StorageStatus write(const uint32_t address, const uint8_t* data, const uint32_t len) override
+    {
+        wait();
+        return StorageDriver::write(address, data, len);
+    }
+    StorageStatus erase(const uint32_t* addresses, const uint32_t count) override
+    {
+        wait();
+        return StorageDriver::erase(addresses, count);
+    }
+    uint32_t capabilities() override
+    {
+        return STORAGE_DRIVER_CAP_ASYNC;
+    }
+
+private:
+    StorageStatus complete()
+    {
+        RequestType curType = type;
+        type = REQUEST_NONE;
+        switch (curType) {
+        case REQUEST_READ:
+            return StorageDriver::read(address, data, len);
+        case REQUEST_WRITE:
+            return StorageDriver::write(address, data, len);
+        default:
+            return StorageDriver::erase(addresses, len);
+        }
+    }
+    void wait()
+    {
+        if (type != REQUEST_NONE) {
+            finishedStatus = complete();
+            finished       = true;
+        }
+    }
+    StorageStatus submit(RequestType type, uint32_t address, uint8_t* data, const uint32_t* addresses, uint32_t len)
+    {
+        if (finished || this->type != REQUEST_NONE) {
+            return STORAGE_BUSY;
+        }
+        this->type      = type;
+        this->address   = address;
+        this->data      = data;
+        this->addresses = addresses;
+        this->len       = len;
+        this->remaining = latency;
+        submitsCount++;
+        return STORAGE_OK;
+    }
+};
+
+class FlakyStorageDriver: public VectoredStorageDriver
+{
+public:
+    unsigned busyPeriod = 7;
+    unsigned callsCount = 0;
+
+    StorageStatus read(const uint32_t address, uint8_t* data, const uint32_t len) override
+    {
+        if (++callsCount % busyPeriod == 0) {
+            return STORAGE_BUSY;
+        }
+        return VectoredStorageDriver::read(address, data, len);
+    }
+    StorageStatus write(const uint32_t address, const uint8_t* data, const uint32_t len) override
+    {
+        if (++callsCount % busyPeriod == 0) {
+            return STORAGE_BUSY;
+        }
+        return VectoredStorageDriver::write(address, data, len);
+    }
+};
+
+StorageStatus processOperation(StorageOperation* operation, unsigned* busyCount = nullptr)
+{
+    StorageStatus status = STORAGE_BUSY;
+    for (unsigned i = 0; i < 100000 && status == STORAGE_BUSY; i++) {
+        status = operation->process();
+        if (busyCount && status == STORAGE_BUSY) {
+            (*busyCount)++;
+        }
+    }
+    return status;
+}
+
+TEST_F(StorageFixture, AsyncOperationSaveLoad)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 6;
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+    VectoredStorageDriver syncDriver;
+    AsyncStorageDriver asyncDriver;
+    unsigned busyCount = 0;
+
+    memset(wdata.get(), 0xA5, dataLen);
+
+    syncDriver.vectored = false;
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &syncDriver, minMemoryEraseSize);
+    sat->bind();
+    StorageOperation syncOperation(sat.get());
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    syncDriver.requestsCount = 0;
+    syncOperation.startSave(address, shortPrefix, 1, wdata.get(), dataLen);
+    ASSERT_EQ(syncOperation.process(), STORAGE_OK);
+    unsigned syncRequestsCount = syncDriver.requestsCount;
+
+    storage.clear();
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &asyncDriver, minMemoryEraseSize);
+    sat->bind();
+    StorageOperation operation(sat.get());
+    ASSERT_TRUE(operation.isDone());
+
+    operation.startFind(FIND_MODE_EMPTY, &address);
+    ASSERT_EQ(processOperation(&operation), STORAGE_OK);
+
+    asyncDriver.submitsCount = 0;
+    operation.startSave(address, shortPrefix, 1, wdata.get(), dataLen);
+    ASSERT_FALSE(operation.isDone());
+    ASSERT_EQ(processOperation(&operation, &busyCount), STORAGE_OK);
+    ASSERT_TRUE(operation.isDone());
+    EXPECT_EQ(asyncDriver.submitsCount, syncRequestsCount);
+    EXPECT_GE(busyCount, syncRequestsCount * asyncDriver.latency);
+
+    operation.startLoad(address, rdata.get(), dataLen);
+    ASSERT_EQ(processOperation(&operation), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+
+    uint32_t foundAddress = 0;
+    operation.startFind(FIND_MODE_EQUAL, &foundAddress, shortPrefix, 1);
+    ASSERT_EQ(processOperation(&operation), STORAGE_OK);
+    ASSERT_EQ(foundAddress, address);
+}
+
+TEST_F(StorageFixture, AsyncOperationResumesAfterBusy)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 6;
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+    VectoredStorageDriver cleanDriver;
+    FlakyStorageDriver flakyDriver;
+
+    memset(wdata.get(), 0x5A, dataLen);
+
+    cleanDriver.vectored = false;
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &cleanDriver, minMemoryEraseSize);
+    sat->bind();
+    StorageOperation cleanOperation(sat.get());
+    ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+    cleanDriver.requestsCount = 0;
+    cleanOperation.startSave(address, shortPrefix, 1, wdata.get(), dataLen);
+    ASSERT_EQ(cleanOperation.process(), STORAGE_OK);
+    unsigned cleanRequestsCount = cleanDriver.requestsCount;
+
+    storage.clear();
+    flakyDriver.vectored = false;
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &flakyDriver, minMemoryEraseSize);
+    sat->bind();
+    ASSERT_EQ(sat->save(address, shortPrefix, 1, wdata.get(), dataLen), STORAGE_BUSY);
+
+    storage.clear();
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &flakyDriver, minMemoryEraseSize);
+    sat->bind();
+    StorageOperation operation(sat.get());
+    operation.startFind(FIND_MODE_EMPTY, &address);
+    ASSERT_EQ(processOperation(&operation), STORAGE_OK);
+
+    flakyDriver.requestsCount = 0;
+    operation.startSave(address, shortPrefix, 1, wdata.get(), dataLen);
+    ASSERT_EQ(processOperation(&operation), STORAGE_OK);
+    EXPECT_EQ(flakyDriver.requestsCount, cleanRequestsCount);
+
+    operation.startLoad(address, rdata.get(), dataLen);
+    ASSERT_EQ(processOperation(&operation), STORAGE_OK);
+    ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+
+    operation.startFormat();
+    ASSERT_EQ(processOperation(&operation), STORAGE_OK);
+    operation.startFind(FIND_MODE_EQUAL, &address, shortPrefix, 1);
+    ASSERT_EQ(processOperation(&operation), STORAGE_NOT_FOUND);
+}
+
+TEST_F(StorageFixture, AsyncOperationRestartsAfterChange)
+{
+    const uint32_t dataLen = STORAGE_PAGE_PAYLOAD_SIZE * 3;
+    std::unique_ptr<uint8_t[]> wdata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> odata = std::make_unique<uint8_t[]>(dataLen);
+    std::unique_ptr<uint8_t[]> rdata = std::make_unique<uint8_t[]>(dataLen);
+    AsyncStorageDriver asyncDriver;
+
+    memset(wdata.get(), 0xA5, dataLen);
+    memset(odata.get(), 0x3C, dataLen);
+
+    // Another call saves the data to the same macroblock after every operation process() call
+    bool interrupted = true;
+    for (unsigned steps = 1; interrupted; steps++) {
+        sat = std::make_unique<StorageAT>(storage.getPagesCount(), &asyncDriver, minMemoryEraseSize);
+        sat->bind();
+        ASSERT_EQ(sat->format(), STORAGE_OK);
+        ASSERT_EQ(sat->find(FIND_MODE_EMPTY, &address), STORAGE_OK);
+
+        StorageOperation operation(sat.get());
+        operation.startSave(address, "aaa", 1, wdata.get(), dataLen);
+        for (unsigned i = 0; i < steps && !operation.isDone(); i++) {
+            operation.process();
+        }
+        interrupted = !operation.isDone();
+
+        uint32_t otherAddress = address + 10 * STORAGE_PAGE_SIZE;
+        ASSERT_EQ(sat->save(otherAddress, "bbb", 1, odata.get(), dataLen), STORAGE_OK);
+        ASSERT_EQ(processOperation(&operation), STORAGE_OK);
+
+        sat = std::make_unique<StorageAT>(storage.getPagesCount(), &asyncDriver, minMemoryEraseSize);
+        sat->bind();
+        uint32_t foundAddress = 0;
+        ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &foundAddress, "bbb", 1), STORAGE_OK) << steps;
+        ASSERT_EQ(foundAddress, otherAddress);
+        ASSERT_EQ(sat->load(foundAddress, rdata.get(), dataLen), STORAGE_OK);
+        ASSERT_FALSE(memcmp(odata.get(), rdata.get(), dataLen));
+        ASSERT_EQ(sat->find(FIND_MODE_EQUAL, &foundAddress, "aaa", 1), STORAGE_OK) << steps;
+        ASSERT_EQ(foundAddress, address);
+        ASSERT_EQ(sat->load(foundAddress, rdata.get(), dataLen), STORAGE_OK);
+        ASSERT_FALSE(memcmp(wdata.get(), rdata.get(), dataLen));
+    }
+}
+
+TEST_F(StorageFixture, OperationForwardsDriverCapabilities)
+{
+    VectoredStorageDriver vectoredDriver;
+
+    sat = std::make_unique<StorageAT>(storage.getPagesCount(), &vectoredDriver, minMemoryEraseSize);
+    sat->bind();
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+    vectoredDriver.requestsCount = 0;
+    ASSERT_EQ(sat->format(), STORAGE_OK);
+    unsigned formatRequestsCount = vectoredDriver.requestsCount;
+
+    // The headers of several macroblocks are saved by one writev request through the journal
+    StorageOperation operation(sat.get());
+    vectoredDriver.requestsCount = 0;
+    operation.startFormat();
+    ASSERT_EQ(operation.process(), STORAGE_OK);
+    EXPECT_EQ(vectoredDriver.requestsCount, formatRequestsCount);
+
+    vectoredDriver.vectored = false;
+    vectoredDriver.requestsCount = 0;
+    operation.startFormat();
+    ASSERT_EQ(operation.process(), STORAGE_OK);
+    EXPECT_GT(vectoredDriver.requestsCount, formatRequestsCount);
+}
+
 /*
  * Tasks:
  * 1. if true header will be blocked, how to find out that?